@@ -181,6 +181,12 @@ DYNAMIC_EXPORT viennamesh_error viennamesh_data_conversion_register(viennamesh_c
                                                                     const char * data_type_from,
                                                                     const char * data_type_to,
                                                                     viennamesh_data_convert_function convert_function);
+/* cost is a relative hint for planning multi-step conversions (default is 1), the cheapest chain is used */
+DYNAMIC_EXPORT viennamesh_error viennamesh_data_conversion_register_with_cost(viennamesh_context context,
+                                                                              const char * data_type_from,
+                                                                              const char * data_type_to,
+                                                                              viennamesh_data_convert_function convert_function,
+                                                                              double cost);
 
 DYNAMIC_EXPORT viennamesh_error viennamesh_data_wrapper_convert(viennamesh_data_wrapper data_from,
                                                                 viennamesh_data_wrapper data_to);
@@ -189,6 +195,9 @@ DYNAMIC_EXPORT viennamesh_error viennamesh_data_wrapper_convert_to(viennamesh_da
                                                                    const char * data_type_to,
                                                                    viennamesh_data_wrapper * data_to);
 
+/* Drops all cached conversions of data, has to be called after the internal data was modified in place */
+DYNAMIC_EXPORT viennamesh_error viennamesh_data_wrapper_invalidate_conversions(viennamesh_data_wrapper data);
+
 
 
 /*****************************************************************************************************
@@ -250,6 +259,9 @@ DYNAMIC_EXPORT viennamesh_error viennamesh_algorithm_link_input(viennamesh_algor
 DYNAMIC_EXPORT viennamesh_error viennamesh_algorithm_get_input(viennamesh_algorithm_wrapper algorithm,
                                                                const char * name,
                                                                viennamesh_data_wrapper * data);
+/* A converted input is cached at the source data and shared by all consumers requesting the same type,
+   it must not be modified in place. Data modified in place has to be marked with
+   viennamesh_data_wrapper_invalidate_conversions. */
 DYNAMIC_EXPORT viennamesh_error viennamesh_algorithm_get_input_with_type(viennamesh_algorithm_wrapper algorithm,
                                                                          const char * name,
                                                                          const char * data_type,
@@ -305,6 +317,9 @@ DYNAMIC_EXPORT viennamesh_error viennamesh_log_set_warning_level(int log_level);
 DYNAMIC_EXPORT viennamesh_error viennamesh_log_set_debug_level(int log_level);
 DYNAMIC_EXPORT viennamesh_error viennamesh_log_set_stack_level(int log_level);
 
+/* log levels of the calling thread only, a negative level uses the global level */
+DYNAMIC_EXPORT viennamesh_error viennamesh_log_set_thread_levels(int info_level, int error_level, int warning_level, int debug_level, int stack_level);
+
 
 DYNAMIC_EXPORT viennamesh_error viennamesh_log_add_logging_file(char const * filename, viennamesh_log_callback_handle * handle);
 
@@ -0,0 +1,537 @@
+#ifndef VIENNAMESH_CORE_AABB_TREE_HPP
+#define VIENNAMESH_CORE_AABB_TREE_HPP
+
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+
+                    http://viennamesh.sourceforge.net/
+
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <queue>
+#include <cmath>
+
+#include "viennagrid/viennagrid.hpp"
+#include "viennagrid/algorithm/distance.hpp"
+
+namespace viennamesh
+{
+
+  // Bounding volume hierarchy over the axis aligned bounding boxes of a set of
+  // elements. The elements are stored in tree order, every leaf references a
+  // contiguous range of them. Supports nearest element queries (subtrees are
+  // pruned by their box distance to the query point), point location and
+  // segment queries.
+  template<typename ElementT>
+  class aabb_tree
+  {
+  public:
+
+    typedef ElementT                                                    ElementType;
+    typedef typename viennagrid::result_of::point<ElementT>::type       PointType;
+    typedef typename viennagrid::result_of::coord<PointType>::type      CoordType;
+
+    typedef std::vector<ElementType>                                    ElementContainerType;
+
+    aabb_tree() : dimension(0), max_leaf_size(4) {}
+
+    template<typename ElementIteratorT>
+    aabb_tree(ElementIteratorT const & begin, ElementIteratorT const & end, int max_leaf_size_ = 4) :
+        dimension(0), max_leaf_size(max_leaf_size_ < 1 ? 1 : max_leaf_size_)
+    {
+      for (ElementIteratorT it = begin; it != end; ++it)
+        elements_.push_back(*it);
+
+      build();
+    }
+
+    bool empty() const { return elements_.empty(); }
+    std::size_t size() const { return elements_.size(); }
+
+    // elements in tree order, indices returned by the queries refer to this container
+    ElementContainerType const & elements() const { return elements_; }
+    ElementType const & element(std::size_t index) const { return elements_[index]; }
+
+
+    // Returns the index of the element nearest to pt according to distance_functor(pt, element)
+    // and stores its distance in min_distance. Returns -1 if the tree is empty.
+    template<typename DistanceFunctorT>
+    int nearest(PointType const & pt, DistanceFunctorT distance_functor, CoordType & min_distance) const
+    {
+      NearestStackType stack;
+      return nearest(pt, distance_functor, min_distance, -1, stack);
+    }
+
+    int nearest(PointType const & pt, CoordType & min_distance) const
+    {
+      return nearest(pt, euclidean_distance(), min_distance);
+    }
+
+
+    // Nearest element queries for count points, coordinate d of point i is coords[d*count+i].
+    // The nearest element of the previous point bounds the search of the next one and the
+    // traversal stack is reused, which is cheaper than single queries for coherent points.
+    // indices[i] is -1 if the tree is empty.
+    template<typename DistanceFunctorT>
+    void nearest(std::size_t count, int point_dimension, CoordType const * coords,
+                 DistanceFunctorT distance_functor, int * indices, CoordType * min_distances) const
+    {
+      NearestStackType stack;
+      PointType pt(point_dimension);
+
+      int start = -1;
+      for (std::size_t i = 0; i != count; ++i)
+      {
+        for (int d = 0; d != point_dimension; ++d)
+          pt[d] = coords[d*count+i];
+
+        indices[i] = nearest(pt, distance_functor, min_distances[i], start, stack);
+        start = indices[i];
+      }
+    }
+
+    void nearest(std::size_t count, int point_dimension, CoordType const * coords,
+                 int * indices, CoordType * min_distances) const
+    {
+      nearest(count, point_dimension, coords, euclidean_distance(), indices, min_distances);
+    }
+
+
+    // Calls visitor(index, distance) for the elements in order of non-decreasing
+    // distance_functor(pt, element) until the visitor returns true. Only the
+    // subtrees which may contain the next nearest element are opened.
+    template<typename DistanceFunctorT, typename VisitorT>
+    bool for_each_by_distance(PointType const & pt, DistanceFunctorT distance_functor, VisitorT & visitor) const
+    {
+      if (empty())
+        return false;
+
+      // box distances are scaled down slightly, they have to stay lower bounds after rounding
+      CoordType const scale = 1.0 - 16*std::numeric_limits<CoordType>::epsilon();
+
+      std::priority_queue<queue_entry> queue;
+      queue.push( queue_entry(std::sqrt(box_distance_squared(0, pt))*scale, 0, false) );
+
+      while (!queue.empty())
+      {
+        queue_entry entry = queue.top();
+        queue.pop();
+
+        if (entry.is_element)
+        {
+          if (visitor(entry.index, entry.distance))
+            return true;
+          continue;
+        }
+
+        node_type const & node = nodes[entry.index];
+        if (node.is_leaf())
+        {
+          for (std::size_t i = node.first; i != node.first+node.count; ++i)
+            queue.push( queue_entry(distance_functor(pt, elements_[i]), i, true) );
+          continue;
+        }
+
+        queue.push( queue_entry(std::sqrt(box_distance_squared(entry.index+1, pt))*scale, entry.index+1, false) );
+        queue.push( queue_entry(std::sqrt(box_distance_squared(node.right, pt))*scale, node.right, false) );
+      }
+
+      return false;
+    }
+
+
+    // Calls visitor(index) for every element whose bounding box contains pt. The
+    // traversal stops as soon as the visitor returns true, the function then returns true.
+    template<typename VisitorT>
+    bool for_each_containing(PointType const & pt, VisitorT & visitor) const
+    {
+      if (empty())
+        return false;
+
+      std::vector<std::size_t> stack;
+      stack.push_back(0);
+
+      while (!stack.empty())
+      {
+        std::size_t node_index = stack.back();
+        stack.pop_back();
+
+        if (!box_contains(node_index, pt))
+          continue;
+
+        node_type const & node = nodes[node_index];
+        if (node.is_leaf())
+        {
+          for (std::size_t i = node.first; i != node.first+node.count; ++i)
+          {
+            if (element_box_contains(i, pt) && visitor(i))
+              return true;
+          }
+          continue;
+        }
+
+        stack.push_back(node.right);
+        stack.push_back(node_index+1);
+      }
+
+      return false;
+    }
+
+
+    // Calls visitor(index) for every element whose bounding box, enlarged by
+    // tolerance, intersects the segment [p0, p1]. The traversal stops as soon
+    // as the visitor returns true, the function then returns true.
+    template<typename VisitorT>
+    bool for_each_intersecting_segment(PointType const & p0, PointType const & p1, CoordType tolerance, VisitorT & visitor) const
+    {
+      if (empty())
+        return false;
+
+      std::vector<std::size_t> stack;
+      stack.push_back(0);
+
+      while (!stack.empty())
+      {
+        std::size_t node_index = stack.back();
+        stack.pop_back();
+
+        if (!bounds_intersect_segment(&node_bounds[2*dimension*node_index], p0, p1, tolerance))
+          continue;
+
+        node_type const & node = nodes[node_index];
+        if (node.is_leaf())
+        {
+          for (std::size_t i = node.first; i != node.first+node.count; ++i)
+          {
+            if (bounds_intersect_segment(&element_bounds[2*dimension*i], p0, p1, tolerance) && visitor(i))
+              return true;
+          }
+          continue;
+        }
+
+        stack.push_back(node.right);
+        stack.push_back(node_index+1);
+      }
+
+      return false;
+    }
+
+  private:
+
+    typedef std::vector< std::pair<std::size_t, CoordType> > NearestStackType;
+
+    // nearest element query using the distance of element start (if >= 0) as initial upper bound
+    template<typename DistanceFunctorT>
+    int nearest(PointType const & pt, DistanceFunctorT distance_functor, CoordType & min_distance,
+                int start, NearestStackType & stack) const
+    {
+      int min_index = -1;
+      min_distance = std::numeric_limits<CoordType>::max();
+
+      if (empty())
+        return min_index;
+
+      if (start >= 0 && start < static_cast<int>(elements_.size()))
+      {
+        min_distance = distance_functor(pt, elements_[start]);
+        min_index = start;
+      }
+
+      stack.clear();
+      stack.push_back( std::make_pair(std::size_t(0), box_distance_squared(0, pt)) );
+
+      while (!stack.empty())
+      {
+        std::size_t node_index = stack.back().first;
+        CoordType node_distance_squared = stack.back().second;
+        stack.pop_back();
+
+        // the tolerance keeps subtrees whose box distance only differs by rounding from the current minimum
+        if (min_index >= 0 && node_distance_squared > min_distance*min_distance*(1.0 + 16*std::numeric_limits<CoordType>::epsilon()))
+          continue;
+
+        node_type const & node = nodes[node_index];
+        if (node.is_leaf())
+        {
+          for (std::size_t i = node.first; i != node.first+node.count; ++i)
+          {
+            CoordType current_distance = distance_functor(pt, elements_[i]);
+            if (min_index < 0 || current_distance < min_distance)
+            {
+              min_distance = current_distance;
+              min_index = i;
+            }
+          }
+          continue;
+        }
+
+        CoordType left_distance_squared = box_distance_squared(node_index+1, pt);
+        CoordType right_distance_squared = box_distance_squared(node.right, pt);
+
+        // the nearer child is pushed last and therefore visited first
+        if (left_distance_squared < right_distance_squared)
+        {
+          stack.push_back( std::make_pair(node.right, right_distance_squared) );
+          stack.push_back( std::make_pair(node_index+1, left_distance_squared) );
+        }
+        else
+        {
+          stack.push_back( std::make_pair(node_index+1, left_distance_squared) );
+          stack.push_back( std::make_pair(node.right, right_distance_squared) );
+        }
+      }
+
+      return min_index;
+    }
+
+
+    struct euclidean_distance
+    {
+      CoordType operator()(PointType const & pt, ElementType const & element) const
+      { return viennagrid::distance(pt, element); }
+    };
+
+    // nodes are stored in depth first order, the left child of an inner node
+    // directly follows its parent
+    struct node_type
+    {
+      node_type() : first(0), count(0), right(0) {}
+
+      bool is_leaf() const { return count != 0; }
+
+      std::size_t first;
+      std::size_t count;
+      std::size_t right;
+    };
+
+    // entry of the best first traversal, std::priority_queue pops the largest entry
+    // so the comparison is inverted; on equal distance elements come before nodes
+    struct queue_entry
+    {
+      queue_entry(CoordType distance_, std::size_t index_, bool is_element_) :
+          distance(distance_), index(index_), is_element(is_element_) {}
+
+      bool operator<(queue_entry const & rhs) const
+      {
+        if (distance != rhs.distance)
+          return distance > rhs.distance;
+        return !is_element && rhs.is_element;
+      }
+
+      CoordType distance;
+      std::size_t index;
+      bool is_element;
+    };
+
+    struct centroid_less
+    {
+      centroid_less(std::vector<CoordType> const & centroids_, int dimension_, int axis_) :
+          centroids(centroids_), dimension(dimension_), axis(axis_) {}
+
+      bool operator()(std::size_t lhs, std::size_t rhs) const
+      { return centroids[lhs*dimension+axis] < centroids[rhs*dimension+axis]; }
+
+      std::vector<CoordType> const & centroids;
+      int dimension;
+      int axis;
+    };
+
+
+    void build()
+    {
+      if (elements_.empty())
+        return;
+
+      std::vector<CoordType> boxes;
+      std::vector<CoordType> centroids;
+      for (std::size_t i = 0; i != elements_.size(); ++i)
+      {
+        std::pair<PointType, PointType> bb = viennagrid::bounding_box(elements_[i]);
+        if (i == 0)
+        {
+          dimension = bb.first.size();
+          boxes.resize( 2*dimension*elements_.size() );
+          centroids.resize( dimension*elements_.size() );
+        }
+
+        for (int d = 0; d != dimension; ++d)
+        {
+          boxes[2*dimension*i+d] = bb.first[d];
+          boxes[2*dimension*i+dimension+d] = bb.second[d];
+          centroids[dimension*i+d] = (bb.first[d]+bb.second[d])/2.0;
+        }
+      }
+
+      std::vector<std::size_t> order( elements_.size() );
+      for (std::size_t i = 0; i != order.size(); ++i)
+        order[i] = i;
+
+      nodes.reserve( 2*elements_.size()/max_leaf_size + 1 );
+      build_node(order, boxes, centroids, 0, order.size());
+
+      // store elements and their boxes in tree order
+      ElementContainerType ordered_elements;
+      ordered_elements.reserve( elements_.size() );
+      element_bounds.resize( boxes.size() );
+      for (std::size_t i = 0; i != order.size(); ++i)
+      {
+        ordered_elements.push_back( elements_[order[i]] );
+        std::copy( boxes.begin() + 2*dimension*order[i], boxes.begin() + 2*dimension*(order[i]+1),
+                   element_bounds.begin() + 2*dimension*i );
+      }
+      elements_.swap(ordered_elements);
+    }
+
+    std::size_t build_node(std::vector<std::size_t> & order,
+                           std::vector<CoordType> const & boxes,
+                           std::vector<CoordType> const & centroids,
+                           std::size_t first, std::size_t last)
+    {
+      std::size_t node_index = nodes.size();
+      nodes.push_back( node_type() );
+      node_bounds.resize( node_bounds.size() + 2*dimension );
+
+      std::vector<CoordType> centroid_min( dimension, std::numeric_limits<CoordType>::max() );
+      std::vector<CoordType> centroid_max( dimension, -std::numeric_limits<CoordType>::max() );
+
+      CoordType * bounds = &node_bounds[2*dimension*node_index];
+      for (int d = 0; d != dimension; ++d)
+      {
+        bounds[d] = std::numeric_limits<CoordType>::max();
+        bounds[dimension+d] = -std::numeric_limits<CoordType>::max();
+      }
+
+      for (std::size_t i = first; i != last; ++i)
+      {
+        for (int d = 0; d != dimension; ++d)
+        {
+          bounds[d] = std::min( bounds[d], boxes[2*dimension*order[i]+d] );
+          bounds[dimension+d] = std::max( bounds[dimension+d], boxes[2*dimension*order[i]+dimension+d] );
+          centroid_min[d] = std::min( centroid_min[d], centroids[dimension*order[i]+d] );
+          centroid_max[d] = std::max( centroid_max[d], centroids[dimension*order[i]+d] );
+        }
+      }
+
+      if (last-first <= static_cast<std::size_t>(max_leaf_size))
+      {
+        nodes[node_index].first = first;
+        nodes[node_index].count = last-first;
+        return node_index;
+      }
+
+      // median split along the axis with the largest centroid extent
+      int axis = 0;
+      for (int d = 1; d != dimension; ++d)
+      {
+        if (centroid_max[d]-centroid_min[d] > centroid_max[axis]-centroid_min[axis])
+          axis = d;
+      }
+
+      std::size_t middle = first + (last-first)/2;
+      std::nth_element( order.begin()+first, order.begin()+middle, order.begin()+last,
+                        centroid_less(centroids, dimension, axis) );
+
+      build_node(order, boxes, centroids, first, middle);
+      std::size_t right = build_node(order, boxes, centroids, middle, last);
+      nodes[node_index].right = right;
+
+      return node_index;
+    }
+
+
+    CoordType box_distance_squared(std::size_t node_index, PointType const & pt) const
+    {
+      CoordType const * bounds = &node_bounds[2*dimension*node_index];
+
+      CoordType result = 0;
+      for (int d = 0; d != dimension; ++d)
+      {
+        CoordType delta = 0;
+        if (pt[d] < bounds[d])
+          delta = bounds[d]-pt[d];
+        else if (pt[d] > bounds[dimension+d])
+          delta = pt[d]-bounds[dimension+d];
+        result += delta*delta;
+      }
+
+      return result;
+    }
+
+    bool box_contains(std::size_t node_index, PointType const & pt) const
+    {
+      return bounds_contain(&node_bounds[2*dimension*node_index], pt);
+    }
+
+    bool element_box_contains(std::size_t element_index, PointType const & pt) const
+    {
+      return bounds_contain(&element_bounds[2*dimension*element_index], pt);
+    }
+
+    bool bounds_contain(CoordType const * bounds, PointType const & pt) const
+    {
+      for (int d = 0; d != dimension; ++d)
+      {
+        if (pt[d] < bounds[d] || pt[d] > bounds[dimension+d])
+          return false;
+      }
+      return true;
+    }
+
+
+    // slab test of the segment p0 + t*(p1-p0), t in [0,1], against the enlarged box
+    bool bounds_intersect_segment(CoordType const * bounds, PointType const & p0, PointType const & p1, CoordType tolerance) const
+    {
+      CoordType t_min = 0;
+      CoordType t_max = 1;
+
+      for (int d = 0; d != dimension; ++d)
+      {
+        CoordType lower = bounds[d] - tolerance;
+        CoordType upper = bounds[dimension+d] + tolerance;
+        CoordType direction = p1[d]-p0[d];
+
+        if (direction == 0)
+        {
+          if (p0[d] < lower || p0[d] > upper)
+            return false;
+          continue;
+        }
+
+        CoordType t0 = (lower-p0[d]) / direction;
+        CoordType t1 = (upper-p0[d]) / direction;
+        if (t0 > t1)
+          std::swap(t0, t1);
+
+        t_min = std::max(t_min, t0);
+        t_max = std::min(t_max, t1);
+        if (t_min > t_max)
+          return false;
+      }
+
+      return true;
+    }
+
+
+    ElementContainerType elements_;
+
+    std::vector<node_type> nodes;
+    std::vector<CoordType> node_bounds;
+    std::vector<CoordType> element_bounds;
+
+    int dimension;
+    int max_leaf_size;
+  };
+
+}
+
+#endif
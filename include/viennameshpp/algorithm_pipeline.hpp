@@ -42,6 +42,23 @@ namespace viennamesh
   };
 
 
+  // wall-clock trace of one algorithm, times in seconds relative to the start of the pipeline run
+  struct algorithm_pipeline_trace_entry
+  {
+    algorithm_pipeline_trace_entry() : worker(-1), start_time(-1.0), end_time(-1.0) {}
+
+    double duration() const { return end_time - start_time; }
+
+    std::string name;
+    std::string type;
+    std::vector<std::size_t> dependencies;
+
+    int worker;
+    double start_time;
+    double end_time;
+  };
+
+
   class algorithm_pipeline
   {
   public:
@@ -53,16 +70,33 @@ namespace viennamesh
 
     bool run(bool cleanup_after_algorithm_step = false);
 
+    // Runs the pipeline as a dependency graph (default_source and dynamic parameters)
+    // on a work-stealing thread pool with at most worker_count workers (<= 0: one per core).
+    // Independent branches are executed concurrently, per-algorithm log levels apply to the worker
+    // running the algorithm. Netgen and vgmodeler algorithms are never run concurrently with each other.
+    bool run_parallel(int worker_count = 0, bool cleanup_after_algorithm_step = false);
+
+    // logs the per-algorithm wall-clock trace and the critical path of the last run
+    void log_trace() const;
+    // writes the trace of the last run as CSV (name;type;worker;start;end;duration;critical)
+    bool write_trace(std::string const & filename) const;
+
     void clear();
 
     void set_base_path( std::string const & path );
 
+    std::vector<algorithm_pipeline_trace_entry> const & trace() const { return trace_; }
+    // indices into trace() of the longest dependency chain of the last run
+    std::vector<std::size_t> critical_path() const;
+
   private:
 
     algorithm_pipeline_element * get_element(std::string const & algorithm_name);
+    void init_trace(std::vector<algorithm_pipeline_element *> const & elements);
 
     viennamesh::context_handle & context;
     std::list<algorithm_pipeline_element> algorithms;
+    std::vector<algorithm_pipeline_trace_entry> trace_;
   };
 
 
@@ -47,22 +47,24 @@ namespace viennamesh
                          result_of::data_information<DataT>::delete_function());
     }
 
+    // cost is a relative hint for planning multi-step conversions, the cheapest chain is used
     void register_conversion(std::string const & data_type_from,
                              std::string const & data_type_to,
-                             viennamesh_data_convert_function convert_function);
+                             viennamesh_data_convert_function convert_function,
+                             double cost = 1.0);
 
     template<typename FromT, typename ToT>
-    void register_conversion(viennamesh_data_convert_function convert_function)
+    void register_conversion(viennamesh_data_convert_function convert_function, double cost = 1.0)
     {
       register_conversion(result_of::data_information<FromT>::type_name(),
                           result_of::data_information<ToT>::type_name(),
-                          convert_function);
+                          convert_function, cost);
     }
 
     template<typename FromT, typename ToT>
-    void register_conversion()
+    void register_conversion(double cost = 1.0)
     {
-      register_conversion<FromT, ToT>(generic_convert<FromT, ToT> );
+      register_conversion<FromT, ToT>(generic_convert<FromT, ToT>, cost);
     }
 
 
@@ -167,10 +169,10 @@ namespace viennamesh
   }
 
   template<typename FromT, typename ToT>
-  void register_conversion(viennamesh_context ctx)
+  void register_conversion(viennamesh_context ctx, double cost = 1.0)
   {
     context_handle context(ctx);
-    context.register_conversion<FromT, ToT>();
+    context.register_conversion<FromT, ToT>(cost);
   }
 
 
@@ -31,6 +31,9 @@ namespace viennamesh
     int size() const;
     void resize(int size_);
 
+    // has to be called after the data was modified in place, drops cached conversions
+    void invalidate_conversions();
+
     viennamesh_data_wrapper internal() const;
 
     std::string type_name() const;
@@ -136,6 +139,7 @@ namespace viennamesh
     void set(int position, CPPType const & data_in)
     {
       to_c( data_in, *get_ptr(position) );
+      invalidate_conversions();
     }
 
     void set(CPPType const & data_in)
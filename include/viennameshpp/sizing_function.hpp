@@ -16,54 +16,163 @@
 =============================================================================== */
 
 #include "viennameshpp/forwards.hpp"
+#include "viennameshpp/aabb_tree.hpp"
+#include "viennameshpp/thread_pool.hpp"
 #include "viennagrid/viennagrid.hpp"
 
+#include <map>
+
 #include "pugixml.hpp"
 
 namespace viennamesh
 {
   namespace sizing_function
   {
+    // Point location on a uniform grid over the cell bounding boxes of a mesh of
+    // arbitrary dimension. Every grid bucket references the cells whose (scaled)
+    // bounding box overlaps it. Single cell lookups first try the last cell hit by
+    // the calling thread and its facet neighbours, which is the common case for
+    // coherent queries.
     class fast_is_inside
     {
     public:
 
       typedef viennagrid::mesh                                  MeshType;
       typedef viennagrid::result_of::point<MeshType>::type      PointType;
+      typedef viennagrid::result_of::coord<PointType>::type     CoordType;
       typedef viennagrid::result_of::element<MeshType>::type    ElementType;
 
       typedef std::vector<ElementType> ElementContainerType;
 
+      // counts_ holds the grid resolution per axis, missing axes use the last given value
+      fast_is_inside(MeshType const & mesh_,
+                     std::vector<int> const & counts_,
+                     double mesh_bounding_box_scale, double cell_scale);
       fast_is_inside(MeshType const & mesh_,
                      int count_x_, int count_y_,
                      double mesh_bounding_box_scale, double cell_scale);
+
+      // all cells containing p
       ElementContainerType operator()(PointType const & p) const;
 
-    private:
+      // one cell containing p
+      optional<ElementType> locate(PointType const & p) const;
+
+      // one cell per point for count points, coordinate d of point i is coords[d*count+i],
+      // cell_indices[i] is -1 if no cell contains point i. The whole batch is walked from
+      // the previous hit, with one hint update at the end.
+      void locate(std::size_t count, int dimension, CoordType const * coords, long * cell_indices) const;
+      ElementType const & cell(long index) const { return cells[index]; }
 
-      int index_x(PointType const & p) const
+      // approximate memory used by the point location structures in bytes
+      std::size_t memory_size() const
       {
-        return (p[0]-min[0]) * (static_cast<double>(count_x)/(max[0]-min[0]));
+        return cells.size()*sizeof(ElementType) +
+               (neighbor_offsets.size() + neighbor_cells.size() + bucket_offsets.size() + bucket_cells.size())*sizeof(std::size_t);
       }
 
-      int index_y(PointType const & p) const
+    private:
+
+      void init(std::vector<int> const & counts_,
+                double mesh_bounding_box_scale, double cell_scale);
+
+      // index of a cell containing p starting the search at cell start (if >= 0), -1 if there is none
+      long locate_index(PointType const & p, long start) const;
+
+      int index(PointType const & p, int axis) const
       {
-        return (p[1]-min[1]) * (static_cast<double>(count_y)/(max[1]-min[1]));
+        return (p[axis]-min[axis]) * (static_cast<double>(counts[axis])/(max[axis]-min[axis]));
       }
 
+      // index of the grid bucket containing p, -1 if p is outside of the grid
       int index(PointType const & p) const
       {
-        return index_y(p)*count_x+index_x(p);
+        int result = 0;
+        for (int axis = static_cast<int>(counts.size())-1; axis >= 0; --axis)
+        {
+          int i = index(p, axis);
+          if (p[axis] < min[axis] || i >= counts[axis])
+            return -1;
+          result = result*counts[axis] + i;
+        }
+        return result;
       }
 
       MeshType mesh;
-      std::vector<ElementContainerType> grid_elements;
+
+      ElementContainerType cells;
+
+      // facet neighbours of cell i are neighbor_cells[neighbor_offsets[i]...neighbor_offsets[i+1]]
+      std::vector<std::size_t> neighbor_offsets;
+      std::vector<std::size_t> neighbor_cells;
+
+      // cells of bucket i are bucket_cells[bucket_offsets[i]...bucket_offsets[i+1]]
+      std::vector<std::size_t> bucket_offsets;
+      std::vector<std::size_t> bucket_cells;
 
       PointType min;
       PointType max;
 
-      int count_x;
-      int count_y;
+      std::vector<int> counts;
+    };
+
+
+
+
+    // Background mesh read from a file for the mesh_quantity and mesh_gradient
+    // functors. Background meshes are shared between all functors using the same
+    // file, the scalar vertex quantities are read with the mesh, gradients and point
+    // location grids are created on first use.
+    // Meshes are identified by file name and modification time and are kept in a
+    // process wide least recently used cache after the last functor released them,
+    // until their estimated memory exceeds the cache size.
+    class background_mesh
+    {
+    public:
+
+      typedef viennagrid::mesh                                  MeshType;
+      typedef viennagrid::quantity_field                        QuantityFieldType;
+
+      static shared_ptr<background_mesh> get(std::string const & filename);
+
+      // cache size in bytes, the default can be set in MiB by the environment
+      // variable VIENNAMESH_BACKGROUND_MESH_CACHE_SIZE
+      static std::size_t cache_size();
+      static void set_cache_size(std::size_t bytes);
+
+      // approximate memory of the mesh and all data created for it in bytes
+      std::size_t memory_size() const;
+
+      MeshType const & mesh() const { return mesh_; }
+
+      QuantityFieldType const & vertex_quantity(std::string const & quantity_name);
+      QuantityFieldType const & cell_gradient(std::string const & quantity_name);
+
+      shared_ptr<fast_is_inside> locator(std::vector<int> const & resolution,
+                                         double mesh_bounding_box_scale, double cell_scale);
+
+    private:
+
+      // creates an empty placeholder, the file is read by load
+      background_mesh(std::string const & filename_);
+
+      // reads the file if this was not done yet, called without the cache lock so
+      // that only users of this mesh wait for the file
+      void load();
+      void add_memory_size(std::size_t bytes);
+
+      std::string filename;
+      MeshType mesh_;
+      bool loaded_;
+
+      std::map<std::string, QuantityFieldType> vertex_quantities;
+      std::map<std::string, QuantityFieldType> cell_gradients;
+      std::map<std::string, shared_ptr<fast_is_inside> > locators;
+
+      // updated atomically, the cache reads it without locking mutex_
+      std::size_t memory_size_;
+      // guards loading, gradients and locators
+      mutex mutex_;
     };
 
 
@@ -94,6 +203,11 @@ namespace viennamesh
 
       virtual result_type operator()( PointType const & pt ) const = 0;
 
+      // evaluates count points, coordinate d of point i is coords[d*count+i],
+      // valid[i] is 0 if there is no value for point i
+      virtual void evaluate( std::size_t count, int dimension,
+                             CoordType const * coords, CoordType * results, char * valid ) const;
+
     private:
     };
 
@@ -105,16 +219,18 @@ namespace viennamesh
     public:
       mesh_quantity_functor( std::string const & filename,
                              std::string const & quantity_name,
-                             int resolution_x, int resolution_y,
+                             std::vector<int> const & resolution,
                              double mesh_bounding_box_scale, double cell_scale);
 
       result_type operator()( PointType const & pt ) const;
+      void evaluate( std::size_t count, int dimension,
+                     CoordType const * coords, CoordType * results, char * valid ) const;
 
     private:
+      shared_ptr<background_mesh> background;
       shared_ptr<fast_is_inside> ii;
 
-      MeshType mesh;
-      QuantityFieldType quantities;
+      QuantityFieldType const * quantities;
     };
 
 
@@ -122,16 +238,18 @@ namespace viennamesh
     {
     public:
       mesh_gradient_functor( std::string const & filename, std::string const & quantity_name,
-                             int resolution_x, int resolution_y,
+                             std::vector<int> const & resolution,
                              double mesh_bounding_box_scale, double cell_scale );
 
       result_type operator()( PointType const & pt ) const;
+      void evaluate( std::size_t count, int dimension,
+                     CoordType const * coords, CoordType * results, char * valid ) const;
 
     private:
+      shared_ptr<background_mesh> background;
       shared_ptr<fast_is_inside> ii;
 
-      MeshType mesh;
-      QuantityFieldType gradient_accessor;
+      QuantityFieldType const * gradient_accessor;
     };
 
 
@@ -146,13 +264,17 @@ namespace viennamesh
                                      std::string const & region1_name );
 
       result_type operator()( PointType const & pt ) const;
+      void evaluate( std::size_t count, int dimension,
+                     CoordType const * coords, CoordType * results, char * valid ) const;
 
     private:
+      typedef aabb_tree<ElementType> InterfaceElementTreeType;
+
       MeshType mesh;
-      RegionType region0;
-      RegionType region1;
 
-      viennagrid_dimension facet_dimension;
+      // value returned if there are no interface elements (0 if region0 has no facets, -1 otherwise)
+      CoordType no_interface_distance;
+      shared_ptr<InterfaceElementTreeType> interface_elements;
     };
 
 
@@ -166,12 +288,14 @@ namespace viennamesh
                                             viennagrid_dimension topologic_dimension);
 
       result_type operator()( PointType const & pt ) const;
+      void evaluate( std::size_t count, int dimension,
+                     CoordType const * coords, CoordType * results, char * valid ) const;
 
     private:
-      typedef std::vector<ElementType> BoundaryElementContainer;
+      typedef aabb_tree<ElementType> BoundaryElementTreeType;
 
       MeshType mesh;
-      shared_ptr<BoundaryElementContainer> boundary_elements;
+      shared_ptr<BoundaryElementTreeType> boundary_elements;
     };
 
 
@@ -180,12 +304,19 @@ namespace viennamesh
     class local_feature_size_2d_functor : public base_functor
     {
     public:
-      local_feature_size_2d_functor( MeshType const & mesh_ ) : mesh(mesh_) {}
+      local_feature_size_2d_functor( MeshType const & mesh_ );
 
       result_type operator()( PointType const & pt ) const;
 
     private:
+      typedef aabb_tree<ElementType> BoundaryLineTreeType;
+      typedef std::vector< std::pair<int, int> > LineVertexContainerType;
+
       MeshType mesh;
+
+      shared_ptr<BoundaryLineTreeType> boundary_lines;
+      // vertex indices of the boundary lines, in tree order
+      shared_ptr<LineVertexContainerType> line_vertices;
     };
 
 
@@ -200,11 +331,18 @@ namespace viennamesh
                             function_type const & function_);
 
       result_type operator()( PointType const & pt ) const;
+      void evaluate( std::size_t count, int dimension,
+                     CoordType const * coords, CoordType * results, char * valid ) const;
 
     private:
+      typedef aabb_tree<ElementType> RegionCellTreeType;
+
       MeshType mesh;
       std::vector<std::string> region_names;
 
+      // cells of all regions
+      shared_ptr<RegionCellTreeType> region_cells;
+
       function_type function;
     };
 
@@ -390,6 +528,95 @@ namespace viennamesh
 
 
 
+    // Sizing function compiled into a flat postfix program. Constants and leaf
+    // functors (geometric queries) push one value per point onto a value stack,
+    // operators replace their operands on top of the stack by their result.
+    // Operands without value are ignored like in the functors above. Points are
+    // evaluated in batches: every instruction runs over the whole batch before
+    // the next one, so operators are plain loops over arrays and leaf functors
+    // see all points of the batch at once.
+    class program
+    {
+    public:
+
+      typedef viennagrid_numeric                    CoordType;
+      typedef base_functor::result_type             result_type;
+      typedef base_functor::function_type           function_type;
+
+      enum opcode
+      {
+        op_constant,              // pushes parameter 0
+        op_leaf,                  // pushes the values of a leaf functor
+        op_add,                   // n operands
+        op_mul,                   // n operands
+        op_min,                   // n operands
+        op_max,                   // n operands
+        op_abs,                   // 1 operand
+        op_less,                  // 1 operand, parameter: threshold
+        op_greater,               // 1 operand, parameter: threshold
+        op_in_interval,           // 1 operand, parameters: lower, upper
+        op_linear_interpolate,    // 1 operand, parameters: lower, upper, lower_to, upper_to
+        op_mask                   // 2 operands, the first one where the second one has a value
+      };
+
+      program() : stack_size(0), max_stack_size(0) {}
+
+      void push_constant(CoordType value);
+      void push_leaf(shared_ptr<base_functor const> const & leaf);
+      // operators on constant operands are folded into a constant
+      void push_operator(opcode op, int operand_count,
+                         std::vector<CoordType> const & op_parameters = std::vector<CoordType>());
+
+      result_type operator()(viennagrid::point const & pt) const;
+
+      // evaluates count points, coordinate d of point i is coords[d*count+i],
+      // valid[i] is 0 if there is no value for point i
+      void evaluate(std::size_t count, int dimension,
+                    CoordType const * coords, CoordType * results, char * valid) const;
+
+      bool is_constant() const { return instructions.size() == 1 && instructions[0].op == op_constant; }
+      std::size_t size() const { return instructions.size(); }
+
+      // single point function sharing a copy of this program
+      function_type function() const;
+
+    private:
+
+      struct instruction
+      {
+        opcode op;
+        int operand_count;
+        // first parameter or leaf index
+        std::size_t index;
+      };
+
+      // runs one instruction on the value stack, slot i holds values[i*count...(i+1)*count]
+      void execute(instruction const & inst, std::size_t count, int dimension, CoordType const * coords,
+                   CoordType * values, char * valid, int & top) const;
+
+      std::vector<instruction> instructions;
+      std::vector<CoordType> parameters;
+      std::vector< shared_ptr<base_functor const> > leaves;
+
+      int stack_size;
+      int max_stack_size;
+    };
+
+
+    program program_from_xml(pugi::xml_node const & node,
+                             viennagrid::const_mesh const & mesh,
+                             std::string const & base_path = "");
+
+    program program_from_xml(std::string const & xml_string,
+                             viennagrid::const_mesh const & mesh,
+                             std::string const & base_path = "");
+
+    program program_from_xmlfile(std::string const & xml_filename,
+                                 viennagrid::const_mesh const & mesh,
+                                 std::string const & base_path = "");
+
+
+
     base_functor::function_type from_xml(pugi::xml_node const & node,
                                          viennagrid::const_mesh const & mesh,
                                          std::string const & base_path = "");
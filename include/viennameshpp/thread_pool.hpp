@@ -0,0 +1,370 @@
+#ifndef VIENNAMESH_CORE_THREAD_POOL_HPP
+#define VIENNAMESH_CORE_THREAD_POOL_HPP
+
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+
+                    http://viennamesh.sourceforge.net/
+
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include <deque>
+#include <vector>
+#include <exception>
+#include <boost/function.hpp>
+#include "viennamesh/cpp_error.hpp"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// storage class for thread local plain old data
+#ifndef _WIN32
+  #define VIENNAMESH_THREAD_LOCAL __thread
+#else
+  #define VIENNAMESH_THREAD_LOCAL __declspec(thread)
+#endif
+
+namespace viennamesh
+{
+
+  // returns the number of online processors, at least 1
+  inline int hardware_concurrency()
+  {
+#ifndef _WIN32
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+      return static_cast<int>(count);
+#endif
+    return 1;
+  }
+
+
+#ifndef _WIN32
+
+  class mutex
+  {
+  public:
+    mutex() { pthread_mutex_init(&mutex_, NULL); }
+    ~mutex() { pthread_mutex_destroy(&mutex_); }
+
+    void lock() { pthread_mutex_lock(&mutex_); }
+    void unlock() { pthread_mutex_unlock(&mutex_); }
+
+  private:
+    mutex(mutex const &);
+    mutex & operator=(mutex const &);
+
+    pthread_mutex_t mutex_;
+  };
+
+#else
+
+  class mutex
+  {
+  public:
+    void lock() {}
+    void unlock() {}
+  };
+
+#endif
+
+  class scoped_lock
+  {
+  public:
+    scoped_lock(mutex & mutex_in) : mutex_(mutex_in) { mutex_.lock(); }
+    ~scoped_lock() { mutex_.unlock(); }
+
+  private:
+    scoped_lock(scoped_lock const &);
+    scoped_lock & operator=(scoped_lock const &);
+
+    mutex & mutex_;
+  };
+
+
+
+#ifndef _WIN32
+
+  // A small work-stealing thread pool. Every worker owns a task deque, tasks
+  // submitted from a worker are pushed to its own deque (LIFO for the owner),
+  // idle workers steal from the front of the other deques.
+  class thread_pool
+  {
+  public:
+
+    typedef boost::function<void ()> task_type;
+
+    thread_pool(int worker_count_ = 0) : pending_(0), next_queue_(0), shutdown_(false), exception_(0)
+    {
+      if (worker_count_ <= 0)
+        worker_count_ = hardware_concurrency();
+
+      pthread_mutex_init(&mutex_, NULL);
+      pthread_cond_init(&task_available_, NULL);
+      pthread_cond_init(&all_done_, NULL);
+
+      queues_.resize(worker_count_);
+      threads_.resize(worker_count_);
+      arguments_.resize(worker_count_);
+
+      for (int i = 0; i != worker_count_; ++i)
+      {
+        arguments_[i].pool = this;
+        arguments_[i].index = i;
+        pthread_create( &threads_[i], NULL, &thread_pool::worker_entry, (void*)&arguments_[i] );
+      }
+    }
+
+    ~thread_pool()
+    {
+      pthread_mutex_lock(&mutex_);
+      while (pending_ != 0)
+        pthread_cond_wait(&all_done_, &mutex_);
+
+      shutdown_ = true;
+      pthread_cond_broadcast(&task_available_);
+      pthread_mutex_unlock(&mutex_);
+
+      for (std::size_t i = 0; i != threads_.size(); ++i)
+        pthread_join(threads_[i], NULL);
+
+      pthread_cond_destroy(&all_done_);
+      pthread_cond_destroy(&task_available_);
+      pthread_mutex_destroy(&mutex_);
+
+      delete exception_;
+    }
+
+    int worker_count() const { return threads_.size(); }
+
+    // index of the calling worker thread, -1 if called from outside the pool
+    int current_worker() const
+    {
+      pthread_t self = pthread_self();
+      for (std::size_t i = 0; i != threads_.size(); ++i)
+        if (pthread_equal(self, threads_[i]))
+          return i;
+      return -1;
+    }
+
+    void submit(task_type const & task)
+    {
+      pthread_mutex_lock(&mutex_);
+
+      int index = current_worker();
+      if (index < 0)
+      {
+        index = next_queue_;
+        next_queue_ = (next_queue_+1) % queues_.size();
+      }
+
+      queues_[index].push_back(task);
+      ++pending_;
+
+      pthread_cond_signal(&task_available_);
+      pthread_mutex_unlock(&mutex_);
+    }
+
+    // blocks until every submitted task (including tasks submitted by tasks) is finished,
+    // the first exception thrown by a task since the last wait is rethrown
+    void wait()
+    {
+      pthread_mutex_lock(&mutex_);
+      while (pending_ != 0)
+        pthread_cond_wait(&all_done_, &mutex_);
+
+      viennamesh::exception * ex = exception_;
+      exception_ = 0;
+      pthread_mutex_unlock(&mutex_);
+
+      if (ex)
+      {
+        viennamesh::exception tmp(*ex);
+        delete ex;
+        throw tmp;
+      }
+    }
+
+  private:
+
+    thread_pool(thread_pool const &);
+    thread_pool & operator=(thread_pool const &);
+
+    struct worker_argument
+    {
+      thread_pool * pool;
+      int index;
+    };
+
+    static void * worker_entry(void * data)
+    {
+      worker_argument & argument = *(worker_argument*)(data);
+      argument.pool->worker_loop(argument.index);
+      return NULL;
+    }
+
+    // has to be called with mutex_ locked
+    bool pop_task(int index, task_type & task)
+    {
+      if (!queues_[index].empty())
+      {
+        task = queues_[index].back();
+        queues_[index].pop_back();
+        return true;
+      }
+
+      for (std::size_t i = 1; i != queues_.size(); ++i)
+      {
+        std::deque<task_type> & victim = queues_[(index+i) % queues_.size()];
+        if (!victim.empty())
+        {
+          task = victim.front();
+          victim.pop_front();
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    void worker_loop(int index)
+    {
+      pthread_mutex_lock(&mutex_);
+      while (true)
+      {
+        task_type task;
+        if (pop_task(index, task))
+        {
+          pthread_mutex_unlock(&mutex_);
+
+          viennamesh::exception * ex = run_task(task);
+
+          pthread_mutex_lock(&mutex_);
+          if (ex && exception_)
+            delete ex;
+          else if (ex)
+            exception_ = ex;
+
+          if (--pending_ == 0)
+            pthread_cond_broadcast(&all_done_);
+          continue;
+        }
+
+        if (shutdown_)
+          break;
+
+        pthread_cond_wait(&task_available_, &mutex_);
+      }
+      pthread_mutex_unlock(&mutex_);
+    }
+
+    // runs task, returns a copy of the exception it threw (or NULL)
+    static viennamesh::exception * run_task(task_type const & task)
+    {
+      try
+      {
+        task();
+      }
+      catch (viennamesh::exception const & ex)
+      {
+        return new viennamesh::exception(ex);
+      }
+      catch (std::exception const & ex)
+      {
+        return new viennamesh::exception(VIENNAMESH_UNKNOWN_ERROR, "", "", -1, ex.what());
+      }
+      catch (...)
+      {
+        return new viennamesh::exception(VIENNAMESH_UNKNOWN_ERROR, "", "", -1, "Unknown exception in thread pool task");
+      }
+
+      return 0;
+    }
+
+    std::vector< std::deque<task_type> > queues_;
+    std::vector<pthread_t> threads_;
+    std::vector<worker_argument> arguments_;
+
+    pthread_mutex_t mutex_;
+    pthread_cond_t task_available_;
+    pthread_cond_t all_done_;
+
+    int pending_;
+    int next_queue_;
+    bool shutdown_;
+
+    // first exception thrown by a task, rethrown by wait
+    viennamesh::exception * exception_;
+  };
+
+#else
+
+  // no thread support: tasks are executed directly on submission
+  class thread_pool
+  {
+  public:
+
+    typedef boost::function<void ()> task_type;
+
+    thread_pool(int = 0) {}
+
+    int worker_count() const { return 1; }
+    int current_worker() const { return 0; }
+
+    void submit(task_type const & task)
+    {
+      try
+      {
+        task();
+      }
+      catch (viennamesh::exception const & ex)
+      {
+        remember(ex);
+      }
+      catch (std::exception const & ex)
+      {
+        remember( viennamesh::exception(VIENNAMESH_UNKNOWN_ERROR, "", "", -1, ex.what()) );
+      }
+      catch (...)
+      {
+        remember( viennamesh::exception(VIENNAMESH_UNKNOWN_ERROR, "", "", -1, "Unknown exception in thread pool task") );
+      }
+    }
+
+    // the first exception thrown by a task since the last wait is rethrown
+    void wait()
+    {
+      if (exception_.empty())
+        return;
+
+      viennamesh::exception tmp = exception_.front();
+      exception_.clear();
+      throw tmp;
+    }
+
+  private:
+
+    void remember(viennamesh::exception const & ex)
+    {
+      if (exception_.empty())
+        exception_.push_back(ex);
+    }
+
+    // holds at most the first exception
+    std::vector<viennamesh::exception> exception_;
+  };
+
+#endif
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include <CGAL/Simple_cartesian.h>
 #include <CGAL/Polyhedron_3.h>
 #include <CGAL/Polyhedron_incremental_builder_3.h>
+#include <CGAL/Unique_hash_map.h>
 
 namespace viennamesh
 {
@@ -57,12 +58,21 @@ namespace viennamesh
 
     std::vector<double> points(num_points*3);
 
+    // CGAL index of a vertex by its viennagrid vertex index
+    std::vector<int> vertex_index_to_cgal_index( num_points, -1 );
+
     int index=0;
     for (ConstVertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit, ++index)
     {
-      points[3*index+0]=viennagrid::get_point(input, *vit)[0];
-      points[3*index+1]=viennagrid::get_point(input, *vit)[1];
-      points[3*index+2]=viennagrid::get_point(input, *vit)[2];
+      viennagrid::result_of::point<ViennaGridMeshType>::type point = viennagrid::get_point(input, *vit);
+      points[3*index+0]=point[0];
+      points[3*index+1]=point[1];
+      points[3*index+2]=point[2];
+
+      std::size_t vertex_index = (*vit).id().index();
+      if (vertex_index >= vertex_index_to_cgal_index.size())
+        vertex_index_to_cgal_index.resize(vertex_index+1, -1);
+      vertex_index_to_cgal_index[vertex_index] = index;
     }
 
 
@@ -84,7 +94,7 @@ namespace viennamesh
       ConstBoundaryElementRangeType boundary_vertices( *cit, 0 );
       for (ConstBoundaryElementIteratorType vit = boundary_vertices.begin(); vit != boundary_vertices.end(); ++vit, ++sm_index)
       {
-        faces[3*index+sm_index]=(*vit).id().index();//3*index+sm_index;
+        faces[3*index+sm_index]=vertex_index_to_cgal_index[ (*vit).id().index() ];
       }
     }
 
@@ -95,54 +105,52 @@ namespace viennamesh
   }
 
 
-  int get_id_of_vertex(cgal::Point_3 p, cgal::mesh const & input)
-  {
-    typedef cgal::mesh::Vertex_const_iterator Vertex_iterator;
-    int pos =0;
-    {
-      Vertex_iterator begin = input.vertices_begin();
-      for ( ; begin != input.vertices_end(); ++begin, ++pos)
-        if(begin->point()==p)
-          return pos;
-    }
-    return -1;
-  }
-
   viennamesh_error convert(cgal::mesh const & input, viennagrid::mesh & output)
   {
-    typedef viennagrid::mesh                               MeshType;
-    typedef viennagrid::result_of::element<MeshType>::type VertexType;
+    typedef cgal::mesh::Vertex_const_handle                Vertex_handle;
+    typedef cgal::mesh::Halfedge_const_handle              Halfedge_handle;
     typedef cgal::mesh::Vertex_const_iterator              Vertex_iterator;
     typedef cgal::mesh::Facet_const_iterator               Facet_iterator;
-    int numberofpoints =0;
 
-    {
-      Vertex_iterator begin = input.vertices_begin();
-      for ( ; begin != input.vertices_end(); ++begin, ++numberofpoints);
-    }
-
-    std::vector<VertexType> vertex_handles(numberofpoints);
+    // viennagrid vertex of every polyhedron vertex, built in one pass over the vertices
+    CGAL::Unique_hash_map<Vertex_handle, viennagrid_element_id> vertex_ids( viennagrid_element_id(), input.size_of_vertices() );
 
     {
       Vertex_iterator begin = input.vertices_begin();
-      for (int i = 0; i < numberofpoints; ++i, ++begin)
+      for ( ; begin != input.vertices_end(); ++begin)
       {
-        vertex_handles[i] = viennagrid::make_vertex( output,
-        viennagrid::make_point(begin->point().x(),begin->point().y(),begin->point().z())
-        );
+        vertex_ids[begin] = viennagrid::make_vertex( output,
+          viennagrid::make_point(begin->point().x(),begin->point().y(),begin->point().z())
+        ).id().internal();
       }
     }
 
+    int numberoffacets = input.size_of_facets();
+    if (numberoffacets == 0)
+      return VIENNAMESH_SUCCESS;
+
+    // all triangles are created with a single batch call
+    std::vector<viennagrid_element_type> element_types(numberoffacets, VIENNAGRID_ELEMENT_TYPE_TRIANGLE);
+    std::vector<viennagrid_int> cell_vertex_offsets(numberoffacets+1);
+    std::vector<viennagrid_element_id> cell_vertex_ids(3*numberoffacets);
+
+    int index = 0;
     Facet_iterator begin = input.facets_begin();
-    for ( ; begin != input.facets_end(); ++begin)
+    for ( ; begin != input.facets_end(); ++begin, ++index)
     {
-      viennagrid::make_triangle(
-          output,
-          vertex_handles[get_id_of_vertex(begin->facet_begin()->vertex()->point(),input)],
-          vertex_handles[get_id_of_vertex(begin->facet_begin()->next()->vertex()->point(),input)],
-          vertex_handles[get_id_of_vertex(begin->facet_begin()->opposite()->vertex()->point(),input)]
-      );
+      Halfedge_handle h = begin->facet_begin();
+
+      cell_vertex_offsets[index] = 3*index;
+      cell_vertex_ids[3*index+0] = vertex_ids[ h->vertex() ];
+      cell_vertex_ids[3*index+1] = vertex_ids[ h->next()->vertex() ];
+      cell_vertex_ids[3*index+2] = vertex_ids[ h->opposite()->vertex() ];
     }
+    cell_vertex_offsets[numberoffacets] = 3*numberoffacets;
+
+    viennagrid_mesh_element_batch_create( output.internal(),
+                                          element_types.size(), &element_types[0],
+                                          &cell_vertex_offsets[0], &cell_vertex_ids[0],
+                                          NULL, NULL );
 
     return VIENNAMESH_SUCCESS;
   }
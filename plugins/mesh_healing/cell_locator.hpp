@@ -0,0 +1,109 @@
+#ifndef VIENNAMESH_ALGORITHM_MESH_HEALING_CELL_LOCATOR_HPP
+#define VIENNAMESH_ALGORITHM_MESH_HEALING_CELL_LOCATOR_HPP
+
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+
+                    http://viennamesh.sourceforge.net/
+
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include "viennameshpp/aabb_tree.hpp"
+#include "viennagrid/algorithm/inclusion.hpp"
+
+namespace viennamesh
+{
+
+  // Finds the cells of a mesh containing a point using an AABB tree over the
+  // cell bounding boxes. Queries are const and may run concurrently.
+  class cell_locator
+  {
+  public:
+
+    typedef viennagrid::mesh                                          MeshType;
+    typedef viennagrid::result_of::point<MeshType>::type              PointType;
+    typedef viennagrid::result_of::element<MeshType>::type            ElementType;
+
+    typedef std::vector<ElementType>                                  ElementContainerType;
+
+    cell_locator(MeshType const & mesh)
+    {
+      typedef viennagrid::result_of::const_cell_range<MeshType>::type   ConstCellRangeType;
+
+      ConstCellRangeType cells(mesh);
+      tree = aabb_tree<ElementType>(cells.begin(), cells.end());
+    }
+
+    // replaces the content of result by all cells containing pt
+    void operator()(PointType const & pt, ElementContainerType & result) const
+    {
+      result.clear();
+      collector visitor(tree, pt, result);
+      tree.for_each_containing(pt, visitor);
+    }
+
+  private:
+
+    struct collector
+    {
+      collector(aabb_tree<ElementType> const & tree_, PointType const & pt_, ElementContainerType & result_) :
+          tree(tree_), pt(pt_), result(result_) {}
+
+      bool operator()(std::size_t index)
+      {
+        if ( viennagrid::is_inside(tree.element(index), pt) )
+          result.push_back( tree.element(index) );
+        return false;
+      }
+
+      aabb_tree<ElementType> const & tree;
+      PointType const & pt;
+      ElementContainerType & result;
+    };
+
+    aabb_tree<ElementType> tree;
+  };
+
+
+
+  // Small xorshift generator for sampling in parallel tasks, seeded per sampled
+  // entity so results depend neither on the thread count nor on the schedule
+  class sample_generator
+  {
+  public:
+    // the seed is mixed (murmur3 finalizer), consecutive seeds give unrelated streams
+    sample_generator(unsigned int seed) : state(seed + 1u)
+    {
+      state ^= state >> 16;
+      state *= 0x85ebca6bu;
+      state ^= state >> 13;
+      state *= 0xc2b2ae35u;
+      state ^= state >> 16;
+
+      if (state == 0)
+        state = 1;
+    }
+
+    // uniformly distributed in [0,1]
+    double operator()()
+    {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      return static_cast<double>(state) / 4294967295.0;
+    }
+
+  private:
+    unsigned int state;
+  };
+
+}
+
+#endif
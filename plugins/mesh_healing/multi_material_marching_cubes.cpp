@@ -13,8 +13,11 @@
 =============================================================================== */
 
 #include <numeric>
+#include <algorithm>
+#include <functional>
 #include <boost/concept_check.hpp>
 #include "multi_material_marching_cubes.hpp"
+#include "viennameshpp/thread_pool.hpp"
 #include "viennagrid/algorithm/geometry.hpp"
 #include "viennagrid/algorithm/inclusion.hpp"
 #include "viennagrid/algorithm/centroid.hpp"
@@ -25,38 +28,79 @@ namespace viennamesh
 {
 
 
-  template<typename ValueT>
-  ValueT & access(std::vector<ValueT> & array,
-                std::vector<int> const & size,
-                std::vector<int> const & pos)
+  // Sample grid stored in blocks of block_size^3 samples. A block in which
+  // every sample has the same region only stores that region id, so memory
+  // grows with the area of the region interfaces and not with the volume of
+  // the bounding box. Samples are addressed by grid coordinates starting at 0.
+  class sparse_sample_grid
   {
-    return array[ pos[2]*size[0]*size[1] + pos[1]*size[0] + pos[0] ];
-  }
+  public:
 
-  template<typename ValueT>
-  ValueT & access_symmetric(std::vector<ValueT> & array,
-                          std::vector<int> const & size,
-                          std::vector<int> pos)
-  {
-    for (int i = 0; i != 3; ++i)
-      pos[i] += size[i]/2;
+    static const int block_size = 8;
+    static const int block_sample_count = block_size*block_size*block_size;
 
-    return access(array, size, pos);
-  }
+    sparse_sample_grid(std::vector<int> const & sample_count_) :
+        sample_count(sample_count_), block_count(3)
+    {
+      for (int i = 0; i != 3; ++i)
+        block_count[i] = (sample_count[i] + block_size - 1) / block_size;
 
-  template<typename ValueT>
-  ValueT & access_symmetric(std::vector<ValueT> & array,
-                          std::vector<int> const & size,
-                          int x, int y, int z)
-  {
-    std::vector<int> pos(3);
-    pos[0] = x;
-    pos[1] = y;
-    pos[2] = z;
-    return access_symmetric(array, size, pos);
-  }
+      uniform_regions.resize( block_count[0]*block_count[1]*block_count[2], -1 );
+      blocks.resize( uniform_regions.size() );
+    }
+
+    int block_index(int bx, int by, int bz) const
+    {
+      return (bz*block_count[1] + by)*block_count[0] + bx;
+    }
+
+    static int local_index(int x, int y, int z)
+    {
+      return ((z % block_size)*block_size + y % block_size)*block_size + x % block_size;
+    }
+
+    int operator()(int x, int y, int z) const
+    {
+      int block = block_index(x/block_size, y/block_size, z/block_size);
+      if ( blocks[block].empty() )
+        return uniform_regions[block];
+      return blocks[block][ local_index(x, y, z) ];
+    }
 
+    // takes the samples of a block, samples is left in an unspecified state
+    void set_block(int block, std::vector<int> & samples)
+    {
+      if ( std::adjacent_find(samples.begin(), samples.end(), std::not_equal_to<int>()) == samples.end() )
+        uniform_regions[block] = samples.front();
+      else
+        blocks[block].swap(samples);
+    }
+
+    // true if all samples of the block and of its upper neighbor blocks have
+    // the same region, no marching cube starting in the block has an interface
+    bool is_uniform_neighborhood(int bx, int by, int bz) const
+    {
+      int region = uniform_regions[ block_index(bx, by, bz) ];
+
+      for (int z = bz; z <= std::min(bz+1, block_count[2]-1); ++z)
+        for (int y = by; y <= std::min(by+1, block_count[1]-1); ++y)
+          for (int x = bx; x <= std::min(bx+1, block_count[0]-1); ++x)
+          {
+            int block = block_index(x, y, z);
+            if ( !blocks[block].empty() || uniform_regions[block] != region )
+              return false;
+          }
+
+      return true;
+    }
+
+    std::vector<int> sample_count;
+    std::vector<int> block_count;
 
+  private:
+    std::vector<int> uniform_regions;
+    std::vector< std::vector<int> > blocks;
+  };
 
 
 
@@ -577,6 +621,235 @@ namespace viennamesh
 
 
 
+  typedef viennagrid::mesh                                  MarchingCubesMeshType;
+  typedef viennagrid::result_of::point<MarchingCubesMeshType>::type     MarchingCubesPointType;
+  typedef viennagrid::result_of::element<MarchingCubesMeshType>::type   MarchingCubesElementType;
+
+
+  // samples all blocks of one z-layer of blocks, only the cells binned to a
+  // block are tested against its samples
+  struct sample_slab_task
+  {
+    void operator()() const
+    {
+      int const bs = sparse_sample_grid::block_size;
+      std::vector<int> const & sample_count = grid->sample_count;
+      std::vector<int> samples;
+
+      for (int by = 0; by != grid->block_count[1]; ++by)
+        for (int bx = 0; bx != grid->block_count[0]; ++bx)
+        {
+          int block = grid->block_index(bx, by, bz);
+          if ( (*block_cell_offsets)[block] == (*block_cell_offsets)[block+1] )
+            continue;
+
+          samples.assign( sparse_sample_grid::block_sample_count, -1 );
+
+          int block_min[3] = { bx*bs, by*bs, bz*bs };
+
+          for (int ci = (*block_cell_offsets)[block]; ci != (*block_cell_offsets)[block+1]; ++ci)
+          {
+            int cell = (*block_cells)[ci];
+            int region_id = (*cell_regions)[cell];
+
+            int min_index[3];
+            int max_index[3];
+            for (int i = 0; i != 3; ++i)
+            {
+              min_index[i] = std::max( (*cell_min_index)[3*cell+i], block_min[i] );
+              max_index[i] = std::min( (*cell_max_index)[3*cell+i], block_min[i]+bs-1 );
+            }
+
+            for (int z = min_index[2]; z <= max_index[2]; ++z)
+              for (int y = min_index[1]; y <= max_index[1]; ++y)
+                for (int x = min_index[0]; x <= max_index[0]; ++x)
+                {
+                  MarchingCubesPointType sample_point = *center;
+                  sample_point[0] += (x - sample_count[0]/2) * (*sample_size)[0];
+                  sample_point[1] += (y - sample_count[1]/2) * (*sample_size)[1];
+                  sample_point[2] += (z - sample_count[2]/2) * (*sample_size)[2];
+
+                  if (viennagrid::is_inside((*cells)[cell], sample_point, is_inside_tolerance))
+                  {
+                    int & sample = samples[ sparse_sample_grid::local_index(x, y, z) ];
+
+                    if ((sample == -1) || ((*region_priority)[region_id] > (*region_priority)[sample]))
+                      sample = region_id;
+                  }
+                }
+          }
+
+          grid->set_block(block, samples);
+        }
+    }
+
+    int bz;
+
+    sparse_sample_grid * grid;
+
+    std::vector<MarchingCubesElementType> const * cells;
+    std::vector<int> const * cell_regions;
+    std::vector<int> const * cell_min_index;
+    std::vector<int> const * cell_max_index;
+
+    std::vector<int> const * block_cell_offsets;
+    std::vector<int> const * block_cells;
+
+    std::vector<int> const * region_priority;
+
+    MarchingCubesPointType const * center;
+    MarchingCubesPointType const * sample_size;
+    double is_inside_tolerance;
+  };
+
+
+
+  // Marching cube points are identified by the grid point at their lower
+  // corner and a slot: 0-2 edge centers along x/y/z, 3-5 face centers normal
+  // to x/y/z and 6 the cube center. Edge and face points shared by
+  // neighboring cubes get the same key, which welds the output mesh.
+  inline long long marching_cube_point_key(marching_cube const & mc, int index,
+                                           int x, int y, int z,
+                                           std::vector<int> const & sample_count)
+  {
+    int corner = 0;
+    int slot = 6;
+
+    if (index < 12)
+    {
+      std::pair<int,int> edge = marching_cube::edge_vertices(index);
+      int axis_bit = edge.second - edge.first;
+      corner = edge.first;
+      slot = (axis_bit == 1) ? 0 : ((axis_bit == 2) ? 1 : 2);
+    }
+    else if (index < 18)
+    {
+      int const * vertex_indices = mc.faces[index-12].vertex_indices;
+      int all = vertex_indices[0] & vertex_indices[1] & vertex_indices[2] & vertex_indices[3];
+      int any = vertex_indices[0] | vertex_indices[1] | vertex_indices[2] | vertex_indices[3];
+      int normal_bit = ~(all ^ any) & 7;
+      corner = all;
+      slot = 3 + ((normal_bit == 1) ? 0 : ((normal_bit == 2) ? 1 : 2));
+    }
+
+    x += corner & 1;
+    y += (corner >> 1) & 1;
+    z += (corner >> 2) & 1;
+
+    return ((static_cast<long long>(z)*sample_count[1] + y)*sample_count[0] + x)*7 + slot;
+  }
+
+  inline MarchingCubesPointType marching_cube_point(long long key,
+                                                    std::vector<int> const & sample_count,
+                                                    MarchingCubesPointType const & center,
+                                                    MarchingCubesPointType const & sample_size)
+  {
+    int slot = key % 7;
+    key /= 7;
+
+    double pos[3];
+    pos[0] = key % sample_count[0];
+    pos[1] = (key / sample_count[0]) % sample_count[1];
+    pos[2] = key / (static_cast<long long>(sample_count[0])*sample_count[1]);
+
+    if (slot < 3)
+      pos[slot] += 0.5;
+    else if (slot < 6)
+    {
+      for (int i = 0; i != 3; ++i)
+        if (i != slot-3)
+          pos[i] += 0.5;
+    }
+    else
+    {
+      for (int i = 0; i != 3; ++i)
+        pos[i] += 0.5;
+    }
+
+    MarchingCubesPointType p = center;
+    for (int i = 0; i != 3; ++i)
+      p[i] += (pos[i] - sample_count[i]/2) * sample_size[i];
+    return p;
+  }
+
+
+  struct marching_cubes_triangles
+  {
+    std::vector<long long> vertex_keys;
+    std::vector< std::pair<int,int> > regions;
+  };
+
+  // extracts the interface triangles of all marching cubes with a lower
+  // corner in one z-layer of blocks
+  struct extract_slab_task
+  {
+    void operator()() const
+    {
+      int const bs = sparse_sample_grid::block_size;
+      std::vector<int> const & sample_count = grid->sample_count;
+
+      for (int by = 0; by != grid->block_count[1]; ++by)
+        for (int bx = 0; bx != grid->block_count[0]; ++bx)
+        {
+          if ( grid->is_uniform_neighborhood(bx, by, bz) )
+            continue;
+
+          for (int z = bz*bs; z < std::min((bz+1)*bs, sample_count[2]-1); ++z)
+            for (int y = by*bs; y < std::min((by+1)*bs, sample_count[1]-1); ++y)
+              for (int x = bx*bs; x < std::min((bx+1)*bs, sample_count[0]-1); ++x)
+              {
+                sparse_sample_grid const & samples = *grid;
+
+                int r0 = samples(x  , y  , z  );
+                int r1 = samples(x+1, y  , z  );
+                int r2 = samples(x  , y+1, z  );
+                int r3 = samples(x+1, y+1, z  );
+                int r4 = samples(x  , y  , z+1);
+                int r5 = samples(x+1, y  , z+1);
+                int r6 = samples(x  , y+1, z+1);
+                int r7 = samples(x+1, y+1, z+1);
+
+                if (r0 == r1 && r0 == r2 && r0 == r3 && r0 == r4 && r0 == r5 && r0 == r6 && r0 == r7)
+                  continue;
+
+                marching_cube mc(r0, r1, r2, r3, r4, r5, r6, r7);
+                mc.make_lines(*region_priority);
+                std::vector<poly_line> poly_lines = mc.make_poly_lines();
+
+                for (std::size_t i = 0; i != poly_lines.size(); ++i)
+                {
+                  poly_line const & pl = poly_lines[i];
+
+                  long long v0 = marching_cube_point_key(mc, pl.vertex_indices[0], x, y, z, sample_count);
+                  long long v_prev = marching_cube_point_key(mc, pl.vertex_indices[1], x, y, z, sample_count);
+
+                  for (std::size_t j = 2; j != pl.vertex_indices.size(); ++j)
+                  {
+                    long long v_cur = marching_cube_point_key(mc, pl.vertex_indices[j], x, y, z, sample_count);
+
+                    triangles->vertex_keys.push_back(v0);
+                    triangles->vertex_keys.push_back(v_prev);
+                    triangles->vertex_keys.push_back(v_cur);
+                    triangles->regions.push_back(pl.regions);
+
+                    v_prev = v_cur;
+                  }
+                }
+              }
+        }
+    }
+
+    int bz;
+
+    sparse_sample_grid const * grid;
+    std::vector<int> const * region_priority;
+
+    marching_cubes_triangles * triangles;
+  };
+
+
+
+
   multi_material_marching_cubes::multi_material_marching_cubes() {}
   std::string multi_material_marching_cubes::name() { return "multi_material_marching_cubes"; }
 
@@ -643,7 +916,7 @@ namespace viennamesh
     for (RegionIteratorType rit = regions.begin(); rit != regions.end(); ++rit)
       max_region_id = std::max((*rit).id(), max_region_id);
 
-    std::vector<int> region_priority(max_region_id);
+    std::vector<int> region_priority(max_region_id+1);
 
     int counter = region_count;
     for (RegionIteratorType rit = regions.begin(); rit != regions.end(); ++rit)
@@ -658,6 +931,8 @@ namespace viennamesh
     point_handle input_sample_size = get_required_input<point_handle>("sample_size");
     PointType sample_size = input_sample_size();
 
+    data_handle<int> thread_count = get_input<int>("thread_count");
+
 
 
     size += sample_size*2;
@@ -672,134 +947,159 @@ namespace viennamesh
 
     info(1) << "Sample counts: x=" << sample_count[0] << " y=" << sample_count[1] << " z=" << sample_count[2] << std::endl;
 
-    int total_sample_size = sample_count[0] * sample_count[1] * sample_count[2];
-    std::vector<char> sample_regions(total_sample_size, -1);
+    sparse_sample_grid grid(sample_count);
+
 
-    ElementRangeType cells(mesh, viennagrid::cell_dimension(mesh));
-    for (ElementIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+    // sample index range of every cell (grid coordinates)
+    std::vector<ElementType> cells;
+    std::vector<int> cell_regions;
+    std::vector<int> cell_min_index;
+    std::vector<int> cell_max_index;
+
+    ElementRangeType cell_range(mesh, viennagrid::cell_dimension(mesh));
+    for (ElementIteratorType cit = cell_range.begin(); cit != cell_range.end(); ++cit)
     {
       std::pair<PointType, PointType> cell_bb = viennagrid::bounding_box(*cit);
 
-      std::vector<int> min_index(3);
-      std::vector<int> max_index(3);
-
       for (int i = 0; i != 3; ++i)
       {
-        min_index[i] = (cell_bb.first[i]-center[i]) / sample_size[i];
+        int min_index = (cell_bb.first[i]-center[i]) / sample_size[i];
         if (cell_bb.first[i] > 0)
-          ++min_index[i];
+          ++min_index;
 
-        max_index[i] = (cell_bb.second[i]-center[i]) / sample_size[i];
+        int max_index = (cell_bb.second[i]-center[i]) / sample_size[i];
         if (cell_bb.second[i] < 0)
-          --max_index[i];
+          --max_index;
 
-        min_index[i] -= 3;
-        max_index[i] += 3;
+        min_index -= 3;
+        max_index += 3;
 
-        min_index[i] = std::max(min_index[i], -sample_count[i]/2);
-        max_index[i] = std::min(max_index[i],  sample_count[i]/2);
+        cell_min_index.push_back( std::max(min_index, -sample_count[i]/2) + sample_count[i]/2 );
+        cell_max_index.push_back( std::min(max_index,  sample_count[i]/2) + sample_count[i]/2 );
       }
 
-
-
       ElementRegionRangeType regions(*cit);
       if (regions.size() != 1)
         error(1) << "ERROR, one cell is on more than one region" << std::endl;
 
-      int region_id = (*regions.begin()).id();
+      cells.push_back(*cit);
+      cell_regions.push_back( (*regions.begin()).id() );
+    }
 
-      for (int z = min_index[2]; z <= max_index[2]; ++z)
-        for (int y = min_index[1]; y <= max_index[1]; ++y)
-          for (int x = min_index[0]; x <= max_index[0]; ++x)
-          {
-            std::vector<int> pos(3);
-            pos[0] = x;
-            pos[1] = y;
-            pos[2] = z;
 
-            PointType sample_point = center;
-            for (int j = 0; j != 3; ++j)
-              sample_point[j] += pos[j]*sample_size[j];
+    // bin the cells to the sample blocks they overlap
+    int const bs = sparse_sample_grid::block_size;
+    std::vector<int> block_cell_offsets( grid.block_count[0]*grid.block_count[1]*grid.block_count[2] + 1, 0 );
+    std::vector<int> block_cells;
 
-            if (viennagrid::is_inside(*cit, sample_point, is_inside_tolerance()))
-            {
-              char & sample = access_symmetric(sample_regions, sample_count, pos);
+    for (int pass = 0; pass != 2; ++pass)
+    {
+      if (pass == 1)
+      {
+        std::partial_sum( block_cell_offsets.begin(), block_cell_offsets.end(), block_cell_offsets.begin() );
+        block_cells.resize( block_cell_offsets.back() );
+      }
+
+      for (std::size_t cell = 0; cell != cells.size(); ++cell)
+      {
+        if (cell_min_index[3*cell] > cell_max_index[3*cell] ||
+            cell_min_index[3*cell+1] > cell_max_index[3*cell+1] ||
+            cell_min_index[3*cell+2] > cell_max_index[3*cell+2])
+          continue;
 
-              if ((sample == -1) || (region_priority[region_id] > region_priority[sample]))
-                sample = region_id;
+        for (int bz = cell_min_index[3*cell+2]/bs; bz <= cell_max_index[3*cell+2]/bs; ++bz)
+          for (int by = cell_min_index[3*cell+1]/bs; by <= cell_max_index[3*cell+1]/bs; ++by)
+            for (int bx = cell_min_index[3*cell]/bs; bx <= cell_max_index[3*cell]/bs; ++bx)
+            {
+              int block = grid.block_index(bx, by, bz);
+              if (pass == 0)
+                ++block_cell_offsets[block+1];
+              else
+                block_cells[ block_cell_offsets[block]++ ] = cell;
             }
-          }
+      }
     }
 
-    info(1) << "Finished regional sampling" << std::endl;
+    // the fill pass moved every offset to the end of its block
+    for (std::size_t i = block_cell_offsets.size()-1; i != 0; --i)
+      block_cell_offsets[i] = block_cell_offsets[i-1];
+    block_cell_offsets[0] = 0;
 
 
+    thread_pool pool( thread_count.valid() ? thread_count() : 0 );
 
+    for (int bz = 0; bz != grid.block_count[2]; ++bz)
+    {
+      sample_slab_task task;
+      task.bz = bz;
+      task.grid = &grid;
+      task.cells = &cells;
+      task.cell_regions = &cell_regions;
+      task.cell_min_index = &cell_min_index;
+      task.cell_max_index = &cell_max_index;
+      task.block_cell_offsets = &block_cell_offsets;
+      task.block_cells = &block_cells;
+      task.region_priority = &region_priority;
+      task.center = &center;
+      task.sample_size = &sample_size;
+      task.is_inside_tolerance = is_inside_tolerance();
+
+      pool.submit(task);
+    }
+    pool.wait();
 
-    typedef viennagrid::result_of::region<MeshType>::type RegionType;
-//     std::vector<RegionType> regions;
+    info(1) << "Finished regional sampling" << std::endl;
 
-    std::vector<char> & used_samples = sample_regions;
 
-    for (int z = -sample_count[2]/2; z < sample_count[2]/2; ++z)
-      for (int y = -sample_count[1]/2; y < sample_count[1]/2; ++y)
-        for (int x = -sample_count[0]/2; x < sample_count[0]/2; ++x)
-        {
-          int r0 = access_symmetric(used_samples, sample_count, x  , y  , z  );
-          int r1 = access_symmetric(used_samples, sample_count, x+1, y  , z  );
-          int r2 = access_symmetric(used_samples, sample_count, x  , y+1, z  );
-          int r3 = access_symmetric(used_samples, sample_count, x+1, y+1, z  );
-          int r4 = access_symmetric(used_samples, sample_count, x  , y  , z+1);
-          int r5 = access_symmetric(used_samples, sample_count, x+1, y  , z+1);
-          int r6 = access_symmetric(used_samples, sample_count, x  , y+1, z+1);
-          int r7 = access_symmetric(used_samples, sample_count, x+1, y+1, z+1);
-
-          if (r0 == r1 && r0 == r2 && r0 == r3 && r0 == r4 && r0 == r5 && r0 == r6 && r0 == r7)
-            continue;
 
+    std::vector<marching_cubes_triangles> slab_triangles( grid.block_count[2] );
+    for (int bz = 0; bz != grid.block_count[2]; ++bz)
+    {
+      extract_slab_task task;
+      task.bz = bz;
+      task.grid = &grid;
+      task.region_priority = &region_priority;
+      task.triangles = &slab_triangles[bz];
 
-          marching_cube mc(r0, r1, r2, r3, r4, r5, r6, r7);
-          mc.make_lines(region_priority);
-          std::vector<poly_line> poly_lines = mc.make_poly_lines();
+      pool.submit(task);
+    }
+    pool.wait();
 
-          PointType p[8];
-          p[0] = viennagrid::make_point( sample_size[0] *  x,    sample_size[1] *  y,    sample_size[2] * z     );
-          p[1] = viennagrid::make_point( sample_size[0] * (x+1), sample_size[1] *  y,    sample_size[2] * z     );
-          p[2] = viennagrid::make_point( sample_size[0] *  x   , sample_size[1] * (y+1), sample_size[2] * z     );
-          p[3] = viennagrid::make_point( sample_size[0] * (x+1), sample_size[1] * (y+1), sample_size[2] * z     );
-          p[4] = viennagrid::make_point( sample_size[0] *  x   , sample_size[1] *  y   , sample_size[2] * (z+1) );
-          p[5] = viennagrid::make_point( sample_size[0] * (x+1), sample_size[1] *  y   , sample_size[2] * (z+1) );
-          p[6] = viennagrid::make_point( sample_size[0] *  x   , sample_size[1] * (y+1), sample_size[2] * (z+1) );
-          p[7] = viennagrid::make_point( sample_size[0] * (x+1), sample_size[1] * (y+1), sample_size[2] * (z+1) );
 
-          for (int i = 0; i != 8; ++i)
-            p[i] += center;
+    // one output vertex per distinct point key
+    std::vector<long long> vertex_keys;
+    for (std::size_t i = 0; i != slab_triangles.size(); ++i)
+      vertex_keys.insert( vertex_keys.end(), slab_triangles[i].vertex_keys.begin(), slab_triangles[i].vertex_keys.end() );
 
-          for (std::size_t i = 0; i != poly_lines.size(); ++i)
-          {
-            poly_line const & pl = poly_lines[i];
+    std::sort( vertex_keys.begin(), vertex_keys.end() );
+    vertex_keys.erase( std::unique(vertex_keys.begin(), vertex_keys.end()), vertex_keys.end() );
 
-//             ElementType v0 = viennagrid::make_unique_vertex( output_mesh(), mc.point(pl.vertex_indices[0], p), 1e-6 );
-//             ElementType v_prev = viennagrid::make_unique_vertex( output_mesh(), mc.point(pl.vertex_indices[1], p), 1e-6 );
+    std::vector<ElementType> vertices( vertex_keys.size() );
+    for (std::size_t i = 0; i != vertex_keys.size(); ++i)
+      vertices[i] = viennagrid::make_vertex( output_mesh(), marching_cube_point(vertex_keys[i], sample_count, center, sample_size) );
 
-            ElementType v0 = viennagrid::make_vertex( output_mesh(), mc.point(pl.vertex_indices[0], p) );
-            ElementType v_prev = viennagrid::make_vertex( output_mesh(), mc.point(pl.vertex_indices[1], p) );
+    for (std::size_t i = 0; i != slab_triangles.size(); ++i)
+    {
+      marching_cubes_triangles const & triangles = slab_triangles[i];
 
-            for (std::size_t j = 2; j != pl.vertex_indices.size(); ++j)
-            {
-              ElementType v_cur = viennagrid::make_vertex( output_mesh(), mc.point(pl.vertex_indices[j], p) );
-//               ElementType v_cur = viennagrid::make_unique_vertex( output_mesh(), mc.point(pl.vertex_indices[j], p), 1e-6 );
-              ElementType triangle = viennagrid::make_triangle( output_mesh(), v0, v_prev, v_cur );
-              v_prev = v_cur;
-
-//               if (pl.regions.first != -1)
-                viennagrid::add( output_mesh().get_or_create_region(pl.regions.first+1), triangle );
-//               if (pl.regions.second != -1)
-                viennagrid::add( output_mesh().get_or_create_region(pl.regions.second+1), triangle );
-            }
-          }
+      for (std::size_t j = 0; j != triangles.regions.size(); ++j)
+      {
+        ElementType v[3];
+        for (int k = 0; k != 3; ++k)
+        {
+          long long key = triangles.vertex_keys[3*j+k];
+          v[k] = vertices[ std::lower_bound(vertex_keys.begin(), vertex_keys.end(), key) - vertex_keys.begin() ];
         }
 
+        ElementType triangle = viennagrid::make_triangle( output_mesh(), v[0], v[1], v[2] );
+
+        viennagrid::add( output_mesh().get_or_create_region(triangles.regions[j].first+1), triangle );
+        viennagrid::add( output_mesh().get_or_create_region(triangles.regions[j].second+1), triangle );
+      }
+    }
+
+    info(1) << "Extracted " << vertices.size() << " welded vertices" << std::endl;
+
 
 
 //     point_container_handle input_mc_regions = get_required_input<point_container_handle>("mc_regions");
@@ -14,6 +14,8 @@
 
 #include <numeric>
 #include "volumetric_resample.hpp"
+#include "cell_locator.hpp"
+#include "viennameshpp/thread_pool.hpp"
 #include "viennagrid/algorithm/geometry.hpp"
 #include "viennagrid/algorithm/inclusion.hpp"
 #include "viennagrid/algorithm/centroid.hpp"
@@ -131,12 +133,105 @@ namespace viennamesh
 
 
 
+  namespace
+  {
+    const int NOT_SPECIFIED = -1;
+
+    typedef viennagrid::mesh                                        MeshType;
+    typedef viennagrid::result_of::element<MeshType>::type          ElementType;
+
+    // determines the regions of the base cells [first, last), the samples of a cell
+    // only depend on its index, not on the partitioning into tasks
+    struct volumetric_resample_task
+    {
+      void operator()() const
+      {
+        cell_locator::ElementContainerType reference_cells;
+
+        for (std::size_t index = first; index != last; ++index)
+        {
+          ElementType const & cell = (*cells)[index];
+          sample_generator random( static_cast<unsigned int>(index) );
+
+          point pt_a = viennagrid::get_point( viennagrid::vertices(cell)[0] );
+          point pt_b = viennagrid::get_point( viennagrid::vertices(cell)[1] );
+          point pt_c = viennagrid::get_point( viennagrid::vertices(cell)[2] );
+          point pt_d = viennagrid::get_point( viennagrid::vertices(cell)[3] );
+
+          std::vector<double> weights(region_count+1, 0.0);
+          for (int i = 0; i < sample_count; ++i)
+          {
+            double a = -1;
+            double b = -1;
+            double c = -1;
+            double d = -1;
+
+            while (a+b+c+d < 1e-6)
+            {
+              a = random();
+              b = random();
+              c = random();
+              d = random();
+            }
+
+            point sample_point = (a*pt_a + b*pt_b + c*pt_c + d*pt_d) / (a+b+c+d);
+
+            std::vector<int> local_hits(region_count, 0);
+            int total_local_hits = 0;
+
+            (*locator)(sample_point, reference_cells);
+            for (cell_locator::ElementContainerType::const_iterator scit = reference_cells.begin(); scit != reference_cells.end(); ++scit)
+            {
+              typedef viennagrid::result_of::region_range<ElementType>::type RegionRangeType;
+              typedef viennagrid::result_of::iterator<RegionRangeType>::type RegionRangeIterator;
+
+              RegionRangeType regions(*scit);
+              for (RegionRangeIterator rit = regions.begin(); rit != regions.end(); ++rit)
+              {
+                ++total_local_hits;
+                local_hits[(*rit).id()]++;
+              }
+            }
+
+            if (total_local_hits == 0)
+              weights[region_count] += 1.0;
+            else
+            {
+              int sum = std::accumulate(local_hits.begin(), local_hits.end(), 0);
+              for (int i = 0; i != region_count; ++i)
+                weights[i] += static_cast<double>(local_hits[i])/static_cast<double>(sum);
+            }
+          }
+
+          std::vector<double>::iterator max = std::max_element( weights.begin(), weights.end() );
+          int region_id = max - weights.begin();
+
+          if (*max > 0.9*sample_count && region_id != region_count)
+            (*cell_regions)[index] = region_id;
+        }
+      }
+
+      cell_locator const * locator;
+      std::vector<ElementType> const * cells;
+      std::vector<int> * cell_regions;
+
+      std::size_t first;
+      std::size_t last;
+
+      int sample_count;
+      int region_count;
+    };
+  }
+
+
+
   volumetric_resample::volumetric_resample() {}
   std::string volumetric_resample::name() { return "volumetric_resample"; }
 
   bool volumetric_resample::run(viennamesh::algorithm_handle &)
   {
     data_handle<int> sample_count = get_required_input<int>("sample_count");
+    data_handle<int> thread_count = get_input<int>("thread_count");
 
     mesh_handle reference_mesh = get_required_input<mesh_handle>("reference_mesh");
     mesh_handle base_mesh = get_required_input<mesh_handle>("base_mesh");
@@ -146,10 +241,7 @@ namespace viennamesh
     int region_count = reference_mesh().region_count();
 
 
-    typedef viennagrid::mesh                                        MeshType;
-    typedef viennagrid::result_of::element<MeshType>::type          ElementType;
     typedef viennagrid::result_of::cell_range<MeshType>::type       CellRangeType;
-    typedef viennagrid::result_of::iterator<CellRangeType>::type    CellRangeIterator;
 
 
     MeshType tmp;
@@ -157,97 +249,44 @@ namespace viennamesh
     viennagrid::copy( base_mesh(), tmp );
     CellRangeType cells( tmp );
 
-    const int NOT_SPECIFIED = -1;
-    const int OUTSIDE_MESH = -2;
-
-    std::vector<int> region_container( cells.size(), NOT_SPECIFIED );
-    typedef viennagrid::result_of::accessor< std::vector<int>, ElementType >::type RegionAccessor;
-    RegionAccessor region(region_container);
-
+    std::vector<ElementType> cell_container( cells.begin(), cells.end() );
+    std::vector<int> cell_regions( cell_container.size(), NOT_SPECIFIED );
 
+    cell_locator locator( reference_mesh() );
 
-    for (CellRangeIterator cit = cells.begin(); cit != cells.end(); ++cit)
     {
-      if ( region.get(*cit) != NOT_SPECIFIED )
-        continue;
+      thread_pool pool( thread_count.valid() ? thread_count() : 0 );
 
-      point pt_a = viennagrid::get_point( viennagrid::vertices(*cit)[0] );
-      point pt_b = viennagrid::get_point( viennagrid::vertices(*cit)[1] );
-      point pt_c = viennagrid::get_point( viennagrid::vertices(*cit)[2] );
-      point pt_d = viennagrid::get_point( viennagrid::vertices(*cit)[3] );
-
-      std::vector<double> weights(region_count+1, 0.0);
-      for (int i = 0; i < sample_count(); ++i)
+      // a few chunks per worker for load balancing
+      std::size_t chunk_count = std::min<std::size_t>( cell_container.size(), 8*pool.worker_count() );
+      for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
       {
-        double a = -1;
-        double b = -1;
-        double c = -1;
-        double d = -1;
-
-        while (a+b+c+d < 1e-6)
-        {
-          a = static_cast<double>(rand())/RAND_MAX;
-          b = static_cast<double>(rand())/RAND_MAX;
-          c = static_cast<double>(rand())/RAND_MAX;
-          d = static_cast<double>(rand())/RAND_MAX;
-        }
-
-        point sample_point = (a*pt_a + b*pt_b + c*pt_c + d*pt_d) / (a+b+c+d);
-
-        std::vector<int> local_hits(region_count, 0);
-        int total_local_hits = 0;
-
-        CellRangeType src_cells( reference_mesh() );
-        for (CellRangeIterator scit = src_cells.begin(); scit != src_cells.end(); ++scit)
-        {
-          if (viennagrid::is_inside(*scit, sample_point))
-          {
-            typedef viennagrid::result_of::region_range<ElementType>::type RegionRangeType;
-            typedef viennagrid::result_of::iterator<RegionRangeType>::type RegionRangeIterator;
-
-            RegionRangeType regions(*scit);
-            for (RegionRangeIterator rit = regions.begin(); rit != regions.end(); ++rit)
-            {
-              ++total_local_hits;
-              local_hits[(*rit).id()]++;
-            }
-          }
-        }
-
-        if (total_local_hits == 0)
-          weights[region_count] += 1.0;
-        else
-        {
-          int sum = std::accumulate(local_hits.begin(), local_hits.end(), 0);
-          for (int i = 0; i != region_count; ++i)
-            weights[i] += static_cast<double>(local_hits[i])/static_cast<double>(sum);
-        }
+        volumetric_resample_task task;
+        task.locator = &locator;
+        task.cells = &cell_container;
+        task.cell_regions = &cell_regions;
+        task.first = cell_container.size() * chunk / chunk_count;
+        task.last = cell_container.size() * (chunk+1) / chunk_count;
+        task.sample_count = sample_count();
+        task.region_count = region_count;
+
+        pool.submit(task);
       }
 
-      std::vector<double>::iterator max = std::max_element( weights.begin(), weights.end() );
-      int region_id = max - weights.begin();
-
-      if (*max > 0.9*sample_count() && region_id != region_count)
-        region.set(*cit, region_id);
-
-//       if (region_id != region_count)
-//       {
-//         region(*cit) = region_id;
-//       }
+      pool.wait();
     }
 
 
 
     typedef viennagrid::result_of::element_copy_map<>::type ElementCopyMap;
     ElementCopyMap copy_map( output_mesh() );
-    cells = CellRangeType(tmp);
 
-    for (CellRangeIterator cit = cells.begin(); cit != cells.end(); ++cit)
+    for (std::size_t i = 0; i != cell_container.size(); ++i)
     {
-      if ( region.get(*cit) != NOT_SPECIFIED && region.get(*cit) != OUTSIDE_MESH )
+      if ( cell_regions[i] != NOT_SPECIFIED )
       {
-        ElementType element = copy_map(*cit);
-        viennagrid::add( output_mesh().get_or_create_region(region.get(*cit)), element );
+        ElementType element = copy_map(cell_container[i]);
+        viennagrid::add( output_mesh().get_or_create_region(cell_regions[i]), element );
       }
     }
 
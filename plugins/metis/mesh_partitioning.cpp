@@ -12,11 +12,11 @@
    License:         MIT (X11), see file LICENSE in the base directory
 =============================================================================== */
 
-#include <set>
 #include <map>
-#include <iterator>
+#include <algorithm>
 
 #include "mesh_partitioning.hpp"
+#include "mesh_partitions.hpp"
 #include "metis.h"
 
 
@@ -30,12 +30,13 @@ namespace viennamesh
     mesh_handle input_mesh = get_required_input<mesh_handle>("mesh");
     data_handle<int> region_count = get_required_input<int>("region_count");
     data_handle<bool> multi_mesh_output = get_input<bool>("multi_mesh_output");
+    data_handle<int> halo_layers = get_input<int>("halo_layers");
+    quantity_field_handle cell_weights = get_input<viennagrid_quantity_field>("cell_weights");
 
     int cell_dimension = viennagrid::cell_dimension( input_mesh() );
 
     typedef viennagrid::mesh                                                MeshType;
     typedef viennagrid::result_of::const_cell_range<MeshType>::type         ConstCellRangeType;
-    typedef viennagrid::result_of::iterator<ConstCellRangeType>::type       ConstCellRangeIterator;
 
     typedef viennagrid::result_of::element<MeshType>::type                  ElementType;
     typedef viennagrid::result_of::const_element_range<ElementType>::type   ConstElementRangeType;
@@ -44,18 +45,30 @@ namespace viennamesh
 
     info(1) << "Using region count " << region_count() << std::endl;
 
+    int layer_count = 0;
+    if ( halo_layers.valid() )
+      layer_count = std::max( halo_layers(), 0 );
+
+    bool multi_mesh = multi_mesh_output.valid() && multi_mesh_output();
+    if (layer_count > 0 && !multi_mesh)
+    {
+      info(1) << "Halo layers are only created for multi mesh output -> ignoring" << std::endl;
+      layer_count = 0;
+    }
+
+
+    ConstCellRangeType cell_range( input_mesh() );
+    std::vector<ElementType> cells( cell_range.begin(), cell_range.end() );
 
     std::vector<idx_t> eptr;
     std::vector<idx_t> eind;
 
+    eptr.reserve( cells.size()+1 );
     eptr.push_back(0);
 
-
-
-    ConstCellRangeType cells( input_mesh() );
-    for (ConstCellRangeIterator cit = cells.begin(); cit != cells.end(); ++cit)
+    for (std::size_t i = 0; i != cells.size(); ++i)
     {
-      ConstElementRangeType vertices(*cit, 0);
+      ConstElementRangeType vertices(cells[i], 0);
       for (ConstElementRangeIterator vit = vertices.begin(); vit != vertices.end(); ++vit)
         eind.push_back( (*vit).id().index() );
 
@@ -67,10 +80,42 @@ namespace viennamesh
     idx_t num_elements = eptr.size()-1;
 
 
+    // cell weights are scaled to integers in [1,100], METIS balances their sum
+    std::vector<idx_t> vwgt;
+    if ( cell_weights.valid() )
+    {
+      viennagrid::quantity_field weights = cell_weights();
+
+      if ( weights.topologic_dimension() != cell_dimension || weights.values_per_quantity() != 1 )
+      {
+        error(1) << "Cell weights have to be a scalar quantity field on cells (topologic dimension = "
+                 << (int)weights.topologic_dimension() << ", values dimension = " << (int)weights.values_per_quantity() << ")" << std::endl;
+        return false;
+      }
+
+      std::vector<double> values( cells.size() );
+      double max_value = 0;
+      for (std::size_t i = 0; i != cells.size(); ++i)
+      {
+        values[i] = std::max( static_cast<double>(weights.get(cells[i])), 0.0 );
+        max_value = std::max( max_value, values[i] );
+      }
+
+      vwgt.resize( cells.size(), 1 );
+      if (max_value > 0)
+      {
+        for (std::size_t i = 0; i != cells.size(); ++i)
+          vwgt[i] = std::max( static_cast<idx_t>(values[i] / max_value * 100.0 + 0.5), static_cast<idx_t>(1) );
+      }
+
+      info(1) << "Using cell weights from quantity field \"" << weights.get_name() << "\"" << std::endl;
+    }
+
+
 
     idx_t result;
 
-    viennagrid::vector<idx_t> epart(num_elements);
+    std::vector<idx_t> epart(num_elements);
     std::vector<idx_t> npart(num_nodes);
 
     idx_t ncommon = cell_dimension;
@@ -78,45 +123,190 @@ namespace viennamesh
 
     METIS_PartMeshDual(&num_elements, &num_nodes,
                        &eptr[0], &eind[0],
-                       NULL, NULL,
+                       vwgt.empty() ? NULL : &vwgt[0], NULL,
                        &ncommon, &nparts,
                        NULL, NULL,
                        &result, &epart[0], &npart[0]);
 
 
+    int part_count = region_count();
+
+    mesh_partitions mp;
+
+    mp.part_count = part_count;
+    mp.halo_layers = layer_count;
+    mp.cell_parts.assign( epart.begin(), epart.end() );
+
+
+    // cells of each vertex in CSR format
+    std::vector<int> vertex_cell_offsets( num_nodes+1, 0 );
+    std::vector<int> vertex_cells( eind.size() );
+
+    for (std::size_t i = 0; i != eind.size(); ++i)
+      ++vertex_cell_offsets[ eind[i]+1 ];
+    for (idx_t v = 0; v != num_nodes; ++v)
+      vertex_cell_offsets[v+1] += vertex_cell_offsets[v];
+    {
+      std::vector<int> fill( vertex_cell_offsets.begin(), vertex_cell_offsets.end()-1 );
+      for (idx_t c = 0; c != num_elements; ++c)
+        for (idx_t j = eptr[c]; j != eptr[c+1]; ++j)
+          vertex_cells[ fill[eind[j]]++ ] = c;
+    }
+
+
+    // interface vertices: every vertex whose cells belong to more than one part
+    {
+      std::map< std::pair<int, int>, std::vector<int> > interface_map;
+      std::vector<int> vertex_parts;
+
+      for (idx_t v = 0; v != num_nodes; ++v)
+      {
+        vertex_parts.clear();
+        for (int j = vertex_cell_offsets[v]; j != vertex_cell_offsets[v+1]; ++j)
+          vertex_parts.push_back( epart[vertex_cells[j]] );
+
+        std::sort( vertex_parts.begin(), vertex_parts.end() );
+        vertex_parts.erase( std::unique(vertex_parts.begin(), vertex_parts.end()), vertex_parts.end() );
+
+        for (std::size_t a = 0; a < vertex_parts.size(); ++a)
+          for (std::size_t b = a+1; b < vertex_parts.size(); ++b)
+            interface_map[ std::make_pair(vertex_parts[a], vertex_parts[b]) ].push_back(v);
+      }
+
+      for (std::map< std::pair<int, int>, std::vector<int> >::iterator it = interface_map.begin(); it != interface_map.end(); ++it)
+      {
+        partition_interface pi;
+        pi.first_part = it->first.first;
+        pi.second_part = it->first.second;
+        mp.interfaces.push_back(pi);
+        mp.interfaces.back().vertices.swap( it->second );
+      }
+
+      info(1) << "Found " << mp.interfaces.size() << " interfaces between parts" << std::endl;
+    }
+
+
 
     mesh_handle output_mesh = make_data<mesh_handle>();
 
     typedef viennagrid::result_of::element_copy_map<>::type ElementCopyMapType;
 
-    if ( multi_mesh_output.valid() && multi_mesh_output() )
+    if (multi_mesh)
     {
-      output_mesh.resize( region_count() );
-      std::vector<ElementCopyMapType> copy_maps;
+      output_mesh.resize( part_count );
+
+      mp.vertex_local_to_global.resize( part_count );
+      mp.cell_local_to_global.resize( part_count );
+      mp.cell_layers.resize( part_count );
 
-      for (int i = 0; i != region_count(); ++i)
+      // owned cells of each part, sorted by part with a counting sort
+      std::vector<int> part_offsets( part_count+1, 0 );
+      std::vector<int> part_cells( num_elements );
+
+      for (idx_t c = 0; c != num_elements; ++c)
+        ++part_offsets[ epart[c]+1 ];
+      for (int p = 0; p != part_count; ++p)
+        part_offsets[p+1] += part_offsets[p];
+      {
+        std::vector<int> fill( part_offsets.begin(), part_offsets.end()-1 );
+        for (idx_t c = 0; c != num_elements; ++c)
+          part_cells[ fill[epart[c]]++ ] = c;
+      }
+
+      // visited[c] == p if cell c is already part of the (halo of) part p
+      std::vector<int> visited( num_elements, -1 );
+      std::vector<int> part_cell_list;
+      std::vector<int> part_cell_layers;
+
+      for (int p = 0; p != part_count; ++p)
       {
-        ElementCopyMapType copy_map( output_mesh(i) );
-        for (ConstCellRangeIterator cit = cells.begin(); cit != cells.end(); ++cit)
+        part_cell_list.assign( part_cells.begin() + part_offsets[p], part_cells.begin() + part_offsets[p+1] );
+        part_cell_layers.assign( part_cell_list.size(), 0 );
+
+        for (std::size_t i = 0; i != part_cell_list.size(); ++i)
+          visited[ part_cell_list[i] ] = p;
+
+        // every halo layer holds the cells sharing a vertex with the previous layer
+        std::size_t layer_begin = 0;
+        for (int layer = 1; layer <= layer_count; ++layer)
         {
-          int part = epart[(*cit).id().index()];
-          if (part == i)
-            copy_map( *cit );
+          std::size_t layer_end = part_cell_list.size();
+          for (std::size_t i = layer_begin; i != layer_end; ++i)
+          {
+            int c = part_cell_list[i];
+            for (idx_t j = eptr[c]; j != eptr[c+1]; ++j)
+            {
+              int v = eind[j];
+              for (int k = vertex_cell_offsets[v]; k != vertex_cell_offsets[v+1]; ++k)
+              {
+                int neighbor = vertex_cells[k];
+                if (visited[neighbor] != p)
+                {
+                  visited[neighbor] = p;
+                  part_cell_list.push_back(neighbor);
+                  part_cell_layers.push_back(layer);
+                }
+              }
+            }
+          }
+          layer_begin = layer_end;
         }
+
+
+        std::vector<int> & vertex_map = mp.vertex_local_to_global[p];
+        std::vector<int> & cell_map = mp.cell_local_to_global[p];
+        std::vector<int> & cell_layers = mp.cell_layers[p];
+
+        cell_map.resize( part_cell_list.size(), -1 );
+        cell_layers.resize( part_cell_list.size(), 0 );
+
+        ElementCopyMapType copy_map( output_mesh(p) );
+        for (std::size_t i = 0; i != part_cell_list.size(); ++i)
+        {
+          int c = part_cell_list[i];
+          ElementType cell = copy_map( cells[c] );
+
+          int local_cell = cell.id().index();
+          if (local_cell >= static_cast<int>(cell_map.size()))
+          {
+            cell_map.resize( local_cell+1, -1 );
+            cell_layers.resize( local_cell+1, 0 );
+          }
+          cell_map[local_cell] = c;
+          cell_layers[local_cell] = part_cell_layers[i];
+
+          // the copied cell has the vertices of the original cell in the same order
+          ConstElementRangeType local_vertices(cell, 0);
+          idx_t j = eptr[c];
+          for (ConstElementRangeIterator vit = local_vertices.begin(); vit != local_vertices.end(); ++vit, ++j)
+          {
+            int local_vertex = (*vit).id().index();
+            if (local_vertex >= static_cast<int>(vertex_map.size()))
+              vertex_map.resize( local_vertex+1, -1 );
+            vertex_map[local_vertex] = eind[j];
+          }
+        }
+
+        info(1) << "Part " << p << ": " << part_offsets[p+1]-part_offsets[p] << " owned cells, "
+                << part_cell_list.size() - (part_offsets[p+1]-part_offsets[p]) << " halo cells" << std::endl;
       }
     }
     else
     {
       ElementCopyMapType copy_map( output_mesh(), false );
 
-      for (ConstCellRangeIterator cit = cells.begin(); cit != cells.end(); ++cit)
+      for (std::size_t i = 0; i != cells.size(); ++i)
       {
-        ElementType cell = copy_map( *cit );
-        viennagrid::add( output_mesh().get_or_create_region(epart[(*cit).id().index()]), cell );
+        ElementType cell = copy_map( cells[i] );
+        viennagrid::add( output_mesh().get_or_create_region(epart[i]), cell );
       }
     }
 
+    data_handle<mesh_partitions> partitions = make_data<mesh_partitions>();
+    partitions.set(mp);
+
     set_output( "mesh", output_mesh );
+    set_output( "partitions", partitions );
 
     return true;
   }
@@ -0,0 +1,68 @@
+#ifndef VIENNAMESH_ALGORITHM_METIS_MESH_PARTITIONS_HPP
+#define VIENNAMESH_ALGORITHM_METIS_MESH_PARTITIONS_HPP
+
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+
+                    http://viennamesh.sourceforge.net/
+
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include "viennameshpp/plugin.hpp"
+
+namespace viennamesh
+{
+  // vertices shared by the cells of two parts, first_part < second_part
+  struct partition_interface
+  {
+    int first_part;
+    int second_part;
+
+    // sorted global vertex indices
+    std::vector<int> vertices;
+  };
+
+  // Relation between a partitioned mesh and its parts. Global indices are the
+  // indices of the vertices and cells of the input mesh, local indices are the
+  // indices in the part meshes. The per part vectors are only filled if the
+  // parts are written to separate meshes.
+  struct mesh_partitions
+  {
+    mesh_partitions() : part_count(0), halo_layers(0) {}
+
+    int part_count;
+    int halo_layers;
+
+    // owning part of every global cell
+    std::vector<int> cell_parts;
+
+    // per part: global index of every local vertex/cell
+    std::vector< std::vector<int> > vertex_local_to_global;
+    std::vector< std::vector<int> > cell_local_to_global;
+
+    // per part: 0 for owned cells, l for cells of the l-th halo layer
+    std::vector< std::vector<int> > cell_layers;
+
+    std::vector<partition_interface> interfaces;
+  };
+
+  namespace result_of
+  {
+    template<>
+    struct data_information<mesh_partitions>
+    {
+      static std::string type_name() { return "viennamesh::mesh_partitions"; }
+      static viennamesh_data_make_function make_function() { return viennamesh::generic_make<mesh_partitions>; }
+      static viennamesh_data_delete_function delete_function() { return viennamesh::generic_delete<mesh_partitions>; }
+    };
+  }
+}
+
+#endif
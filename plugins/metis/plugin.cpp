@@ -1,10 +1,13 @@
 #include "viennameshpp/plugin.hpp"
 
 #include "mesh_partitioning.hpp"
+#include "mesh_partitions.hpp"
 
 
 viennamesh_error viennamesh_plugin_init(viennamesh_context context)
 {
+  viennamesh::register_data_type<viennamesh::mesh_partitions>(context);
+
   viennamesh::register_algorithm<viennamesh::metis_mesh_partitioning>(context);
 
   return VIENNAMESH_SUCCESS;
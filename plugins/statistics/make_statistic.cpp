@@ -14,14 +14,68 @@
 
 #include "make_statistic.hpp"
 #include "statistic.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
+  namespace
+  {
+    typedef viennagrid::mesh                                          MeshType;
+    typedef viennagrid::result_of::element<MeshType>::type            ElementType;
+    typedef viennagrid::result_of::coord<ElementType>::type           CoordType;
+
+    typedef CoordType (*MetricFunctionType)(ElementType const &);
+    typedef viennamesh::statistic<viennagrid_numeric>                 StatisticType;
+
+    // NULL if the metric type is not supported
+    MetricFunctionType metric_function(std::string const & metric_type)
+    {
+      if (metric_type == "aspect_ratio")
+        return &viennamesh::aspect_ratio<ElementType>;
+      else if (metric_type == "condition_number")
+        return &viennamesh::condition_number<ElementType>;
+//       else if (metric_type == "min_angle")
+//         return &viennamesh::min_angle<ElementType>;
+//       else if (metric_type == "max_angle")
+//         return &viennamesh::max_angle<ElementType>;
+      else if (metric_type == "min_dihedral_angle")
+        return &viennamesh::min_dihedral_angle<ElementType>;
+      else if (metric_type == "radius_edge_ratio")
+        return &viennamesh::radius_edge_ratio<ElementType>;
+
+      return NULL;
+    }
+
+
+    // evaluates all metrics for the cells [first, last) into the statistics of one chunk
+    struct statistic_task
+    {
+      void operator()() const
+      {
+        for (std::size_t i = first; i != last; ++i)
+          for (std::size_t m = 0; m != metrics->size(); ++m)
+            (*statistics)[m].add( (*metrics)[m]( (*cells)[i] ) );
+      }
+
+      std::vector<ElementType> const * cells;
+      std::vector<MetricFunctionType> const * metrics;
+      std::vector<StatisticType> * statistics;
+
+      std::size_t first;
+      std::size_t last;
+    };
+  }
+
+
+
   make_statistic::make_statistic() {}
   std::string make_statistic::name() { return "make_statistic"; }
 
   bool make_statistic::run(viennamesh::algorithm_handle &)
   {
+    typedef viennagrid::result_of::const_cell_range<MeshType>::type   ConstCellRangeType;
+    typedef StatisticType::histogram_type                             HistogramType;
+
     mesh_handle input_mesh = get_required_input<mesh_handle>("mesh");
     data_handle<viennamesh_string> metric_type = get_required_input<viennamesh_string>("metric_type");
     data_handle<viennagrid_numeric> histogram_bins = get_input<viennagrid_numeric>("histogram_bin");
@@ -30,14 +84,11 @@ namespace viennamesh
     data_handle<viennagrid_numeric> histogram_max = get_input<viennagrid_numeric>("histogram_max");
     data_handle<int> histogram_bin_count = get_input<int>("histogram_bin_count");
 
+    data_handle<bool> cell_quantities = get_input<bool>("cell_quantities");
+    data_handle<int> thread_count = get_input<int>("thread_count");
 
-    typedef viennagrid::mesh                                  MeshType;
-    typedef viennagrid::result_of::element<MeshType>::type    ElementType;
-
-    typedef viennamesh::statistic<viennagrid_numeric>         StatisticType;
-    typedef StatisticType::histogram_type                     HistogramType;
-    StatisticType statistic;
 
+    StatisticType prototype;
 
     if (histogram_bins.valid())
     {
@@ -45,11 +96,11 @@ namespace viennamesh
       for (int i = 0; i != histogram_bins.size(); ++i)
         bins.push_back( histogram_bins(i) );
 
-      statistic.set_histogram( StatisticType::histogram_type::make(bins.begin(), bins.end()) );
+      prototype.set_histogram( HistogramType::make(bins.begin(), bins.end()) );
     }
     else if (histogram_min.valid() && histogram_max.valid() && histogram_bin_count.valid())
     {
-      statistic.set_histogram( StatisticType::histogram_type::make_uniform(histogram_min(), histogram_max(), histogram_bin_count()) );
+      prototype.set_histogram( HistogramType::make_uniform(histogram_min(), histogram_max(), histogram_bin_count()) );
     }
     else
     {
@@ -57,29 +108,58 @@ namespace viennamesh
       return false;
     }
 
+
+    // every value of metric_type is a metric, all metrics are evaluated in the same pass over the cells
+    std::vector<std::string> metric_names;
+    std::vector<MetricFunctionType> metrics;
+    for (int i = 0; i != metric_type.size(); ++i)
     {
-      viennamesh::LoggingStack stack( std::string("metric type \"") + metric_type() + "\"" );
-
-      statistic.clear();
-
-      if (metric_type() == "aspect_ratio")
-        statistic( input_mesh(), viennamesh::aspect_ratio<ElementType> );
-      else if (metric_type() == "condition_number")
-        statistic( input_mesh(), viennamesh::condition_number<ElementType> );
-//       else if (metric_type() == "min_angle")
-//         statistic( input_mesh(), viennamesh::min_angle<ElementType> );
-//       else if (metric_type() == "max_angle")
-//         statistic( input_mesh(), viennamesh::max_angle<ElementType> );
-      else if (metric_type() == "min_dihedral_angle")
-        statistic( input_mesh(), viennamesh::min_dihedral_angle<ElementType> );
-      else if (metric_type() == "radius_edge_ratio")
-        statistic( input_mesh(), viennamesh::radius_edge_ratio<ElementType> );
-      else
+      std::string name = metric_type(i);
+      MetricFunctionType function = metric_function(name);
+      if (!function)
       {
-        error(1) << "Metric type \"" << metric_type() << "\" is not supported" << std::endl;
+        error(1) << "Metric type \"" << name << "\" is not supported" << std::endl;
         return false;
       }
 
+      metric_names.push_back(name);
+      metrics.push_back(function);
+    }
+
+
+    ConstCellRangeType cell_range( input_mesh() );
+    std::vector<ElementType> cells( cell_range.begin(), cell_range.end() );
+
+    thread_pool pool( thread_count.valid() ? thread_count() : 0 );
+
+    std::size_t chunk_count = std::max<std::size_t>( std::min<std::size_t>(cells.size(), 8*pool.worker_count()), 1 );
+    std::vector< std::vector<StatisticType> > chunk_statistics( chunk_count, std::vector<StatisticType>(metrics.size(), prototype) );
+
+    for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
+    {
+      statistic_task task;
+      task.cells = &cells;
+      task.metrics = &metrics;
+      task.statistics = &chunk_statistics[chunk];
+      task.first = cells.size()*chunk/chunk_count;
+      task.last = cells.size()*(chunk+1)/chunk_count;
+
+      pool.submit(task);
+    }
+    pool.wait();
+
+
+    quantity_field_handle quantities = make_data<viennagrid::quantity_field>();
+
+    for (std::size_t m = 0; m != metrics.size(); ++m)
+    {
+      viennamesh::LoggingStack stack( std::string("metric type \"") + metric_names[m] + "\"" );
+
+      // merged in chunk order, the values of the statistic are in cell order
+      StatisticType statistic = prototype;
+      for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
+        statistic.merge( chunk_statistics[chunk][m] );
+
       statistic.normalize();
       info(5) << statistic << std::endl;
 
@@ -91,13 +171,34 @@ namespace viennamesh
 
       data_handle<viennagrid_numeric> output_bins = make_data<viennagrid_numeric>();
       output_bins.set( bins );
-      set_output( "bins", output_bins );
 
-      set_output( "min", statistic.min() );
-      set_output( "max", statistic.max() );
+      // the first metric is additionally available without prefix
+      if (m == 0)
+      {
+        set_output( "bins", output_bins );
+        set_output( "min", statistic.min() );
+        set_output( "max", statistic.max() );
+      }
+
+      set_output( metric_names[m] + "_bins", output_bins );
+      set_output( metric_names[m] + "_min", statistic.min() );
+      set_output( metric_names[m] + "_max", statistic.max() );
+
+      if (cell_quantities.valid() && cell_quantities())
+      {
+        viennagrid::quantity_field quantity_field( viennagrid::cell_dimension(input_mesh()), 1 );
+        quantity_field.set_name( metric_names[m] );
 
+        std::vector<viennagrid_numeric> const & values = statistic.values();
+        for (std::size_t i = 0; i != cells.size(); ++i)
+          quantity_field.set( cells[i], values[i] );
+
+        quantities.push_back( quantity_field );
+      }
     }
 
+    if (cell_quantities.valid() && cell_quantities())
+      set_output( "quantities", quantities );
 
     return true;
   }
@@ -15,8 +15,10 @@
    License:         MIT (X11), see file LICENSE in the base directory
 =============================================================================== */
 
+#include <cassert>
 #include <limits>
-#include <set>
+#include <vector>
+#include <algorithm>
 #include "element_metrics.hpp"
 
 namespace viennamesh
@@ -25,10 +27,14 @@ namespace viennamesh
   NumericT infinity()
   { return std::numeric_limits<NumericT>::infinity(); }
 
+  // Histogram over the bins (-inf,b_0), [b_0,b_1), ..., [b_n-1,b_n) and the
+  // overflow bin [b_n,inf). Bins are stored by their upper border in a sorted
+  // vector, lookup is a binary search or O(1) for uniform histograms.
   template<typename NumericT, typename BinT>
   class histogram
   {
-    typedef std::map<NumericT, BinT> BinContainerType;
+    typedef std::pair<NumericT, BinT> BinType;
+    typedef std::vector<BinType> BinContainerType;
     typedef typename BinContainerType::iterator iterator;
 
     iterator begin() { return bins.begin(); }
@@ -37,12 +43,17 @@ namespace viennamesh
 
     typedef histogram<NumericT, BinT> self_type;
 
+    histogram() : overflow_bin_(0), uniform_(false), uniform_min_(0), uniform_width_(0) {}
+
     static self_type make_uniform( NumericT min, NumericT max, std::size_t bin_count )
     {
       self_type tmp;
-      tmp.bins.clear();
       for (std::size_t i = 0; i < bin_count+1; ++i)
-        tmp.bins[ min + i/static_cast<NumericT>(bin_count)*(max-min) ] = 0;
+        tmp.bins.push_back( BinType(min + i/static_cast<NumericT>(bin_count)*(max-min), 0) );
+
+      tmp.uniform_ = bin_count > 0 && max > min;
+      tmp.uniform_min_ = min;
+      tmp.uniform_width_ = (max-min) / bin_count;
       return tmp;
     }
 
@@ -50,9 +61,11 @@ namespace viennamesh
     static self_type make( BinBorderIteratorT begin_it, BinBorderIteratorT const & end_it )
     {
       self_type tmp;
-      tmp.bins.clear();
       for (; begin_it != end_it; ++begin_it)
-        tmp.bins[ *begin_it ] = 0;
+        tmp.bins.push_back( BinType(*begin_it, 0) );
+
+      std::sort( tmp.bins.begin(), tmp.bins.end(), border_less() );
+      tmp.bins.erase( std::unique(tmp.bins.begin(), tmp.bins.end(), border_equal()), tmp.bins.end() );
       return tmp;
     }
 
@@ -65,22 +78,31 @@ namespace viennamesh
 
     void increase(NumericT value, BinT to_increase = 1)
     {
-      iterator bin_it = bin(value);
-      if (bin_it != bins.end())
-        bin_it->second += to_increase;
+      std::size_t index = bin(value);
+      if (index != bins.size())
+        bins[index].second += to_increase;
       else
         overflow_bin_ += to_increase;
     }
 
     BinT get(NumericT value) const
     {
-      const_iterator bin_it = bin(value);
-      if (bin_it != bins.end())
-        return bin_it->second;
+      std::size_t index = bin(value);
+      if (index != bins.size())
+        return bins[index].second;
       else
         return overflow_bin_;
     }
 
+    // adds the bins of a histogram with the same borders
+    void merge(self_type const & other)
+    {
+      assert( bins.size() == other.bins.size() );
+      for (std::size_t i = 0; i != bins.size(); ++i)
+        bins[i].second += other.bins[i].second;
+      overflow_bin_ += other.overflow_bin_;
+    }
+
     typedef typename BinContainerType::const_iterator const_iterator;
 
     const_iterator begin() const { return bins.begin(); }
@@ -113,13 +135,48 @@ namespace viennamesh
 
   private:
 
-    iterator bin(NumericT value)
-    { return bins.upper_bound(value); }
-    const_iterator bin(NumericT value) const
-    { return bins.upper_bound(value); }
+    struct border_less
+    {
+      bool operator()(BinType const & lhs, BinType const & rhs) const { return lhs.first < rhs.first; }
+      bool operator()(NumericT lhs, BinType const & rhs) const { return lhs < rhs.first; }
+    };
+
+    struct border_equal
+    {
+      bool operator()(BinType const & lhs, BinType const & rhs) const { return lhs.first == rhs.first; }
+    };
+
+    // index of the first bin with upper border > value, bins.size() for the overflow bin
+    std::size_t bin(NumericT value) const
+    {
+      if (uniform_)
+      {
+        if (!(value >= bins.front().first))
+          return 0;
+        if (value >= bins.back().first)
+          return bins.size();
+
+        std::size_t index = static_cast<std::size_t>( (value - uniform_min_) / uniform_width_ ) + 1;
+        if (index >= bins.size())
+          index = bins.size()-1;
+
+        // correct rounding errors of the division
+        while (index > 1 && value < bins[index-1].first)
+          --index;
+        while (index < bins.size() && value >= bins[index].first)
+          ++index;
+        return index;
+      }
+
+      return std::upper_bound( bins.begin(), bins.end(), value, border_less() ) - bins.begin();
+    }
 
     BinContainerType bins;
     BinT overflow_bin_;
+
+    bool uniform_;
+    NumericT uniform_min_;
+    NumericT uniform_width_;
   };
 
 
@@ -153,14 +210,40 @@ namespace viennamesh
 
     typedef viennamesh::histogram<NumericT, viennagrid_numeric> histogram_type;
 
-    statistic() {}
+    statistic() { clear(); }
 
     void clear()
     {
       sum_ = 0;
+      count_ = 0;
+      min_ = infinity<NumericT>();
+      max_ = -infinity<NumericT>();
+      values_.clear();
       histogram_.reset();
     }
 
+    void add(NumericT value)
+    {
+      min_ = std::min(min_, value);
+      max_ = std::max(max_, value);
+      sum_ += value;
+      ++count_;
+      histogram_.increase( value );
+      values_.push_back( value );
+    }
+
+    // adds the values of a statistic with the same histogram borders,
+    // the values of other are appended to the values of this statistic
+    void merge(statistic const & other)
+    {
+      min_ = std::min(min_, other.min_);
+      max_ = std::max(max_, other.max_);
+      sum_ += other.sum_;
+      count_ += other.count_;
+      histogram_.merge( other.histogram_ );
+      values_.insert( values_.end(), other.values_.begin(), other.values_.end() );
+    }
+
     template<typename MeshT, typename FunctorT>
     void operator()(MeshT const & mesh, FunctorT functor)
     {
@@ -170,26 +253,16 @@ namespace viennamesh
       typedef typename viennagrid::result_of::iterator<ConstCellRangeType>::type ConstCellIteratorType;
 
       ConstCellRangeType cells(mesh);
-      ConstCellIteratorType cit = cells.begin();
-
-      count_ = cells.size();
-
-      min_ = max_ = functor(*cit++);
-
-      for (; cit != cells.end(); ++cit)
-      {
-        NumericT cell_metric = functor(*cit);
-        min_ = std::min(min_, cell_metric);
-        max_ = std::max(max_, cell_metric);
-        sum_ += cell_metric;
-        histogram_.increase( cell_metric );
-        ordered_values_.insert( cell_metric );
-      }
+      for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+        add( functor(*cit) );
     }
 
 
     void set_histogram( histogram_type const & histogram_x )
-    { histogram_ = histogram_x; }
+    {
+      histogram_ = histogram_x;
+      histogram_.reset();
+    }
 
 
     NumericT min() const { return min_; }
@@ -197,6 +270,9 @@ namespace viennamesh
     NumericT sum() const { return sum_; }
     size_t count() const { return count_; }
 
+    // values in the order they were added
+    std::vector<NumericT> const & values() const { return values_; }
+
     void normalize()
     {
       histogram_.normalize();
@@ -205,23 +281,17 @@ namespace viennamesh
     NumericT mean() const { return sum() / count(); }
     NumericT median() const
     {
-      typename std::multiset<NumericT>::iterator it = ordered_values_.begin();
+      if (count() == 0)
+        return 0;
 
-      NumericT tmp;
+      std::vector<NumericT> tmp = values_;
+      typename std::vector<NumericT>::iterator upper = tmp.begin() + count()/2;
+      std::nth_element( tmp.begin(), upper, tmp.end() );
 
       if (count() % 2 == 0)
-      {
-        std::advance(it,  count()/2-1);
-        tmp = *it;
-        ++it;
-        tmp += *it;
-        return tmp/2;
-      }
+        return (*std::max_element(tmp.begin(), upper) + *upper) / 2;
       else
-      {
-        std::advance(it,  count()/2);
-        return *it;
-      }
+        return *upper;
     }
     histogram_type const & histogram() const { return histogram_; }
 
@@ -234,7 +304,7 @@ namespace viennamesh
     NumericT min_;
     NumericT max_;
 
-    std::multiset<NumericT> ordered_values_;
+    std::vector<NumericT> values_;
 
     histogram_type histogram_;
   };
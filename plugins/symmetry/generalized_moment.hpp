@@ -3,6 +3,7 @@
 
 #include "common.hpp"
 #include "integrate.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
@@ -611,6 +612,242 @@ namespace viennamesh
   }
 
 
+  // Evaluates all coefficients C(2l, m, 2p), 0 <= l <= p, -2l <= m <= 2l, in a
+  // single pass over the triangles of a mesh. Every quadrature point is mapped
+  // to spherical coordinates once, the powers of cos(theta) and sin(theta) and
+  // the trigonometric functions of m*phi are shared by all coefficients.
+  // The coefficient set (including the clamping of l and m) is the one used by
+  // make_static_C, results are equal to C<T>() up to rounding.
+  class generalized_moment_kernel
+  {
+  public:
+
+    typedef triangle_quadrature< triangle_gauss_weights_generator<double, 20> > QuadratureType;
+
+    generalized_moment_kernel(int two_p_) : two_p(two_p_), max_m(0), max_grad(0), coefficient_J_offset(1, 0)
+    {
+      assert(two_p%2 == 0);
+      int p = two_p/2;
+
+      for (int l = 0; l <= p; ++l)
+        for (int m = -2*l; m <= 2*l; ++m)
+          add_coefficient(2*l, m, l);
+
+      QuadratureType::weight_container_type const & weights = QuadratureType::weights();
+      for (std::size_t i = 0; i != weights.size(); ++i)
+      {
+        quadrature_u.push_back( weights[i].p[0] );
+        quadrature_v.push_back( weights[i].p[1] );
+        quadrature_w.push_back( weights[i].w );
+      }
+    }
+
+    std::size_t size() const { return coefficient_m.size(); }
+
+    // temporaries of integrate, allocated once per thread of work and reused for all its triangles
+    struct scratch_buffers
+    {
+      scratch_buffers(generalized_moment_kernel const & kernel) :
+          triangle_result( kernel.size() ), cos_powers( kernel.max_grad+1 ), sin_powers( kernel.max_m+1 ),
+          cos_m_phi( kernel.max_m+1 ), sin_m_phi( kernel.max_m+1 ) {}
+
+      std::vector<double> triangle_result;
+      std::vector<double> cos_powers;
+      std::vector<double> sin_powers;
+      std::vector<double> cos_m_phi;
+      std::vector<double> sin_m_phi;
+    };
+
+    // adds the integral of every coefficient over the triangle p0,p1,p2 to result
+    void integrate(point const & p0, point const & p1, point const & p2, scratch_buffers & scratch, double * result) const
+    {
+      std::vector<double> & triangle_result = scratch.triangle_result;
+      std::vector<double> & cos_powers = scratch.cos_powers;
+      std::vector<double> & sin_powers = scratch.sin_powers;
+      std::vector<double> & cos_m_phi = scratch.cos_m_phi;
+      std::vector<double> & sin_m_phi = scratch.sin_m_phi;
+
+      std::fill( triangle_result.begin(), triangle_result.end(), 0.0 );
+
+      point d0 = p1-p0;
+      point d1 = p2-p0;
+
+      for (std::size_t q = 0; q != quadrature_w.size(); ++q)
+      {
+        double x = p0[0] + quadrature_u[q]*d0[0] + quadrature_v[q]*d1[0];
+        double y = p0[1] + quadrature_u[q]*d0[1] + quadrature_v[q]*d1[1];
+        double z = p0[2] + quadrature_u[q]*d0[2] + quadrature_v[q]*d1[2];
+
+        double r = std::sqrt(x*x+y*y+z*z);
+        double cos_theta = z/r;
+        double sin_theta = std::sqrt(1-cos_theta*cos_theta);
+        double phi = atan2(y,x);
+        double weight = std::pow(r, two_p) * quadrature_w[q];
+
+        cos_powers[0] = 1.0;
+        for (int i = 1; i <= max_grad; ++i)
+          cos_powers[i] = cos_powers[i-1]*cos_theta;
+
+        sin_powers[0] = 1.0;
+        for (int m = 1; m <= max_m; ++m)
+        {
+          sin_powers[m] = std::pow(sin_theta, m);
+          cos_m_phi[m] = std::cos(m*phi);
+          sin_m_phi[m] = std::sin(m*phi);
+        }
+
+        for (std::size_t k = 0; k != size(); ++k)
+        {
+          double const * J = &coefficient_J[ coefficient_J_offset[k] ];
+          int grad = coefficient_J_offset[k+1] - coefficient_J_offset[k] - 1;
+
+          double J_value = 0.0;
+          for (int i = 0; i <= grad; ++i)
+            J_value += J[i]*cos_powers[i];
+
+          int m = coefficient_m[k];
+          double value;
+          if (m == 0)
+            value = J_value/2;
+          else
+            value = J_value * (coefficient_sign_m[k] ? cos_m_phi[m] : sin_m_phi[m]) * coefficient_factor[k] * sin_powers[m];
+
+          triangle_result[k] += value * weight;
+        }
+      }
+
+      double volume = viennagrid::spanned_volume(p0, p1, p2);
+      for (std::size_t k = 0; k != size(); ++k)
+        result[k] += triangle_result[k] * volume;
+    }
+
+    // scaling of the coefficient with index k, S(p,l)
+    double scale(std::size_t k) const { return coefficient_scale[k]; }
+
+  private:
+
+    void add_coefficient(int two_l, int m_in, int l_out)
+    {
+      // same clamping as in make_static_C
+      int l = std::min(two_l, 4);
+      m_in = std::max(-4, std::min(m_in, 4));
+
+      bool sign_m = m_in > 0;
+      int m = std::abs(m_in);
+
+      polynom<double> J = jacobi_polynom<double>(l-m, m, m);
+      for (int i = 0; i <= l-m; ++i)
+        coefficient_J.push_back( (power_mone(m) + power_mone(i)) * (static_cast<std::size_t>(i) < J.size() ? J[i] : 0.0) );
+      coefficient_J_offset.push_back( coefficient_J.size() );
+
+      coefficient_m.push_back(m);
+      coefficient_sign_m.push_back(sign_m);
+      coefficient_factor.push_back( std::sqrt( (factorial(l+m)*factorial(l-m)) / (factorial(l)*factorial(l)) ) *
+                                    std::pow(1.0/2.0, m) * (1.0 / std::sqrt(2)) );
+      coefficient_scale.push_back( S(two_p/2, l_out) );
+
+      max_m = std::max(max_m, m);
+      max_grad = std::max(max_grad, l-m);
+    }
+
+    int two_p;
+    int max_m;
+    int max_grad;
+
+    // per coefficient, J coefficients of coefficient k are [J_offset[k], J_offset[k+1])
+    std::vector<int> coefficient_m;
+    std::vector<bool> coefficient_sign_m;
+    std::vector<double> coefficient_factor;
+    std::vector<double> coefficient_scale;
+    std::vector<int> coefficient_J_offset;
+    std::vector<double> coefficient_J;
+
+    std::vector<double> quadrature_u;
+    std::vector<double> quadrature_v;
+    std::vector<double> quadrature_w;
+  };
+
+
+  // integrates all kernel coefficients over the triangles [first, last) into its own accumulator
+  struct generalized_moment_task
+  {
+    void operator()() const
+    {
+      generalized_moment_kernel::scratch_buffers scratch(*kernel);
+
+      for (std::size_t i = first; i != last; ++i)
+      {
+        point const & p0 = (*points)[3*i+0];
+        point const & p1 = (*points)[3*i+1];
+        point const & p2 = (*points)[3*i+2];
+        kernel->integrate(p0, p1, p2, scratch, &(*result)[0]);
+      }
+    }
+
+    generalized_moment_kernel const * kernel;
+    std::vector<point> const * points;
+    std::vector<double> * result;
+
+    std::size_t first;
+    std::size_t last;
+  };
+
+
+  // C(2l, m, two_p) for all l <= two_p/2 and -2l <= m <= 2l, ordered by l and m
+  template<bool mesh_is_const>
+  std::vector<double> generalized_moment_coefficients(int two_p,
+                                                      viennagrid::base_mesh<mesh_is_const> const & mesh)
+  {
+    typedef viennagrid::base_mesh<mesh_is_const> MeshType;
+    typedef typename viennagrid::result_of::const_cell_range<MeshType>::type ConstCellRange;
+    typedef typename viennagrid::result_of::iterator<ConstCellRange>::type ConstCellIterator;
+
+    generalized_moment_kernel kernel(two_p);
+
+    std::vector<point> points;
+    ConstCellRange cells( mesh );
+    for (ConstCellIterator cit = cells.begin(); cit != cells.end(); ++cit)
+    {
+      for (int i = 0; i != 3; ++i)
+        points.push_back( viennagrid::get_point(*cit, i) );
+    }
+
+    std::size_t triangle_count = points.size()/3;
+    std::vector<double> result( kernel.size(), 0.0 );
+
+    {
+      thread_pool pool;
+
+      // per chunk accumulators, summed up in chunk order to stay deterministic
+      std::size_t chunk_count = std::min<std::size_t>( triangle_count, 8*pool.worker_count() );
+      std::vector< std::vector<double> > chunk_results( chunk_count, std::vector<double>(kernel.size(), 0.0) );
+
+      for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
+      {
+        generalized_moment_task task;
+        task.kernel = &kernel;
+        task.points = &points;
+        task.result = &chunk_results[chunk];
+        task.first = triangle_count * chunk / chunk_count;
+        task.last = triangle_count * (chunk+1) / chunk_count;
+
+        pool.submit(task);
+      }
+
+      pool.wait();
+
+      for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
+        for (std::size_t k = 0; k != kernel.size(); ++k)
+          result[k] += chunk_results[chunk][k];
+    }
+
+    for (std::size_t k = 0; k != kernel.size(); ++k)
+      result[k] *= kernel.scale(k);
+
+    return result;
+  }
+
+
   template<typename T>
   T real(T val) { return val; }
   template<typename T>
@@ -632,10 +869,13 @@ namespace viennamesh
       assert(two_p_ % 2 == 0);
       set_p(two_p_/2);
 
+      std::vector<double> coefficients = generalized_moment_coefficients(2*p(), mesh);
+
+      std::size_t index = 0;
       for (int l = 0; l <= p(); ++l)
         for (int m = -2*l; m <= 2*l; ++m)
         {
-          values[l][m+2*l] = viennamesh::C<CT>(2*l, m, 2*p(), mesh);
+          values[l][m+2*l] = coefficients[index++];
 //                                                 ,
 //                                                relative_integrate_tolerance,
 //                                                absolute_integrate_tolerance,
@@ -21,25 +21,54 @@
 #include "viennagrid/algorithm/spanned_volume.hpp"
 // #include "viennagrid/algorithm/extract_seed_points.hpp"
 #include "viennameshpp/sizing_function.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 
 namespace viennamesh
 {
   namespace tetgen
   {
-    sizing_function::base_functor::function_type tetgen_sizing_function;
-    bool using_sizing_function;
+    // refinement criteria of one tetgen_make_mesh invocation
+    struct refinement_context
+    {
+      refinement_context() : using_sizing_function(false), using_max_edge_ratio(false), using_max_inscribed_radius_edge_ratio(false) {}
+
+      sizing_function::program sizing_function;
+      bool using_sizing_function;
+
+      double max_edge_ratio;
+      bool using_max_edge_ratio;
+
+      double max_inscribed_radius_edge_ratio;
+      bool using_max_inscribed_radius_edge_ratio;
+    };
+
+    // The tetgen refinement callback has no user data argument. The context of the
+    // tetrahedralization running on the current thread is bound here instead.
+    VIENNAMESH_THREAD_LOCAL refinement_context const * current_refinement_context = NULL;
+
+    class scoped_refinement_context
+    {
+    public:
+      scoped_refinement_context(refinement_context const * context) : previous(current_refinement_context)
+      { current_refinement_context = context; }
+
+      ~scoped_refinement_context()
+      { current_refinement_context = previous; }
 
-    double max_edge_ratio;
-    bool using_max_edge_ratio;
+    private:
+      refinement_context const * previous;
+    };
 
-    double max_inscribed_radius_edge_ratio;
-    bool using_max_inscribed_radius_edge_ratio;
 
     bool should_tetrahedron_be_refined_function(double * tet_p0, double * tet_p1, double * tet_p2, double * tet_p3, double * , double)
     {
       typedef viennagrid::point PointType;
 
+      if (!current_refinement_context)
+        return false;
+      refinement_context const & context = *current_refinement_context;
+
       PointType p0 = viennagrid::make_point( tet_p0[0], tet_p0[1], tet_p0[2]);
       PointType p1 = viennagrid::make_point( tet_p1[0], tet_p1[1], tet_p1[2]);
       PointType p2 = viennagrid::make_point( tet_p2[0], tet_p2[1], tet_p2[2]);
@@ -54,53 +83,52 @@ namespace viennamesh
 
       double maxlen = std::max(std::max(std::max(d01, d02), std::max(d03, d12)), std::max(d13, d23));
 
-      if (using_max_edge_ratio)
+      if (context.using_max_edge_ratio)
       {
         double min_len = std::min(std::min(std::min(d01, d02), std::min(d03, d12)), std::min(d13, d23));
 
-        if (min_len / maxlen < max_edge_ratio)
+        if (min_len / maxlen < context.max_edge_ratio)
           return true;
       }
 
 
-      if (using_max_inscribed_radius_edge_ratio)
+      if (context.using_max_inscribed_radius_edge_ratio)
       {
         // http://saketsaurabh.in/blog/2009/11/radius-of-a-sphere-inscribed-in-a-general-tetrahedron/
         double volume = viennagrid::spanned_volume( p0, p1, p2, p3 );
         double surface = viennagrid::spanned_volume( p0, p1, p2 ) + viennagrid::spanned_volume( p0, p1, p3 ) + viennagrid::spanned_volume( p0, p2, p3 ) + viennagrid::spanned_volume( p1, p2, p3 );
         double inscribed_sphere_radius = volume / (3.0 * surface);
 
-        if (inscribed_sphere_radius / maxlen < max_inscribed_radius_edge_ratio)
+        if (inscribed_sphere_radius / maxlen < context.max_inscribed_radius_edge_ratio)
           return true;
       }
 
 
 
-      if (using_sizing_function)
+      if (context.using_sizing_function)
       {
         PointType center = (p0+p1+p2+p3)/4.0;
 
-        boost::array<PointType, 5> sample_points;
-        sample_points[0] = p0;
-        sample_points[1] = p1;
-        sample_points[2] = p2;
-        sample_points[3] = p3;
-        sample_points[3] = center;
+        // the corners and the center are evaluated as one batch, x coordinates first
+        double sample_points[15];
+        for (int d = 0; d != 3; ++d)
+        {
+          sample_points[5*d+0] = p0[d];
+          sample_points[5*d+1] = p1[d];
+          sample_points[5*d+2] = p2[d];
+          sample_points[5*d+3] = p3[d];
+          sample_points[5*d+4] = center[d];
+        }
+
+        double sizes[5];
+        char valid[5];
+        context.sizing_function.evaluate(5, 3, sample_points, sizes, valid);
 
         sizing_function::base_functor::result_type local_size = sizing_function::base_functor::result_type();
-        for (int i = 0; i != 4; ++i)
+        for (int i = 0; i != 5; ++i)
         {
-          sizing_function::base_functor::result_type current_size = tetgen_sizing_function( sample_points[i] );
-          if (current_size)
-          {
-            if (!local_size)
-              local_size = current_size;
-            else
-            {
-              if (current_size.get() < local_size.get() )
-                local_size = current_size;
-            }
-          }
+          if (valid[i] && (!local_size || sizes[i] < local_size.get()))
+            local_size = sizes[i];
         }
 
         if (local_size)
@@ -144,57 +172,63 @@ namespace viennamesh
 
 
 
+    // Shallow copy of a tetgen mesh which borrows all arrays of the source, the
+    // source is neither modified nor freed
+    struct borrowed_mesh : public tetgen::mesh
+    {
+      borrowed_mesh(tetgen::mesh const & src) : tetgen::mesh(src) {}
+      ~borrowed_mesh() { initialize(); }
+    };
+
+
     void make_mesh_impl(tetgen::mesh const & input,
                         tetgen::mesh & output,
                         point_container const & hole_points,
                         seed_point_container const & seed_points,
-                        tetgenbehavior options)
+                        tetgenbehavior options,
+                        refinement_context const * refinement = NULL)
     {
-      tetgenio & tmp = (tetgenio&)(input);
-
-      int old_numberofregions = tmp.numberofregions;
-      REAL * old_regionlist = tmp.regionlist;
-
-//       tmp.numberofregions = 0;
-//       tmp.regionlist = NULL;
-
-      int old_numberofholes = tmp.numberofholes;
-      REAL * old_holelist = tmp.holelist;
-
-//       tmp.numberofholes = 0;
-//       tmp.holelist = NULL;
+      // the input mesh may be shared with concurrent invocations, additional
+      // holes, seed points and the refinement callback only go to a borrowed copy
+      borrowed_mesh tmp(input);
 
+      std::vector<REAL> holelist;
       if (!hole_points.empty())
       {
-        tmp.numberofholes += hole_points.size();
-        tmp.holelist = new REAL[3 * tmp.numberofholes];
+        holelist.resize( 3 * (input.numberofholes + hole_points.size()) );
 
-        std::copy( old_holelist, old_holelist+3*old_numberofholes, tmp.holelist );
+        std::copy( input.holelist, input.holelist+3*input.numberofholes, holelist.begin() );
 
         for (std::size_t i = 0; i < hole_points.size(); ++i)
         {
-          tmp.holelist[3*(old_numberofholes+i)+0] = hole_points[i][0];
-          tmp.holelist[3*(old_numberofholes+i)+1] = hole_points[i][1];
-          tmp.holelist[3*(old_numberofholes+i)+2] = hole_points[i][2];
+          holelist[3*(input.numberofholes+i)+0] = hole_points[i][0];
+          holelist[3*(input.numberofholes+i)+1] = hole_points[i][1];
+          holelist[3*(input.numberofholes+i)+2] = hole_points[i][2];
         }
+
+        tmp.numberofholes = input.numberofholes + hole_points.size();
+        tmp.holelist = &holelist[0];
       }
 
+      std::vector<REAL> regionlist;
       if (!seed_points.empty())
       {
-        tmp.numberofregions += seed_points.size();
-        tmp.regionlist = new REAL[5 * tmp.numberofregions];
+        regionlist.resize( 5 * (input.numberofregions + seed_points.size()) );
 
-        std::copy( old_regionlist, old_regionlist+5*old_numberofregions, tmp.regionlist );
+        std::copy( input.regionlist, input.regionlist+5*input.numberofregions, regionlist.begin() );
 
         for (std::size_t i = 0; i < seed_points.size(); ++i)
         {
-          tmp.regionlist[5*(old_numberofregions+i)+0] = seed_points[i].first[0];
-          tmp.regionlist[5*(old_numberofregions+i)+1] = seed_points[i].first[1];
-          tmp.regionlist[5*(old_numberofregions+i)+2] = seed_points[i].first[2];
-          tmp.regionlist[5*(old_numberofregions+i)+3] = REAL(seed_points[i].second);
-          tmp.regionlist[5*(old_numberofregions+i)+4] = 0;
+          regionlist[5*(input.numberofregions+i)+0] = seed_points[i].first[0];
+          regionlist[5*(input.numberofregions+i)+1] = seed_points[i].first[1];
+          regionlist[5*(input.numberofregions+i)+2] = seed_points[i].first[2];
+          regionlist[5*(input.numberofregions+i)+3] = REAL(seed_points[i].second);
+          regionlist[5*(input.numberofregions+i)+4] = 0;
         }
 
+        tmp.numberofregions = input.numberofregions + seed_points.size();
+        tmp.regionlist = &regionlist[0];
+
         info(1) << "Using additional seed points" << std::endl;
       }
 
@@ -209,26 +243,19 @@ namespace viennamesh
         options.regionattrib = 1;
       }
 
+      tmp.tetunsuitable = refinement ? should_tetrahedron_be_refined_function : NULL;
+      if (!refinement)
+        options.use_refinement_callback = 0;
+
       {
         StdCaptureHandle capture_handle;
+        scoped_refinement_context refinement_binding(refinement);
         options.init();
 
         std::cout << "Region attrib: " << options.regionattrib << std::endl;
 
         tetrahedralize(&options, &tmp, &output);
       }
-
-      if (!hole_points.empty())
-        delete[] tmp.holelist;
-
-      if (!seed_points.empty())
-        delete[] tmp.regionlist;
-
-      tmp.numberofregions = old_numberofregions;
-      tmp.regionlist = old_regionlist;
-
-      tmp.numberofholes = old_numberofholes;
-      tmp.holelist = old_holelist;
     }
 
 
@@ -278,15 +305,146 @@ namespace viennamesh
 //       }
 //     }
 
-    template<typename SizingFunctionRepresentationT>
-    sizing_function::base_functor::function_type make_sizing_function(tetgen::mesh const & mesh,
-                                            point_container const & hole_points,
-                                            seed_point_container const & seed_points,
-                                            SizingFunctionRepresentationT const & sf,
-                                            std::string const & base_path)
+    // Raw copy of the geometry together with its FNV-1a hash, keys are equal
+    // only if the whole geometry is equal, the hash is compared first
+    class geometry_key
+    {
+    public:
+      geometry_key() : hash_(14695981039346656037ULL) {}
+
+      template<typename T>
+      void add(T const * data, std::size_t count)
+      {
+        unsigned char const * bytes = reinterpret_cast<unsigned char const *>(data);
+        bytes_.insert( bytes_.end(), bytes, bytes + count*sizeof(T) );
+        for (std::size_t i = 0; i != count*sizeof(T); ++i)
+        {
+          hash_ ^= bytes[i];
+          hash_ *= 1099511628211ULL;
+        }
+      }
+
+      template<typename T>
+      void add(T const & value) { add(&value, 1); }
+
+      bool operator==(geometry_key const & rhs) const
+      {
+        return hash_ == rhs.hash_ && bytes_ == rhs.bytes_;
+      }
+
+    private:
+      unsigned long long hash_;
+      std::vector<unsigned char> bytes_;
+    };
+
+
+    // key of everything the background mesh depends on: the PLC, holes and seed points
+    geometry_key make_geometry_key(tetgen::mesh const & mesh,
+                                   point_container const & hole_points,
+                                   seed_point_container const & seed_points)
     {
-      typedef viennagrid::mesh MeshType;
-      MeshType simple_mesh;
+      geometry_key key;
+
+      key.add(mesh.numberofpoints);
+      key.add(mesh.pointlist, 3*mesh.numberofpoints);
+
+      key.add(mesh.numberoffacets);
+      for (int i = 0; i != mesh.numberoffacets; ++i)
+      {
+        tetgenio::facet const & facet = mesh.facetlist[i];
+
+        key.add(facet.numberofpolygons);
+        for (int j = 0; j != facet.numberofpolygons; ++j)
+        {
+          key.add(facet.polygonlist[j].numberofvertices);
+          key.add(facet.polygonlist[j].vertexlist, facet.polygonlist[j].numberofvertices);
+        }
+
+        key.add(facet.numberofholes);
+        key.add(facet.holelist, 3*facet.numberofholes);
+      }
+      if (mesh.facetmarkerlist)
+        key.add(mesh.facetmarkerlist, mesh.numberoffacets);
+
+      key.add(mesh.numberofholes);
+      key.add(mesh.holelist, 3*mesh.numberofholes);
+      key.add(mesh.numberofregions);
+      key.add(mesh.regionlist, 5*mesh.numberofregions);
+
+      for (std::size_t i = 0; i != hole_points.size(); ++i)
+        key.add(&hole_points[i][0], hole_points[i].size());
+      for (std::size_t i = 0; i != seed_points.size(); ++i)
+      {
+        key.add(&seed_points[i].first[0], seed_points[i].first.size());
+        key.add(seed_points[i].second);
+      }
+
+      return key;
+    }
+
+
+    // Background meshes of previous runs keyed by their geometry, the least recently
+    // used entry is dropped when the cache is full. Cached meshes are never handed
+    // out, find and insert copy them.
+    class background_mesh_cache
+    {
+    public:
+
+      static std::size_t const max_size = 8;
+
+      bool find(geometry_key const & key, viennagrid::mesh & mesh)
+      {
+        viennagrid::mesh cached;
+
+        {
+          scoped_lock lock(mutex_);
+
+          std::list<EntryType>::iterator it = entries.begin();
+          for (; it != entries.end(); ++it)
+          {
+            if (it->first == key)
+              break;
+          }
+
+          if (it == entries.end())
+            return false;
+
+          entries.splice( entries.end(), entries, it );
+          cached = it->second;
+        }
+
+        // nobody modifies the cached mesh, it can be copied without the lock
+        viennagrid::copy( cached, mesh );
+        return true;
+      }
+
+      void insert(geometry_key const & key, viennagrid::mesh const & mesh)
+      {
+        viennagrid::mesh cached;
+        viennagrid::copy( mesh, cached );
+
+        scoped_lock lock(mutex_);
+
+        entries.push_back( std::make_pair(key, cached) );
+        if (entries.size() > max_size)
+          entries.pop_front();
+      }
+
+    private:
+      typedef std::pair<geometry_key, viennagrid::mesh> EntryType;
+
+      std::list<EntryType> entries;
+      mutex mutex_;
+    };
+
+    background_mesh_cache background_meshes;
+
+
+    viennagrid::mesh make_background_mesh(tetgen::mesh const & mesh,
+                                          point_container const & hole_points,
+                                          seed_point_container const & seed_points)
+    {
+      viennagrid::mesh simple_mesh;
 
       tetgenbehavior options;
       options.zeroindex = 1;
@@ -298,7 +456,7 @@ namespace viennamesh
       make_mesh_impl(mesh, tmp_mesh, hole_points, seed_points, options);
       viennamesh::convert( tmp_mesh, simple_mesh );
 
-      return viennamesh::sizing_function::from_xml(sf, simple_mesh, base_path);
+      return simple_mesh;
     }
 
 
@@ -317,6 +475,8 @@ namespace viennamesh
       data_handle<bool> extract_region_seed_points = get_input<bool>("extract_region_seed_points");
       data_handle<double> cell_size = get_input<double>("cell_size");
       data_handle<bool> forbid_steiner_points_on_faces = get_input<bool>("forbid_steiner_points_on_faces");
+      mesh_handle input_background_mesh = get_input<mesh_handle>("background_mesh");
+      data_handle<bool> cache_background_mesh = get_input<bool>("cache_background_mesh");
 
 
 
@@ -327,7 +487,7 @@ namespace viennamesh
       data_handle<tetgen::mesh> output_mesh = make_data<tetgen::mesh>();
 
 
-      tetgen::mesh & im = const_cast<tetgen::mesh &>(input_mesh());
+      tetgen::mesh const & im = input_mesh();
       tetgen::mesh & om = const_cast<tetgen::mesh &>(output_mesh());
 
 
@@ -357,9 +517,7 @@ namespace viennamesh
 //         options.addsteiner_algo = 2;
       }
 
-      using_sizing_function = false;
-      using_max_edge_ratio = false;
-      using_max_inscribed_radius_edge_ratio = false;
+      refinement_context refinement;
 
 
 //       tetgenio tmp = input_mesh();
@@ -385,19 +543,17 @@ namespace viennamesh
 
       if (max_edge_ratio.valid())
       {
-        viennamesh::tetgen::max_edge_ratio = max_edge_ratio();
-        using_max_edge_ratio = true;
+        refinement.max_edge_ratio = max_edge_ratio();
+        refinement.using_max_edge_ratio = true;
         options.use_refinement_callback = 1;
-        im.tetunsuitable = should_tetrahedron_be_refined_function;
         info(1) << "Using global max edge ratio: " << max_edge_ratio() << std::endl;
       }
 
       if (max_inscribed_radius_edge_ratio.valid())
       {
-        viennamesh::tetgen::max_inscribed_radius_edge_ratio = max_inscribed_radius_edge_ratio();
-        using_max_inscribed_radius_edge_ratio = true;
+        refinement.max_inscribed_radius_edge_ratio = max_inscribed_radius_edge_ratio();
+        refinement.using_max_inscribed_radius_edge_ratio = true;
         options.use_refinement_callback = 1;
-        im.tetunsuitable = should_tetrahedron_be_refined_function;
         info(1) << "Using global max inscribed radius edge ratio: " << max_inscribed_radius_edge_ratio() << std::endl;
       }
 
@@ -446,12 +602,39 @@ namespace viennamesh
       {
         info(5) << "Using user-defined XML string sizing function" << std::endl;
         info(5) << sizing_function() << std::endl;
-        tetgen_sizing_function = make_sizing_function(
-                                    input_mesh(), hole_points, seed_points,
-                                    sizing_function(), base_path());
-        using_sizing_function = true;
+
+        // the sizing function needs a background mesh of the geometry, it is either
+        // passed in, taken from the cache or created by an unrefined tetgen run
+        viennagrid::mesh background;
+        if (input_background_mesh.valid())
+        {
+          info(5) << "Using background mesh from input" << std::endl;
+          background = input_background_mesh();
+        }
+        else
+        {
+          bool use_cache = cache_background_mesh.valid() && cache_background_mesh();
+          geometry_key key;
+          if (use_cache)
+            key = make_geometry_key(im, hole_points, seed_points);
+
+          if (use_cache && background_meshes.find(key, background))
+            info(5) << "Using cached background mesh" << std::endl;
+          else
+          {
+            background = make_background_mesh(im, hole_points, seed_points);
+            if (use_cache)
+              background_meshes.insert(key, background);
+          }
+        }
+
+        mesh_handle output_background_mesh = make_data<mesh_handle>();
+        output_background_mesh.set(background);
+        set_output("background_mesh", output_background_mesh);
+
+        refinement.sizing_function = viennamesh::sizing_function::program_from_xml(sizing_function(), background, base_path());
+        refinement.using_sizing_function = true;
         options.use_refinement_callback = 1;
-        im.tetunsuitable = should_tetrahedron_be_refined_function;
 
 //         options << "u";
 //         should_triangle_be_refined = should_triangle_be_refined_function;
@@ -501,7 +684,7 @@ namespace viennamesh
 
 
 //       tetgen::output_mesh output_mesh;
-      make_mesh_impl( im, om, hole_points, seed_points, options );
+      make_mesh_impl( im, om, hole_points, seed_points, options, &refinement );
       set_output("mesh", output_mesh);
 
 //       if (sizing_function.valid())
@@ -130,11 +130,14 @@ namespace viennamesh
     typedef viennagrid::result_of::const_element_range<ViennaGridMeshType, 2>::type ConstCellRangeType;
     typedef viennagrid::result_of::iterator<ConstCellRangeType>::type ConstCellIteratorType;
 
-    std::map<ConstVertexType, int> vertex_handle_to_tetgen_index_map;
+    std::size_t vertex_count = viennagrid::vertices(input).size();
+
+    // tetgen index of a vertex by its viennagrid vertex index, -1 if not yet used
+    std::vector<int> vertex_index_to_tetgen_index(vertex_count, -1);
 
     output.firstnumber = 0;
     output.numberofpoints = 0;
-    output.pointlist = new REAL[ viennagrid::vertices(input).size() * 3 ];
+    output.pointlist = new REAL[ vertex_count * 3 ];
 
     int index = 0;
 
@@ -165,22 +168,23 @@ namespace viennamesh
 
         for (int i = 0; i < 2; ++i)
         {
-          std::map<ConstVertexType, int>::iterator vit = vertex_handle_to_tetgen_index_map.find( viennagrid::vertices(*lcit)[i] );
-          if (vit != vertex_handle_to_tetgen_index_map.end())
-          {
-            polygon.vertexlist[i] = vit->second;
-          }
-          else
-          {
-            output.pointlist[output.numberofpoints*3+0] = viennagrid::get_point(viennagrid::vertices(*lcit)[i])[0];
-            output.pointlist[output.numberofpoints*3+1] = viennagrid::get_point(viennagrid::vertices(*lcit)[i])[1];
-            output.pointlist[output.numberofpoints*3+2] = viennagrid::get_point(viennagrid::vertices(*lcit)[i])[2];
+          ConstVertexType vertex = viennagrid::vertices(*lcit)[i];
+          std::size_t vertex_index = vertex.id().index();
+
+          if (vertex_index >= vertex_index_to_tetgen_index.size())
+            vertex_index_to_tetgen_index.resize(vertex_index+1, -1);
 
-            polygon.vertexlist[i] = output.numberofpoints;
-            vertex_handle_to_tetgen_index_map[viennagrid::vertices(*lcit)[i]] = output.numberofpoints;
+          int & tetgen_index = vertex_index_to_tetgen_index[vertex_index];
+          if (tetgen_index < 0)
+          {
+            viennagrid::result_of::point<ViennaGridMeshType>::type point = viennagrid::get_point(vertex);
+            std::copy( &point[0], &point[0]+3, output.pointlist + output.numberofpoints*3 );
 
+            tetgen_index = output.numberofpoints;
             ++output.numberofpoints;
           }
+
+          polygon.vertexlist[i] = tetgen_index;
         }
       }
     }
@@ -193,34 +197,50 @@ namespace viennamesh
 
   viennamesh_error convert(tetgen::mesh const & input, viennagrid::mesh & output)
   {
-    typedef viennagrid::mesh                                    MeshType;
-    typedef viennagrid::result_of::element<MeshType>::type      VertexType;
-    typedef viennagrid::result_of::element<MeshType>::type      CellType;
-
-    std::vector<VertexType> vertices(input.numberofpoints);
+    std::vector<viennagrid_element_id> vertex_ids(input.numberofpoints);
 
     for (int i = 0; i < input.numberofpoints; ++i)
     {
-      vertices[i] = viennagrid::make_vertex( output,
+      vertex_ids[i] = viennagrid::make_vertex( output,
         viennagrid::make_point(input.pointlist[3*i+0], input.pointlist[3*i+1], input.pointlist[3*i+2])
-      );
+      ).id().internal();
     }
 
-    for (int i = 0; i < input.numberoftetrahedra; ++i)
+    if (input.numberoftetrahedra == 0)
+      return VIENNAMESH_SUCCESS;
+
+    // all tetrahedra are created with a single batch call, tetgen's corner list
+    // only has to be translated to vertex ids
+    std::vector<viennagrid_element_type> element_types(input.numberoftetrahedra, VIENNAGRID_ELEMENT_TYPE_TETRAHEDRON);
+    std::vector<viennagrid_int> cell_vertex_offsets(input.numberoftetrahedra+1);
+    std::vector<viennagrid_element_id> cell_vertex_ids(4*input.numberoftetrahedra);
+
+    for (int i = 0; i <= input.numberoftetrahedra; ++i)
+      cell_vertex_offsets[i] = 4*i;
+    for (int i = 0; i < 4*input.numberoftetrahedra; ++i)
+      cell_vertex_ids[i] = vertex_ids[ input.tetrahedronlist[i] ];
+
+    if (input.numberoftetrahedronattributes != 0)
     {
-      CellType cell = viennagrid::make_tetrahedron(
-        output,
-        vertices[ input.tetrahedronlist[4*i+0] ],
-        vertices[ input.tetrahedronlist[4*i+1] ],
-        vertices[ input.tetrahedronlist[4*i+2] ],
-        vertices[ input.tetrahedronlist[4*i+3] ]
-      );
-
-      if (input.numberoftetrahedronattributes != 0)
+      std::vector<viennagrid_region_id> region_ids(input.numberoftetrahedra);
+      for (int i = 0; i < input.numberoftetrahedra; ++i)
       {
-        int region_id = input.tetrahedronattributelist[i] + 0.5;
-        viennagrid::add(output.get_or_create_region(region_id), cell);
+        region_ids[i] = input.tetrahedronattributelist[i * input.numberoftetrahedronattributes] + 0.5;
+        if (i == 0 || region_ids[i] != region_ids[i-1])
+          output.get_or_create_region(region_ids[i]);
       }
+
+      viennagrid_mesh_element_batch_create( output.internal(),
+                                            element_types.size(), &element_types[0],
+                                            &cell_vertex_offsets[0], &cell_vertex_ids[0],
+                                            &region_ids[0], NULL );
+    }
+    else
+    {
+      viennagrid_mesh_element_batch_create( output.internal(),
+                                            element_types.size(), &element_types[0],
+                                            &cell_vertex_offsets[0], &cell_vertex_ids[0],
+                                            NULL, NULL );
     }
 
     return VIENNAMESH_SUCCESS;
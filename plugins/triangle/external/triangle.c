@@ -641,16 +641,23 @@ struct memorypool {
 
 /* Global constants.                                                         */
 
-REAL splitter;       /* Used to split REAL factors for exact multiplication. */
-REAL epsilon;                             /* Floating-point machine epsilon. */
-REAL resulterrbound;
-REAL ccwerrboundA, ccwerrboundB, ccwerrboundC;
-REAL iccerrboundA, iccerrboundB, iccerrboundC;
-REAL o3derrboundA, o3derrboundB, o3derrboundC;
+/* Storage class of the global variables, defined as thread local storage    */
+/*   to allow concurrent triangulations on different threads.                */
+
+#ifndef TRIANGLE_THREAD_LOCAL
+#define TRIANGLE_THREAD_LOCAL
+#endif
+
+TRIANGLE_THREAD_LOCAL REAL splitter;       /* Used to split REAL factors for exact multiplication. */
+TRIANGLE_THREAD_LOCAL REAL epsilon;                             /* Floating-point machine epsilon. */
+TRIANGLE_THREAD_LOCAL REAL resulterrbound;
+TRIANGLE_THREAD_LOCAL REAL ccwerrboundA, ccwerrboundB, ccwerrboundC;
+TRIANGLE_THREAD_LOCAL REAL iccerrboundA, iccerrboundB, iccerrboundC;
+TRIANGLE_THREAD_LOCAL REAL o3derrboundA, o3derrboundB, o3derrboundC;
 
 /* Random number seed is not constant, but I've made it global anyway.       */
 
-unsigned long randomseed;                     /* Current random number seed. */
+TRIANGLE_THREAD_LOCAL unsigned long randomseed;                     /* Current random number seed. */
 
 
 /* Mesh data structure.  Triangle operates on only one mesh, but the mesh    */
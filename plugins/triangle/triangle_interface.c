@@ -1,12 +1,30 @@
 #include "triangle_interface.h"
 #include <stdlib.h>
 
-int (*should_triangle_be_refined)(REAL * triorg, REAL * tridest, REAL * triapex, REAL area) = 0;
+#ifndef TRIANGLE_THREAD_LOCAL
+#define TRIANGLE_THREAD_LOCAL
+#endif
+
+/* triunsuitable has no user data argument, the refinement test is bound per thread */
+static TRIANGLE_THREAD_LOCAL triangle_refinement_function refinement_function = 0;
+static TRIANGLE_THREAD_LOCAL void * refinement_data = 0;
+
+void triangle_set_refinement_function(triangle_refinement_function function, void * data)
+{
+  refinement_function = function;
+  refinement_data = data;
+}
+
+void triangle_get_refinement_function(triangle_refinement_function * function, void ** data)
+{
+  *function = refinement_function;
+  *data = refinement_data;
+}
 
 int triunsuitable(REAL * triorg, REAL * tridest, REAL * triapex, REAL area)
 {
-  if (should_triangle_be_refined)
-    return should_triangle_be_refined(triorg, tridest, triapex, area);
+  if (refinement_function)
+    return refinement_function(triorg, tridest, triapex, area, refinement_data);
   else
     return 0;
 }
@@ -12,7 +12,12 @@
 #include "external/triangle.h"
 #include "viennamesh/viennamesh.h"
 
-extern int (*should_triangle_be_refined)(REAL * triorg, REAL * tridest, REAL * triapex, REAL area);
+/* refinement test of the -u switch, data is the pointer bound with the function */
+typedef int (*triangle_refinement_function)(REAL * triorg, REAL * tridest, REAL * triapex, REAL area, void * data);
+
+/* binds the refinement test for triangulations running on the calling thread */
+void triangle_set_refinement_function(triangle_refinement_function function, void * data);
+void triangle_get_refinement_function(triangle_refinement_function * function, void ** data);
 
 typedef struct triangulateio * triangle_mesh;
 viennamesh_error triangle_make_mesh(triangle_mesh * mesh);
@@ -16,15 +16,24 @@
 #include "triangle_make_hull.hpp"
 
 #include "viennagrid/algorithm/refine.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
   namespace triangle
   {
 
-    double max_length = 0.0;
-    int should_hull_triangle_be_refined_function(double * triorg, double * tridest, double * triapex, double)
+    // refinement parameters of one facet triangulation
+    struct hull_refinement
     {
+      double max_length;
+    };
+
+    // data is the hull_refinement of the triangulation
+    int should_hull_triangle_be_refined_function(double * triorg, double * tridest, double * triapex, double, void * data)
+    {
+      double max_length = static_cast<hull_refinement const *>(data)->max_length;
+
       REAL dxoa, dxda, dxod;
       REAL dyoa, dyda, dyod;
       REAL oalen, dalen, odlen;
@@ -81,6 +90,66 @@ namespace viennamesh
     };
 
 
+    // Triangulates the facets [first, last) of input into output. Facets are
+    // independent 2D problems, tasks of different facets run concurrently.
+    struct triangulate_facets_task
+    {
+      void operator()() const
+      {
+        // refinement parameters are bound to the thread running this task
+        hull_refinement local_refinement = refinement;
+        scoped_refinement_function refinement_binding( refine ? should_hull_triangle_be_refined_function : NULL, &local_refinement );
+
+        std::vector<char> buffer( options->begin(), options->end() );
+        buffer.push_back(0);
+
+        for (std::size_t i = first; i != last; ++i)
+        {
+          cell_3d const & input_cell = input->cells[i];
+          cell_3d & output_cell = output->cells[i];
+
+          triangulateio cur_tmp = input_cell.plc;
+          REAL * tmp_holelist = NULL;
+
+          std::vector<point> const & hole_points_2d = input_cell.hole_points_2d;
+
+          if (!hole_points_2d.empty())
+          {
+            tmp_holelist = (REAL*)malloc( 2*sizeof(REAL)*(cur_tmp.numberofholes+hole_points_2d.size()) );
+            memcpy( tmp_holelist, cur_tmp.holelist, 2*sizeof(REAL)*cur_tmp.numberofholes );
+
+            for (std::size_t j = 0; j < hole_points_2d.size(); ++j)
+            {
+              tmp_holelist[2*(cur_tmp.numberofholes+j)+0] = hole_points_2d[j][0];
+              tmp_holelist[2*(cur_tmp.numberofholes+j)+1] = hole_points_2d[j][1];
+            }
+
+            cur_tmp.numberofholes += hole_points_2d.size();
+            cur_tmp.holelist = tmp_holelist;
+          }
+
+          triangulate( &buffer[0], &cur_tmp, &output_cell.plc, NULL);
+
+          output_cell.global_vertex_ids = input_cell.global_vertex_ids;
+          output_cell.projection_functor = input_cell.projection_functor;
+
+          if (!hole_points_2d.empty())
+            free(tmp_holelist);
+        }
+      }
+
+      mesh_3d const * input;
+      mesh_3d * output;
+      std::string const * options;
+
+      hull_refinement refinement;
+      bool refine;
+
+      std::size_t first;
+      std::size_t last;
+    };
+
+
     viennamesh_error convert_to_triangle_3d_cell(viennagrid_plc plc, viennagrid_int facet_id, triangle::cell_3d & output)
     {
       viennagrid_dimension geometric_dimension;
@@ -283,12 +352,15 @@ namespace viennamesh
       data_handle<double> cell_size = get_input<double>("cell_size");
       data_handle<bool> delaunay = get_input<bool>("delaunay");
       data_handle<viennamesh_string> algorithm_type = get_input<viennamesh_string>("algorithm_type");
+      data_handle<int> thread_count = get_input<int>("thread_count");
 
       std::ostringstream options;
       options << "zpQYY";
 
 
       triangle::mesh_3d triangle_3d_input_mesh;
+      triangle::hull_refinement refinement;
+      refinement.max_length = 0.0;
 
       if (cell_size.valid())
       {
@@ -302,12 +374,11 @@ namespace viennamesh
         convert( refined_plc, triangle_3d_input_mesh );
         viennagrid_plc_release(refined_plc);
 
-        max_length = cell_size();
+        refinement.max_length = cell_size();
 
         info(1) << "using cell size " << cell_size() << std::endl;
 
         options << "u";
-        should_triangle_be_refined = should_hull_triangle_be_refined_function;
       }
       else
         convert( input_plc() , triangle_3d_input_mesh );
@@ -349,44 +420,32 @@ namespace viennamesh
       triangle_3d_output_mesh.vertex_points_3d = triangle_3d_input_mesh.vertex_points_3d;
       triangle_3d_output_mesh.region_count = triangle_3d_input_mesh.region_count;
 
-      for (unsigned int i = 0; i < triangle_3d_input_mesh.cells.size(); ++i)
-      {
-        info(10) << "Create hull for mesh " << i << std::endl;
-        triangulateio cur_tmp = triangle_3d_input_mesh.cells[i].plc;
-        REAL * tmp_holelist = NULL;
+      std::string option_string = options.str();
+      std::size_t facet_count = triangle_3d_input_mesh.cells.size();
 
-        std::vector<point> const & hole_points_2d = triangle_3d_input_mesh.cells[i].hole_points_2d;
-
-        if (!hole_points_2d.empty())
-        {
-          tmp_holelist = (REAL*)malloc( 2*sizeof(REAL)*(cur_tmp.numberofholes+hole_points_2d.size()) );
-          memcpy( tmp_holelist, cur_tmp.holelist, 2*sizeof(REAL)*cur_tmp.numberofholes );
-
-          for (std::size_t i = 0; i < hole_points_2d.size(); ++i)
-          {
-            tmp_holelist[2*(cur_tmp.numberofholes+i)+0] = hole_points_2d[i][0];
-            tmp_holelist[2*(cur_tmp.numberofholes+i)+1] = hole_points_2d[i][1];
-          }
+      {
+        thread_pool pool( thread_count.valid() ? thread_count() : 0 );
+        std::size_t chunk_count = std::max<std::size_t>( std::min<std::size_t>(facet_count, 8*pool.worker_count()), 1 );
 
-          cur_tmp.numberofholes += hole_points_2d.size();
-          cur_tmp.holelist = tmp_holelist;
-        }
+        info(5) << "Triangulating " << facet_count << " facets using " << pool.worker_count() << " threads" << std::endl;
 
-        char * buffer = new char[options.str().length()+1];
-        std::strcpy(buffer, options.str().c_str());
-//         info(1) << "   Using buffer " << buffer << std::endl;
+        // one capture for all facets, output of the worker threads is captured as well
+        StdCaptureHandle capture_handle;
 
+        for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
         {
-          StdCaptureHandle capture_handle;
-          triangulate( buffer, &cur_tmp, &triangle_3d_output_mesh.cells[i].plc, NULL);
+          triangulate_facets_task task;
+          task.input = &triangle_3d_input_mesh;
+          task.output = &triangle_3d_output_mesh;
+          task.options = &option_string;
+          task.refinement = refinement;
+          task.refine = cell_size.valid();
+          task.first = facet_count*chunk/chunk_count;
+          task.last = facet_count*(chunk+1)/chunk_count;
+
+          pool.submit(task);
         }
-
-        triangle_3d_output_mesh.cells[i].global_vertex_ids = triangle_3d_input_mesh.cells[i].global_vertex_ids;
-        triangle_3d_output_mesh.cells[i].projection_functor = triangle_3d_input_mesh.cells[i].projection_functor;
-
-        delete[] buffer;
-        if (!hole_points_2d.empty())
-          free(tmp_holelist);
+        pool.wait();
       }
 
 
@@ -14,7 +14,6 @@
 
 #include "triangle_mesh.hpp"
 #include "triangle_make_mesh.hpp"
-#include <boost/array.hpp>
 #include "viennagrid/algorithm/extract_seed_points.hpp"
 #include "viennameshpp/sizing_function.hpp"
 
@@ -22,10 +21,12 @@ namespace viennamesh
 {
   namespace triangle
   {
-    sizing_function::base_functor::function_type triangle_sizing_function;
-
-    int should_triangle_be_refined_function(double * triorg, double * tridest, double * triapex, double)
+    // data is the sizing_function::program of the triangulation
+    int should_triangle_be_refined_function(double * triorg, double * tridest, double * triapex, double, void * data)
     {
+      sizing_function::program const & triangle_sizing_function =
+          *static_cast<sizing_function::program const *>(data);
+
       REAL dxoa, dxda, dxod;
       REAL dyoa, dyda, dyod;
       REAL oalen, dalen, odlen;
@@ -45,34 +46,20 @@ namespace viennamesh
       maxlen = (dalen > oalen) ? dalen : oalen;
       maxlen = (odlen > maxlen) ? odlen : maxlen;
 
-      viennagrid::point pt(2);
-      pt[0] = (triorg[0] + tridest[0] + triapex[0]) / 3;
-      pt[1] = (triorg[1] + tridest[1] + triapex[1]) / 3;
-
-
-
 
-      boost::array<viennagrid::point, 4> sample_points;
-      sample_points[0] = viennagrid::make_point(triorg[0], triorg[1]);
-      sample_points[1] = viennagrid::make_point(tridest[0], tridest[1]);
-      sample_points[2] = viennagrid::make_point(triapex[0], triapex[1]);
-      sample_points[3] = pt;
+      // the corners and the centroid are evaluated as one batch, x coordinates first
+      double sample_points[8] = { triorg[0], tridest[0], triapex[0], (triorg[0] + tridest[0] + triapex[0]) / 3,
+                                  triorg[1], tridest[1], triapex[1], (triorg[1] + tridest[1] + triapex[1]) / 3 };
+      double sizes[4];
+      char valid[4];
 
+      triangle_sizing_function.evaluate(4, 2, sample_points, sizes, valid);
 
       sizing_function::base_functor::result_type local_size = sizing_function::base_functor::result_type();
       for (int i = 0; i != 4; ++i)
       {
-        sizing_function::base_functor::result_type current_size = triangle_sizing_function( sample_points[i] );
-        if (current_size)
-        {
-          if (!local_size)
-            local_size = current_size;
-          else
-          {
-            if (current_size.get() < local_size.get() )
-              local_size = current_size;
-          }
-        }
+        if (valid[i] && (!local_size || sizes[i] < local_size.get()))
+          local_size = sizes[i];
       }
 
       if (local_size)
@@ -197,11 +184,11 @@ namespace viennamesh
 
 
     template<typename SizingFunctionRepresentationT>
-    sizing_function::base_functor::function_type make_sizing_function(triangle_mesh const & mesh,
-                                                                      point_container const & hole_points,
-                                                                      seed_point_container const & seed_points,
-                                                                      SizingFunctionRepresentationT const & sf,
-                                                                      std::string const & base_path)
+    sizing_function::program make_sizing_function(triangle_mesh const & mesh,
+                                                  point_container const & hole_points,
+                                                  seed_point_container const & seed_points,
+                                                  SizingFunctionRepresentationT const & sf,
+                                                  std::string const & base_path)
     {
       typedef viennagrid::mesh MeshType;
       MeshType simple_mesh;
@@ -215,7 +202,7 @@ namespace viennamesh
 
       triangle_delete_mesh(tmp_mesh);
 
-      return viennamesh::sizing_function::from_xml(sf, simple_mesh, base_path);
+      return viennamesh::sizing_function::program_from_xml(sf, simple_mesh, base_path);
     }
 
 
@@ -321,6 +308,8 @@ namespace viennamesh
 
 
 
+      sizing_function::program triangle_sizing_function;
+
       data_handle<viennamesh_string> sizing_function = get_input<viennamesh_string>("sizing_function");
       if (sizing_function.valid())
       {
@@ -330,13 +319,15 @@ namespace viennamesh
                                     input_mesh(), hole_points, seed_points,
                                     sizing_function(), base_path());
         options << "u";
-        should_triangle_be_refined = should_triangle_be_refined_function;
       }
 
 
       info(1) << "Making mesh with option string " << options.str() << std::endl;
 
 
+      triangle::scoped_refinement_function refinement( triangle_sizing_function.size() ? should_triangle_be_refined_function : NULL,
+                                                       &triangle_sizing_function );
+
       data_handle<triangle_mesh> output_mesh = make_data<triangle_mesh>();
       make_mesh_impl( input_mesh(), const_cast<triangle_mesh&>(output_mesh()), hole_points, seed_points, options.str() );
       set_output("mesh", output_mesh);
@@ -31,7 +31,6 @@ namespace viennamesh
   viennamesh_error convert(viennagrid::mesh const & input, triangulateio & output)
   {
     typedef viennagrid::mesh                                              MeshType;
-    typedef viennagrid::result_of::const_element<MeshType>::type          ConstVertexType;
 
     typedef viennagrid::result_of::const_vertex_range<MeshType>::type     ConstVertexRangeType;
     typedef viennagrid::result_of::iterator<ConstVertexRangeType>::type   ConstVertexIteratorType;
@@ -39,18 +38,23 @@ namespace viennamesh
     typedef viennagrid::result_of::const_element_range<MeshType,1>::type  ConstLineRangeType;
     typedef viennagrid::result_of::iterator<ConstLineRangeType>::type     ConstCellIteratorType;
 
-    std::map<ConstVertexType, int> vertex_handle_to_tetgen_index_map;
-
     ConstVertexRangeType vertices(input);
     viennamesh::triangle::init_points( output, vertices.size() );
 
+    // triangle index of a vertex by its viennagrid vertex index
+    std::vector<int> vertex_index_to_triangle_index( vertices.size(), -1 );
+
     int index = 0;
     for (ConstVertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit, ++index)
     {
-      output.pointlist[index*2+0] = viennagrid::get_point(input, *vit)[0];
-      output.pointlist[index*2+1] = viennagrid::get_point(input, *vit)[1];
-
-      vertex_handle_to_tetgen_index_map[ *vit ] = index;
+      viennagrid::result_of::point<MeshType>::type point = viennagrid::get_point(input, *vit);
+      output.pointlist[index*2+0] = point[0];
+      output.pointlist[index*2+1] = point[1];
+
+      std::size_t vertex_index = (*vit).id().index();
+      if (vertex_index >= vertex_index_to_triangle_index.size())
+        vertex_index_to_triangle_index.resize(vertex_index+1, -1);
+      vertex_index_to_triangle_index[vertex_index] = index;
     }
 
 
@@ -60,8 +64,8 @@ namespace viennamesh
     index = 0;
     for (ConstCellIteratorType lit = lines.begin(); lit != lines.end(); ++lit, ++index)
     {
-      output.segmentlist[2*index+0] = vertex_handle_to_tetgen_index_map[ viennagrid::vertices(*lit)[0] ];
-      output.segmentlist[2*index+1] = vertex_handle_to_tetgen_index_map[ viennagrid::vertices(*lit)[1] ];
+      output.segmentlist[2*index+0] = vertex_index_to_triangle_index[ viennagrid::vertices(*lit)[0].id().index() ];
+      output.segmentlist[2*index+1] = vertex_index_to_triangle_index[ viennagrid::vertices(*lit)[1].id().index() ];
     }
 
     return VIENNAMESH_SUCCESS;
@@ -70,34 +74,49 @@ namespace viennamesh
 
   viennamesh_error convert(triangulateio const & input, viennagrid::mesh & output)
   {
-    typedef viennagrid::mesh                                    MeshType;
-
-    typedef viennagrid::result_of::element<MeshType>::type      VertexType;
-    typedef viennagrid::result_of::element<MeshType>::type      CellType;
-
-    std::vector<VertexType> vertex_handles(input.numberofpoints);
+    std::vector<viennagrid_element_id> vertex_ids(input.numberofpoints);
 
     for (int i = 0; i < input.numberofpoints; ++i)
     {
-      vertex_handles[i] = viennagrid::make_vertex( output,
+      vertex_ids[i] = viennagrid::make_vertex( output,
         viennagrid::make_point(input.pointlist[2*i+0], input.pointlist[2*i+1])
-      );
+      ).id().internal();
     }
 
-    for (int i = 0; i < input.numberoftriangles; ++i)
+    if (input.numberoftriangles == 0)
+      return VIENNAMESH_SUCCESS;
+
+    // all triangles are created with a single batch call
+    std::vector<viennagrid_element_type> element_types(input.numberoftriangles, VIENNAGRID_ELEMENT_TYPE_TRIANGLE);
+    std::vector<viennagrid_int> cell_vertex_offsets(input.numberoftriangles+1);
+    std::vector<viennagrid_element_id> cell_vertex_ids(3*input.numberoftriangles);
+
+    for (int i = 0; i <= input.numberoftriangles; ++i)
+      cell_vertex_offsets[i] = 3*i;
+    for (int i = 0; i < 3*input.numberoftriangles; ++i)
+      cell_vertex_ids[i] = vertex_ids[ input.trianglelist[i] ];
+
+    if (input.numberoftriangleattributes != 0)
     {
-      CellType cell = viennagrid::make_triangle(
-        output,
-        vertex_handles[ input.trianglelist[3*i+0] ],
-        vertex_handles[ input.trianglelist[3*i+1] ],
-        vertex_handles[ input.trianglelist[3*i+2] ]
-      );
-
-      if (input.numberoftriangleattributes != 0)
+      std::vector<viennagrid_region_id> region_ids(input.numberoftriangles);
+      for (int i = 0; i < input.numberoftriangles; ++i)
       {
-        int segment_id = input.triangleattributelist[i];
-        viennagrid::add(output.get_or_create_region(segment_id), cell);
+        region_ids[i] = input.triangleattributelist[i * input.numberoftriangleattributes];
+        if (i == 0 || region_ids[i] != region_ids[i-1])
+          output.get_or_create_region(region_ids[i]);
       }
+
+      viennagrid_mesh_element_batch_create( output.internal(),
+                                            element_types.size(), &element_types[0],
+                                            &cell_vertex_offsets[0], &cell_vertex_ids[0],
+                                            &region_ids[0], NULL );
+    }
+    else
+    {
+      viennagrid_mesh_element_batch_create( output.internal(),
+                                            element_types.size(), &element_types[0],
+                                            &cell_vertex_offsets[0], &cell_vertex_ids[0],
+                                            NULL, NULL );
     }
 
     return VIENNAMESH_SUCCESS;
@@ -32,6 +32,24 @@ namespace viennamesh
   {
     void init_points(triangulateio & mesh, int num_points);
     void init_segments(triangulateio & mesh, int num_segments);
+
+    // binds a refinement test for triangulations on the calling thread for the lifetime of this object
+    class scoped_refinement_function
+    {
+    public:
+      scoped_refinement_function(triangle_refinement_function function, void * data)
+      {
+        triangle_get_refinement_function(&previous_function, &previous_data);
+        triangle_set_refinement_function(function, data);
+      }
+
+      ~scoped_refinement_function()
+      { triangle_set_refinement_function(previous_function, previous_data); }
+
+    private:
+      triangle_refinement_function previous_function;
+      void * previous_data;
+    };
   }
 
 
@@ -13,17 +13,286 @@
 =============================================================================== */
 
 #include "interpolate_quantities.hpp"
-#include "viennagrid/algorithm/quantity_interpolate.hpp"
+#include "interpolation_plan.hpp"
+#include "viennameshpp/aabb_tree.hpp"
+#include "viennameshpp/thread_pool.hpp"
+#include "viennagrid/algorithm/inclusion.hpp"
+#include "viennagrid/algorithm/centroid.hpp"
+#include "viennagrid/algorithm/geometry.hpp"
 
 namespace viennamesh
 {
 
+  namespace
+  {
+    typedef viennagrid::mesh                                          MeshType;
+    typedef viennagrid::result_of::point<MeshType>::type              PointType;
+    typedef viennagrid::result_of::coord<MeshType>::type              NumericType;
+    typedef viennagrid::result_of::element<MeshType>::type            ElementType;
+
+    // maximum number of source vertices of a destination vertex
+    const int MAX_WEIGHTS = 4;
+
+
+    struct first_containing_visitor
+    {
+      first_containing_visitor(aabb_tree<ElementType> const & tree_, PointType const & pt_) :
+          tree(tree_), pt(pt_), found(-1) {}
+
+      bool operator()(std::size_t index)
+      {
+        if ( !viennagrid::is_inside(tree.element(index), pt) )
+          return false;
+        found = index;
+        return true;
+      }
+
+      aabb_tree<ElementType> const & tree;
+      PointType const & pt;
+      int found;
+    };
+
+    // index (in tree order) of the cell containing pt, the nearest cell if no cell contains it
+    int locate(aabb_tree<ElementType> const & cells, PointType const & pt)
+    {
+      first_containing_visitor visitor(cells, pt);
+      if (cells.for_each_containing(pt, visitor))
+        return visitor.found;
+
+      NumericType distance;
+      return cells.nearest(pt, distance);
+    }
+
+    bool is_simplex(ElementType const & cell)
+    {
+      return cell.tag().is_line() || cell.tag().is_triangle() || cell.tag().is_tetrahedron();
+    }
+
+    // barycentric weights of pt with respect to the vertices of a simplex cell, for
+    // points outside the cell the normalized volumes of the sub-simplices are used,
+    // returns 0 for other cells
+    int barycentric_weights(ElementType const & cell, PointType const & pt, double * weights)
+    {
+      if (!is_simplex(cell))
+        return 0;
+
+      int count = viennagrid::vertices(cell).size();
+
+      PointType p[MAX_WEIGHTS];
+      for (int i = 0; i != count; ++i)
+        p[i] = viennagrid::get_point( viennagrid::vertices(cell)[i] );
+
+      if (cell.tag().is_line())
+      {
+        weights[0] = viennagrid::norm_2(p[1]-pt);
+        weights[1] = viennagrid::norm_2(p[0]-pt);
+      }
+      else if (cell.tag().is_triangle())
+      {
+        weights[0] = viennagrid::spanned_volume( pt, p[1], p[2] );
+        weights[1] = viennagrid::spanned_volume( p[0], pt, p[2] );
+        weights[2] = viennagrid::spanned_volume( p[0], p[1], pt );
+      }
+      else
+      {
+        weights[0] = std::abs( viennagrid::inner_prod(p[1]-pt, viennagrid::cross_prod(p[2]-pt, p[3]-pt)) );
+        weights[1] = std::abs( viennagrid::inner_prod(p[0]-pt, viennagrid::cross_prod(p[2]-pt, p[3]-pt)) );
+        weights[2] = std::abs( viennagrid::inner_prod(p[0]-pt, viennagrid::cross_prod(p[1]-pt, p[3]-pt)) );
+        weights[3] = std::abs( viennagrid::inner_prod(p[0]-pt, viennagrid::cross_prod(p[1]-pt, p[2]-pt)) );
+      }
+
+      double sum = 0.0;
+      for (int i = 0; i != count; ++i)
+        sum += weights[i];
+
+      for (int i = 0; i != count; ++i)
+        weights[i] = (sum > 0.0) ? weights[i]/sum : 1.0/count;
+
+      return count;
+    }
+
+
+    // all values_per_quantity() values of element
+    viennagrid_numeric const * get_values(viennagrid::quantity_field const & qf, ElementType const & element)
+    {
+      void * values = NULL;
+      viennagrid_quantity_field_value_get( qf.internal(), element.id().internal(), &values );
+      return static_cast<viennagrid_numeric const *>(values);
+    }
+
+    void set_values(viennagrid::quantity_field & qf, ElementType const & element, viennagrid_numeric const * values)
+    {
+      viennagrid_quantity_field_value_set( qf.internal(), element.id().internal(), values );
+    }
+
+
+    // locates the destination vertices and cells [first, last) in the source cells
+    struct build_plan_task
+    {
+      void operator()() const
+      {
+        for (std::size_t i = first; i != last; ++i)
+        {
+          if (i < dst_vertices->size())
+          {
+            PointType pt = viennagrid::get_point( (*dst_vertices)[i] );
+            int cell = locate(*src_cells, pt);
+
+            double weights[MAX_WEIGHTS];
+            int count = barycentric_weights(src_cells->element(cell), pt, weights);
+            for (int j = 0; j != count; ++j)
+            {
+              (*vertex_sources)[MAX_WEIGHTS*i+j] = (*src_vertex_positions)[ viennagrid::vertices(src_cells->element(cell))[j].id().index() ];
+              (*vertex_weights)[MAX_WEIGHTS*i+j] = weights[j];
+            }
+          }
+          else
+          {
+            std::size_t c = i - dst_vertices->size();
+            int cell = locate(*src_cells, viennagrid::centroid( (*dst_cells)[c] ));
+            (*cell_sources)[c] = (*src_cell_positions)[cell];
+          }
+        }
+      }
+
+      aabb_tree<ElementType> const * src_cells;
+      std::vector<int> const * src_vertex_positions;
+      std::vector<int> const * src_cell_positions;
+
+      std::vector<ElementType> const * dst_vertices;
+      std::vector<ElementType> const * dst_cells;
+
+      std::vector<int> * vertex_sources;
+      std::vector<double> * vertex_weights;
+      std::vector<int> * cell_sources;
+
+      std::size_t first;
+      std::size_t last;
+    };
+
+
+    interpolation_plan make_interpolation_plan(MeshType const & src, MeshType const & dst)
+    {
+      typedef viennagrid::result_of::const_vertex_range<MeshType>::type     ConstVertexRangeType;
+      typedef viennagrid::result_of::const_cell_range<MeshType>::type       ConstCellRangeType;
+      typedef viennagrid::result_of::iterator<ConstVertexRangeType>::type   ConstVertexIteratorType;
+      typedef viennagrid::result_of::iterator<ConstCellRangeType>::type     ConstCellIteratorType;
+
+      interpolation_plan plan;
+      plan.src_mesh = src;
+      plan.dst_mesh = dst;
+      plan.src_fingerprint = mesh_fingerprint(src);
+      plan.dst_fingerprint = mesh_fingerprint(dst);
+
+      ConstVertexRangeType src_vertex_range(src);
+      ConstCellRangeType src_cell_range(src);
+
+      ConstVertexRangeType dst_vertex_range(dst);
+      ConstCellRangeType dst_cell_range(dst);
+
+      std::vector<ElementType> dst_vertices( dst_vertex_range.begin(), dst_vertex_range.end() );
+      std::vector<ElementType> dst_cells( dst_cell_range.begin(), dst_cell_range.end() );
+
+      plan.vertex_offsets.assign( dst_vertices.size()+1, 0 );
+      plan.cell_sources.assign( dst_cells.size(), -1 );
+
+      if (src_cell_range.size() == 0)
+        return plan;
+
+      // positions of the source vertices and cells by their viennagrid index
+      std::vector<int> src_vertex_positions;
+      int position = 0;
+      for (ConstVertexIteratorType vit = src_vertex_range.begin(); vit != src_vertex_range.end(); ++vit, ++position)
+      {
+        std::size_t index = (*vit).id().index();
+        if (index >= src_vertex_positions.size())
+          src_vertex_positions.resize(index+1, -1);
+        src_vertex_positions[index] = position;
+      }
+
+      aabb_tree<ElementType> src_cells( src_cell_range.begin(), src_cell_range.end() );
+
+      std::size_t non_simplex_count = 0;
+      for (std::size_t i = 0; i != src_cells.size(); ++i)
+      {
+        if (!is_simplex(src_cells.element(i)))
+          ++non_simplex_count;
+      }
+      if (non_simplex_count != 0)
+        warning(1) << "Source mesh has " << non_simplex_count << " non-simplex cells, no vertex quantities are interpolated at destination vertices inside them" << std::endl;
+
+      std::vector<int> src_cell_positions( src_cells.size() );
+      {
+        std::vector<int> index_to_position;
+        position = 0;
+        for (ConstCellIteratorType cit = src_cell_range.begin(); cit != src_cell_range.end(); ++cit, ++position)
+        {
+          std::size_t index = (*cit).id().index();
+          if (index >= index_to_position.size())
+            index_to_position.resize(index+1, -1);
+          index_to_position[index] = position;
+        }
+
+        for (std::size_t i = 0; i != src_cells.size(); ++i)
+          src_cell_positions[i] = index_to_position[ src_cells.element(i).id().index() ];
+      }
+
+      std::vector<int> vertex_sources( MAX_WEIGHTS*dst_vertices.size(), -1 );
+      std::vector<double> vertex_weights( MAX_WEIGHTS*dst_vertices.size(), 0.0 );
+
+      {
+        thread_pool pool;
+
+        std::size_t total = dst_vertices.size() + dst_cells.size();
+        std::size_t chunk_count = std::min<std::size_t>( total, 8*pool.worker_count() );
+        for (std::size_t chunk = 0; chunk != chunk_count; ++chunk)
+        {
+          build_plan_task task;
+          task.src_cells = &src_cells;
+          task.src_vertex_positions = &src_vertex_positions;
+          task.src_cell_positions = &src_cell_positions;
+          task.dst_vertices = &dst_vertices;
+          task.dst_cells = &dst_cells;
+          task.vertex_sources = &vertex_sources;
+          task.vertex_weights = &vertex_weights;
+          task.cell_sources = &plan.cell_sources;
+          task.first = total * chunk / chunk_count;
+          task.last = total * (chunk+1) / chunk_count;
+
+          pool.submit(task);
+        }
+
+        pool.wait();
+      }
+
+      for (std::size_t i = 0; i != dst_vertices.size(); ++i)
+      {
+        for (int j = 0; j != MAX_WEIGHTS; ++j)
+        {
+          if (vertex_sources[MAX_WEIGHTS*i+j] == -1)
+            continue;
+
+          plan.vertex_sources.push_back( vertex_sources[MAX_WEIGHTS*i+j] );
+          plan.vertex_weights.push_back( vertex_weights[MAX_WEIGHTS*i+j] );
+        }
+        plan.vertex_offsets[i+1] = plan.vertex_sources.size();
+      }
+
+      return plan;
+    }
+  }
+
+
+
   interpolate_quantities::interpolate_quantities() {}
   std::string interpolate_quantities::name() { return "interpolate_quantities"; }
 
 
   bool interpolate_quantities::run(viennamesh::algorithm_handle &)
   {
+    typedef viennagrid::result_of::const_vertex_range<MeshType>::type     ConstVertexRangeType;
+    typedef viennagrid::result_of::const_cell_range<MeshType>::type       ConstCellRangeType;
+
     mesh_handle src_mesh = get_required_input<mesh_handle>("src_mesh");
     mesh_handle dst_mesh = get_required_input<mesh_handle>("dst_mesh");
 
@@ -31,11 +300,42 @@ namespace viennamesh
     quantity_field_handle dst_quantity_fields = make_data<viennagrid::quantity_field>();
     dst_quantity_fields.resize( src_quantity_fields.size() );
 
+    // a plan of a previous step is reused if it was built for the same meshes
+    data_handle<interpolation_plan> input_plan = get_input<interpolation_plan>("interpolation_plan");
+    data_handle<interpolation_plan> plan = make_data<interpolation_plan>();
+
+    if ( input_plan.valid() && input_plan().matches(src_mesh(), dst_mesh()) )
+    {
+      info(1) << "Reusing interpolation plan" << std::endl;
+      plan = input_plan;
+    }
+    else
+      plan.set( make_interpolation_plan(src_mesh(), dst_mesh()) );
+
+    interpolation_plan const & p = plan();
+
+    ConstVertexRangeType src_vertex_range( src_mesh() );
+    ConstCellRangeType src_cell_range( src_mesh() );
+    ConstVertexRangeType dst_vertex_range( dst_mesh() );
+    ConstCellRangeType dst_cell_range( dst_mesh() );
+
+    std::vector<ElementType> src_vertices( src_vertex_range.begin(), src_vertex_range.end() );
+    std::vector<ElementType> src_cells( src_cell_range.begin(), src_cell_range.end() );
+    std::vector<ElementType> dst_vertices( dst_vertex_range.begin(), dst_vertex_range.end() );
+    std::vector<ElementType> dst_cells( dst_cell_range.begin(), dst_cell_range.end() );
+
+    int src_cell_dimension = viennagrid::cell_dimension( src_mesh() );
+    int dst_cell_dimension = viennagrid::cell_dimension( dst_mesh() );
+
 
     for (int i = 0; i != src_quantity_fields.size(); ++i)
     {
       viennagrid::quantity_field src_qf = src_quantity_fields(i);
-      if (src_qf.topologic_dimension() != 0)
+
+      bool on_vertices = src_qf.topologic_dimension() == 0;
+      bool on_cells = src_qf.topologic_dimension() == src_cell_dimension;
+
+      if (!on_vertices && !on_cells)
       {
         info(1) << "Quantity field \"" << src_qf.get_name() << "\" has unsupported topologic dimension = " << (int)src_qf.topologic_dimension() << " -> skipping" << std::endl;
         continue;
@@ -44,16 +344,51 @@ namespace viennamesh
       info(1) << "Found quantity field \"" << src_qf.get_name() << "\" with topologic dimension " << (int)src_qf.topologic_dimension() <<
       " and values dimension " << (int)src_qf.values_per_quantity() << std::endl;
 
-      viennagrid::quantity_field dst_qf( 0, src_qf.values_per_quantity(), src_qf.storage_layout() );
-      dst_qf.set_name( src_qf.get_name() );
+      // the plan is applied to every component, values of an element are stored contiguously
+      int values_per_quantity = src_qf.values_per_quantity();
+      std::vector<viennagrid_numeric> values(values_per_quantity);
+
+      if (on_vertices)
+      {
+        viennagrid::quantity_field dst_qf( 0, values_per_quantity, src_qf.storage_layout() );
+        dst_qf.set_name( src_qf.get_name() );
+
+        for (std::size_t v = 0; v != dst_vertices.size(); ++v)
+        {
+          if (p.vertex_offsets[v] == p.vertex_offsets[v+1])
+            continue;
 
-      viennagrid::interpolate_vertex_quantity( src_mesh(), src_qf, dst_mesh(), dst_qf, 0 );
+          std::fill( values.begin(), values.end(), viennagrid_numeric(0) );
+          for (int j = p.vertex_offsets[v]; j != p.vertex_offsets[v+1]; ++j)
+          {
+            viennagrid_numeric const * src_values = get_values( src_qf, src_vertices[p.vertex_sources[j]] );
+            for (int k = 0; k != values_per_quantity; ++k)
+              values[k] += p.vertex_weights[j] * src_values[k];
+          }
 
-      dst_quantity_fields.set(i, dst_qf);
+          set_values( dst_qf, dst_vertices[v], &values[0] );
+        }
+
+        dst_quantity_fields.set(i, dst_qf);
+      }
+      else
+      {
+        viennagrid::quantity_field dst_qf( dst_cell_dimension, values_per_quantity, src_qf.storage_layout() );
+        dst_qf.set_name( src_qf.get_name() );
+
+        for (std::size_t c = 0; c != dst_cells.size(); ++c)
+        {
+          if (p.cell_sources[c] != -1)
+            set_values( dst_qf, dst_cells[c], get_values(src_qf, src_cells[p.cell_sources[c]]) );
+        }
+
+        dst_quantity_fields.set(i, dst_qf);
+      }
     }
 
 
     set_output( "quantities", dst_quantity_fields );
+    set_output( "interpolation_plan", plan );
 
     return true;
   }
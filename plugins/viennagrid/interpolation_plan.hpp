@@ -0,0 +1,116 @@
+#ifndef VIENNAMESH_ALGORITHM_VIENNAGRID_INTERPOLATION_PLAN_HPP
+#define VIENNAMESH_ALGORITHM_VIENNAGRID_INTERPOLATION_PLAN_HPP
+
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+
+                    http://viennamesh.sourceforge.net/
+
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include "viennameshpp/plugin.hpp"
+
+namespace viennamesh
+{
+  inline void fingerprint_add(unsigned long long & hash, void const * data, std::size_t size)
+  {
+    unsigned char const * bytes = static_cast<unsigned char const *>(data);
+    for (std::size_t i = 0; i != size; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  // FNV-1a hash of the vertex coordinates and the cell vertices of a mesh,
+  // changes if the mesh is modified in place
+  inline unsigned long long mesh_fingerprint(viennagrid::mesh const & mesh)
+  {
+    typedef viennagrid::result_of::const_vertex_range<viennagrid::mesh>::type         ConstVertexRangeType;
+    typedef viennagrid::result_of::const_cell_range<viennagrid::mesh>::type           ConstCellRangeType;
+    typedef viennagrid::result_of::const_vertex_range<viennagrid::const_element>::type ConstBoundaryVertexRangeType;
+    typedef viennagrid::result_of::iterator<ConstVertexRangeType>::type               ConstVertexIteratorType;
+    typedef viennagrid::result_of::iterator<ConstCellRangeType>::type                 ConstCellIteratorType;
+    typedef viennagrid::result_of::iterator<ConstBoundaryVertexRangeType>::type       ConstBoundaryVertexIteratorType;
+
+    unsigned long long hash = 14695981039346656037ULL;
+
+    ConstVertexRangeType vertices(mesh);
+    for (ConstVertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit)
+    {
+      viennagrid::point pt = viennagrid::get_point(*vit);
+      std::size_t index = (*vit).id().index();
+      fingerprint_add(hash, &index, sizeof(index));
+      if (pt.size() != 0)
+        fingerprint_add(hash, &pt[0], pt.size()*sizeof(pt[0]));
+    }
+
+    ConstCellRangeType cells(mesh);
+    for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+    {
+      ConstBoundaryVertexRangeType cell_vertices(*cit);
+      for (ConstBoundaryVertexIteratorType vit = cell_vertices.begin(); vit != cell_vertices.end(); ++vit)
+      {
+        std::size_t index = (*vit).id().index();
+        fingerprint_add(hash, &index, sizeof(index));
+      }
+    }
+
+    return hash;
+  }
+
+
+  // Location of the entities of a destination mesh in a source mesh, computed
+  // once and applied to any number of quantity fields. Every destination vertex
+  // is a weighted sum of source vertices (barycentric weights in the containing
+  // or nearest source cell), every destination cell takes the value of the
+  // source cell containing its centroid. Entities are referenced by their
+  // position in the vertex/cell ranges of the meshes.
+  struct interpolation_plan
+  {
+    interpolation_plan() : src_fingerprint(0), dst_fingerprint(0) {}
+
+    // true if the plan was built for these meshes and they were not modified since,
+    // the plan holds both meshes so their handles cannot be reused by other meshes
+    bool matches(viennagrid::mesh const & src, viennagrid::mesh const & dst) const
+    {
+      return src.internal() == src_mesh.internal() && dst.internal() == dst_mesh.internal() &&
+             mesh_fingerprint(src) == src_fingerprint &&
+             mesh_fingerprint(dst) == dst_fingerprint;
+    }
+
+    viennagrid::mesh src_mesh;
+    viennagrid::mesh dst_mesh;
+
+    unsigned long long src_fingerprint;
+    unsigned long long dst_fingerprint;
+
+    // sparse matrix in CSR format, row i holds the source vertices and weights of destination vertex i
+    std::vector<int> vertex_offsets;
+    std::vector<int> vertex_sources;
+    std::vector<double> vertex_weights;
+
+    // source cell of every destination cell, -1 if there is none
+    std::vector<int> cell_sources;
+  };
+
+  namespace result_of
+  {
+    template<>
+    struct data_information<interpolation_plan>
+    {
+      static std::string type_name() { return "viennamesh::interpolation_plan"; }
+      static viennamesh_data_make_function make_function() { return viennamesh::generic_make<interpolation_plan>; }
+      static viennamesh_data_delete_function delete_function() { return viennamesh::generic_delete<interpolation_plan>; }
+    };
+  }
+}
+
+#endif
@@ -12,155 +12,175 @@
    License:         MIT (X11), see file LICENSE in the base directory
 =============================================================================== */
 
+#include <cmath>
+#include <algorithm>
+
 #include "laplace_smooth.hpp"
 #include "viennagrid/viennagrid.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
-  // http://en.wikipedia.org/wiki/Laplacian_smoothing
-  // http://graphics.stanford.edu/courses/cs468-12-spring/LectureSlides/06_smoothing.pdf
-  void laplace_smooth_impl( viennagrid::mesh const & mesh, viennagrid_numeric lambda )
+  namespace
   {
-    typedef viennagrid::mesh                                        MeshType;
-
-    typedef viennagrid::result_of::point<MeshType>::type            PointType;
-    typedef viennagrid::result_of::element<MeshType>::type          VertexType;
 
-    typedef viennagrid::result_of::vertex_range<MeshType>::type     VertexRangeType;
-    typedef viennagrid::result_of::iterator<VertexRangeType>::type  VertexIteratorType;
-
-    viennagrid_dimension dim = viennagrid::geometric_dimension(mesh);
-
-    VertexRangeType vertices(mesh);
-
-    std::vector<PointType> vertex_offset_container(vertices.size(), PointType(dim));
-    viennagrid::result_of::accessor<std::vector<PointType>, VertexType>::type vertex_offset(vertex_offset_container);
-
-    for (VertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit)
+    // Vertex adjacency used by the smoothing iterations, built once per run.
+    // Vertices are referenced by their position in the vertex range of the mesh,
+    // the neighbors of vertex i are neighbors[offsets[i]] ... neighbors[offsets[i+1]-1].
+    // Fixed vertices and vertices without neighbors are not moved.
+    struct laplace_stencil
     {
-      if (viennagrid::is_any_boundary(*vit))
-        continue;
+      std::vector<int> offsets;
+      std::vector<int> neighbors;
+      std::vector<char> fixed;
+    };
 
-      typedef viennagrid::result_of::coboundary_range<MeshType>::type CoboundaryVertexRangeType;
-      typedef viennagrid::result_of::iterator<CoboundaryVertexRangeType>::type CoboundaryLineIteratorType;
 
-      PointType sum(dim);
-      PointType point = viennagrid::get_point(*vit);
-
-      CoboundaryVertexRangeType coboundary_lines(mesh, *vit, 1);
-      for (CoboundaryLineIteratorType lit = coboundary_lines.begin(); lit != coboundary_lines.end(); ++lit)
+    // maps vertex id indices to positions in the vertex range
+    template<typename VertexContainerT>
+    std::vector<int> vertex_positions(VertexContainerT const & vertices)
+    {
+      std::vector<int> positions;
+      for (std::size_t i = 0; i != vertices.size(); ++i)
       {
-        PointType neighbor_point = viennagrid::get_point(
-                                viennagrid::vertices(*lit)[0] == *vit ?
-                                viennagrid::vertices(*lit)[1] :
-                                viennagrid::vertices(*lit)[0]);
-
-        sum += neighbor_point-point;
+        std::size_t index = vertices[i].id().index();
+        if (index >= positions.size())
+          positions.resize(index+1, -1);
+        positions[index] = i;
       }
-
-      sum /= coboundary_lines.size();
-      sum *= lambda;
-
-      vertex_offset.set(*vit, sum);
+      return positions;
     }
 
-    for (VertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit)
-      viennagrid::set_point( *vit, viennagrid::get_point(*vit) + vertex_offset.get(*vit) );
-  }
-
-
-
-
 
-
-
-
-  template<typename RegionRangeT>
-  bool is_subset(RegionRangeT const & subset, RegionRangeT const & superset)
-  {
-    typedef typename viennagrid::result_of::const_iterator<RegionRangeT>::type RegionRangeIterator;
-
-    for (RegionRangeIterator it = subset.begin(); it != subset.end(); ++it)
+    // http://en.wikipedia.org/wiki/Laplacian_smoothing
+    // http://graphics.stanford.edu/courses/cs468-12-spring/LectureSlides/06_smoothing.pdf
+    // boundary vertices are fixed, all other vertices move towards the mean of their line neighbors
+    template<typename VertexContainerT>
+    void make_laplace_stencil( viennagrid::mesh const & mesh, VertexContainerT const & vertices, laplace_stencil & stencil )
     {
-      RegionRangeIterator jt = superset.begin();
-      for (; jt != superset.end(); ++jt)
-        if ( (*it).id() == (*jt).id() )
-          break;
+      typedef viennagrid::mesh MeshType;
+      typedef viennagrid::result_of::coboundary_range<MeshType>::type CoboundaryLineRangeType;
+      typedef viennagrid::result_of::iterator<CoboundaryLineRangeType>::type CoboundaryLineIteratorType;
 
-      if (jt == superset.end())
-        return false;
-    }
+      std::vector<int> positions = vertex_positions(vertices);
 
-    return true;
-  }
-
-
-  void hull_laplace_smooth_impl( viennagrid::mesh const & mesh, viennagrid_numeric lambda )
-  {
-    typedef viennagrid::mesh                                            MeshType;
+      stencil.offsets.assign(1, 0);
+      stencil.neighbors.clear();
+      stencil.fixed.assign(vertices.size(), 0);
 
-    typedef viennagrid::result_of::point<MeshType>::type                PointType;
-    typedef viennagrid::result_of::element<MeshType>::type              VertexType;
-
-    typedef viennagrid::result_of::vertex_range<MeshType>::type         VertexRangeType;
-    typedef viennagrid::result_of::iterator<VertexRangeType>::type      VertexIteratorType;
+      for (std::size_t i = 0; i != vertices.size(); ++i)
+      {
+        if (viennagrid::is_any_boundary(vertices[i]))
+          stencil.fixed[i] = 1;
+        else
+        {
+          CoboundaryLineRangeType coboundary_lines(mesh, vertices[i], 1);
+          for (CoboundaryLineIteratorType lit = coboundary_lines.begin(); lit != coboundary_lines.end(); ++lit)
+          {
+            int first = positions[ viennagrid::vertices(*lit)[0].id().index() ];
+            int second = positions[ viennagrid::vertices(*lit)[1].id().index() ];
+            stencil.neighbors.push_back( first == static_cast<int>(i) ? second : first );
+          }
+        }
 
-    viennagrid_dimension dim = viennagrid::geometric_dimension(mesh);
+        stencil.offsets.push_back( stencil.neighbors.size() );
+      }
+    }
 
-    VertexRangeType vertices(mesh);
 
-    std::vector<PointType> vertex_offset_container(vertices.size(), PointType(dim));
-    viennagrid::result_of::accessor<std::vector<PointType>, VertexType>::type vertex_offset(vertex_offset_container);
 
-    for (VertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit)
+    // only vertices in exactly two regions (the interior of an interface
+    // between two regions) are smoothed, vertices on lines or corners where
+    // three or more regions meet are fixed
+    template<typename VertexContainerT>
+    void make_hull_laplace_stencil( viennagrid::mesh const & mesh, VertexContainerT const & vertices, laplace_stencil & stencil )
     {
+      typedef viennagrid::mesh MeshType;
+      typedef viennagrid::result_of::element<MeshType>::type VertexType;
       typedef viennagrid::result_of::region_range<VertexType>::type RegionRangeType;
-//       typedef typename viennagrid::result_of::iterator<RegionRangeType>::type RegionRangeIterator;
 
       typedef viennagrid::result_of::neighbor_range<MeshType>::type NeighborVertexRangeType;
       typedef viennagrid::result_of::iterator<NeighborVertexRangeType>::type NeighborVertexRangeIterator;
 
-      PointType offset(dim);
-      int point_count = 0;
+      std::vector<int> positions = vertex_positions(vertices);
 
-      PointType point = viennagrid::get_point(*vit);
+      stencil.offsets.assign(1, 0);
+      stencil.neighbors.clear();
+      stencil.fixed.assign(vertices.size(), 0);
 
-      NeighborVertexRangeType neighbor_vertices(mesh, *vit, 1, 0);
+      for (std::size_t i = 0; i != vertices.size(); ++i)
+      {
+        RegionRangeType regions(vertices[i]);
 
-      RegionRangeType regions(*vit);
-//       std::cout << regions.size() << std::endl;
+        if (regions.size() != 2)
+          stencil.fixed[i] = 1;
+        else
+        {
+          NeighborVertexRangeType neighbor_vertices(mesh, vertices[i], 1, 0);
+          for (NeighborVertexRangeIterator nvit = neighbor_vertices.begin(); nvit != neighbor_vertices.end(); ++nvit)
+            stencil.neighbors.push_back( positions[(*nvit).id().index()] );
+        }
 
-      if (regions.size() == 2)
+        stencil.offsets.push_back( stencil.neighbors.size() );
+      }
+    }
+
+
+
+    // One Jacobi step for the vertices [first, last): reads the coordinates of
+    // the current buffer and writes the next buffer. Coordinates are stored
+    // component wise, coordinate d of vertex i is at d*vertex_count+i.
+    struct laplace_smooth_task
+    {
+      void operator()() const
       {
-        for (NeighborVertexRangeIterator nvit = neighbor_vertices.begin(); nvit != neighbor_vertices.end(); ++nvit)
+        double max_displacement = 0;
+
+        for (int i = first; i != last; ++i)
         {
-          offset += viennagrid::get_point(*nvit) - point;
-          ++point_count;
+          int begin = stencil->offsets[i];
+          int end = stencil->offsets[i+1];
+
+          if (stencil->fixed[i] || begin == end)
+          {
+            for (int d = 0; d != dimension; ++d)
+              next[d*vertex_count+i] = current[d*vertex_count+i];
+            continue;
+          }
+
+          double displacement = 0;
+          for (int d = 0; d != dimension; ++d)
+          {
+            double const * component = current + d*vertex_count;
+
+            double sum = 0;
+            for (int j = begin; j != end; ++j)
+              sum += component[ stencil->neighbors[j] ];
+
+            double offset = lambda * (sum / (end-begin) - component[i]);
+            next[d*vertex_count+i] = component[i] + offset;
+            displacement += offset*offset;
+          }
+
+          max_displacement = std::max(max_displacement, displacement);
         }
+
+        *chunk_displacement = std::sqrt(max_displacement);
       }
-//       else if (regions.size() == 3)
-//       {
-//         for (NeighborVertexRangeIterator nvit = neighbor_vertices.begin(); nvit != neighbor_vertices.end(); ++nvit)
-//         {
-//           RegionRangeType neighbor_regions(mesh, *nvit);
-//           if ( is_subset(neighbor_regions, regions) )
-//           {
-//             offset += viennagrid::get_point(*nvit) - point;
-//             ++point_count;
-//           }
-//         }
-//       }
-
-      if (point_count != 0)
-        offset /= point_count;
-      vertex_offset.set(*vit, offset * lambda);
-    }
 
-    for (VertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit)
-      viennagrid::set_point( *vit, viennagrid::get_point(*vit) + vertex_offset.get(*vit) );
-  }
+      laplace_stencil const * stencil;
+      double const * current;
+      double * next;
+      int vertex_count;
+      int dimension;
+      double lambda;
 
+      int first;
+      int last;
+      double * chunk_displacement;
+    };
 
+  }
 
 
   laplace_smooth::laplace_smooth() {}
@@ -169,8 +189,15 @@ namespace viennamesh
 
   bool laplace_smooth::run(viennamesh::algorithm_handle &)
   {
+    typedef viennagrid::mesh                                        MeshType;
+    typedef viennagrid::result_of::point<MeshType>::type            PointType;
+    typedef viennagrid::result_of::element<MeshType>::type          VertexType;
+    typedef viennagrid::result_of::vertex_range<MeshType>::type     VertexRangeType;
+
     data_handle<double> lambda = get_required_input<double>("lambda");
     data_handle<int> iteration_count = get_required_input<int>("iteration_count");
+    data_handle<double> convergence_tolerance = get_input<double>("convergence_tolerance");
+    data_handle<int> thread_count = get_input<int>("thread_count");
 
     mesh_handle input_mesh = get_required_input<mesh_handle>("mesh");
     if (!input_mesh.valid())
@@ -191,16 +218,19 @@ namespace viennamesh
       viennagrid::copy( input_mesh(), output_mesh() );
 
 
-    function< void(viennagrid::mesh const &) > smooth_function;
+    VertexRangeType vertex_range( output_mesh() );
+    std::vector<VertexType> vertices( vertex_range.begin(), vertex_range.end() );
+
+    laplace_stencil stencil;
     if (geometric_dimension == 3 && cell_dimension == 2)
     {
       info(1) << "Geometric dimension == 3 and cell dimension == 2 -> using hull laplacian smoothing" << std::endl;
-      smooth_function = bind( hull_laplace_smooth_impl, _1, lambda() );
+      make_hull_laplace_stencil( output_mesh(), vertices, stencil );
     }
     else if (geometric_dimension == cell_dimension)
     {
       info(1) << "Geometric dimension == cell dimension -> using standard laplacian smoothing" << std::endl;
-      smooth_function = bind( laplace_smooth_impl, _1, lambda() );
+      make_laplace_stencil( output_mesh(), vertices, stencil );
     }
     else
     {
@@ -208,10 +238,74 @@ namespace viennamesh
       return false;
     }
 
-//     typedef void (*hull_laplace_smooth_impl)(viennagrid::mesh_t const &, double) SmoothFunction
 
-    for (int i = 0; i < iteration_count(); ++i)
-      smooth_function( output_mesh() );
+    int vertex_count = vertices.size();
+
+    // nothing to smooth, the chunks below would reference empty coordinate arrays
+    if (vertex_count == 0)
+    {
+      set_output( "mesh", output_mesh );
+      return true;
+    }
+
+    std::vector<double> current( geometric_dimension*vertex_count );
+    std::vector<double> next( geometric_dimension*vertex_count );
+
+    for (int i = 0; i != vertex_count; ++i)
+    {
+      PointType point = viennagrid::get_point( vertices[i] );
+      for (int d = 0; d != geometric_dimension; ++d)
+        current[d*vertex_count+i] = point[d];
+    }
+
+
+    thread_pool pool( thread_count.valid() ? thread_count() : 0 );
+
+    int chunk_count = std::max( std::min(vertex_count, 8*pool.worker_count()), 1 );
+    std::vector<double> chunk_displacements( chunk_count, 0 );
+
+    int iteration = 0;
+    for (; iteration < iteration_count(); ++iteration)
+    {
+      for (int chunk = 0; chunk != chunk_count; ++chunk)
+      {
+        laplace_smooth_task task;
+        task.stencil = &stencil;
+        task.current = &current[0];
+        task.next = &next[0];
+        task.vertex_count = vertex_count;
+        task.dimension = geometric_dimension;
+        task.lambda = lambda();
+        task.first = static_cast<long>(vertex_count)*chunk/chunk_count;
+        task.last = static_cast<long>(vertex_count)*(chunk+1)/chunk_count;
+        task.chunk_displacement = &chunk_displacements[chunk];
+
+        pool.submit(task);
+      }
+      pool.wait();
+
+      current.swap(next);
+
+      if ( convergence_tolerance.valid() &&
+           *std::max_element(chunk_displacements.begin(), chunk_displacements.end()) < convergence_tolerance() )
+      {
+        ++iteration;
+        info(1) << "Converged after " << iteration << " iterations" << std::endl;
+        break;
+      }
+    }
+
+
+    for (int i = 0; i != vertex_count; ++i)
+    {
+      if (stencil.fixed[i])
+        continue;
+
+      PointType point(geometric_dimension);
+      for (int d = 0; d != geometric_dimension; ++d)
+        point[d] = current[d*vertex_count+i];
+      viennagrid::set_point( vertices[i], point );
+    }
 
     set_output( "mesh", output_mesh );
 
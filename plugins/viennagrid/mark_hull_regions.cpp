@@ -1,4 +1,6 @@
 #include "mark_hull_regions.hpp"
+#include "viennameshpp/aabb_tree.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 #include "viennagrid/algorithm/geometry.hpp"
 #include "viennagrid/algorithm/centroid.hpp"
@@ -119,8 +121,10 @@ namespace viennamesh
 
 
 
+  // marks triangle and all triangles reachable over the neighbor lists with
+  // region_id, uses an explicit worklist so large hulls cannot overflow the stack
   template<typename MeshT, typename NeighborsT, typename RegionAccessorT, typename ElementT>
-  void mark_neighbors(MeshT const & mesh,
+  void mark_neighbors(MeshT const &,
                       std::vector<NeighborsT> const & pos_neighbors,
                       std::vector<NeighborsT> const & neg_neighbors,
                       RegionAccessorT & pos_orient,
@@ -129,47 +133,131 @@ namespace viennamesh
                       bool positive,
                       int region_id)
   {
-    if (positive)
+    std::vector< std::pair<ElementT, bool> > worklist;
+    worklist.push_back( std::make_pair(triangle, positive) );
+
+    while (!worklist.empty())
     {
-      int rid = pos_orient.get(triangle);
-      assert(neg_orient.get(triangle) != region_id);
-      if (rid == -1)
+      triangle = worklist.back().first;
+      positive = worklist.back().second;
+      worklist.pop_back();
+
+      if (positive)
       {
-        pos_orient.set(triangle, region_id);
+        int rid = pos_orient.get(triangle);
+        assert(neg_orient.get(triangle) != region_id);
+        if (rid == -1)
+        {
+          pos_orient.set(triangle, region_id);
+        }
+        else
+        {
+          assert(rid == region_id);
+          continue;
+        }
       }
       else
       {
-        assert(rid == region_id);
-        return;
+        int rid = neg_orient.get(triangle);
+        assert(pos_orient.get(triangle) != region_id);
+        if (rid == -1)
+        {
+          neg_orient.set(triangle, region_id);
+        }
+        else
+        {
+          assert(rid == region_id);
+          continue;
+        }
       }
+
+
+      NeighborsT const & neighbors = positive ? pos_neighbors[triangle.id().index()] : neg_neighbors[triangle.id().index()];
+      for (typename NeighborsT::const_iterator ntit = neighbors.begin(); ntit != neighbors.end(); ++ntit)
+        worklist.push_back( std::make_pair(*ntit, same_orientation(triangle, *ntit) == positive) );
     }
-    else
+  }
+
+
+
+  // stops at the first triangle other than self which intersects the segment
+  template<typename ElementT, typename PointT, typename NumericConfigT>
+  struct segment_intersect_visitor
+  {
+    segment_intersect_visitor(aabb_tree<ElementT> const & tree_, ElementT const & self_,
+                              PointT const & from_, PointT const & to_, NumericConfigT numeric_config_) :
+        tree(tree_), self(self_), from(from_), to(to_), numeric_config(numeric_config_) {}
+
+    bool operator()(std::size_t index) const
     {
-      int rid = neg_orient.get(triangle);
-      assert(pos_orient.get(triangle) != region_id);
-      if (rid == -1)
-      {
-        neg_orient.set(triangle, region_id);
-      }
-      else
+      return (tree.element(index) != self) &&
+             viennagrid::element_line_intersect(tree.element(index), from, to, numeric_config);
+    }
+
+    aabb_tree<ElementT> const & tree;
+    ElementT const & self;
+    PointT const & from;
+    PointT const & to;
+    NumericConfigT numeric_config;
+  };
+
+
+  // Searches the triangles [first, last) for one whose ray from the centroid to
+  // the outside point does not intersect any other triangle. The smallest such
+  // index over all tasks is kept in best_candidate, so the result is the same
+  // triangle a serial search would find.
+  template<typename MeshT, typename NumericConfigT>
+  struct outside_triangle_search_task
+  {
+    typedef typename viennagrid::result_of::coord<MeshT>::type CoordType;
+    typedef typename viennagrid::result_of::point<MeshT>::type PointType;
+    typedef typename viennagrid::result_of::element<MeshT>::type ElementType;
+
+    void operator()() const
+    {
+      for (long i = first; i != last; ++i)
       {
-        assert(rid == region_id);
+        // a candidate with smaller index was already found
+        if (*best_candidate <= i)
+          return;
+
+        ElementType const & triangle = (*candidates)[i];
+
+        PointType r = viennagrid::centroid(triangle);
+        PointType n = viennagrid::normal_vector(triangle);
+        n /= viennagrid::norm_2(n);
+        PointType d = *outside_point - r;
+        CoordType p = viennagrid::inner_prod( d, n ) / viennagrid::norm_2(d);
+
+        if ( std::abs(p) < viennagrid::detail::absolute_tolerance<CoordType>(numeric_config) )
+          continue;
+
+        segment_intersect_visitor<ElementType, PointType, NumericConfigT> visitor(*tree, triangle, r, *outside_point, numeric_config);
+        if (tree->for_each_intersecting_segment(r, *outside_point, box_tolerance, visitor))
+          continue;
+
+        long current = *best_candidate;
+        while (i < current)
+        {
+          long previous = __sync_val_compare_and_swap(best_candidate, current, i);
+          if (previous == current)
+            break;
+          current = previous;
+        }
         return;
       }
     }
 
+    std::vector<ElementType> const * candidates;
+    aabb_tree<ElementType> const * tree;
+    PointType const * outside_point;
+    NumericConfigT numeric_config;
+    CoordType box_tolerance;
 
-    NeighborsT const & neighbors = positive ? pos_neighbors[triangle.id().index()] : neg_neighbors[triangle.id().index()];
-    for (typename NeighborsT::const_iterator ntit = neighbors.begin(); ntit != neighbors.end(); ++ntit)
-    {
-      mark_neighbors(mesh,
-                     pos_neighbors, neg_neighbors,
-                     pos_orient, neg_orient,
-                     *ntit,
-                     same_orientation(triangle, *ntit) == positive,
-                     region_id);
-    }
-  }
+    long first;
+    long last;
+    volatile long * best_candidate;
+  };
 
 
 
@@ -309,47 +397,53 @@ namespace viennamesh
     std::pair<PointType, PointType> bb = viennagrid::bounding_box(mesh);
     PointType outside_point = bb.first - viennagrid::make_point(1,1,1) * viennagrid::norm_2(bb.first-bb.second) * 0.1;
 
-    ConstElementRangeType triangles(mesh, 2);
-    for (ConstElementIteratorType tit = triangles.begin(); tit != triangles.end(); ++tit)
+    std::vector<ElementType> candidates;
     {
-      // calculating the center of the triangle
-      PointType r = viennagrid::centroid(*tit);
-
-      // calculating the normal vector of the triangle
-      PointType n = viennagrid::normal_vector(*tit);
-      // ... and normalizing it
-      n /= viennagrid::norm_2(n);
-
-      // calculating the ray vector from the center of the triangle to the seed point
-      PointType d = outside_point - r;
-
-      // projecting the normalized ray vector onto the normal vector
-      CoordType p = viennagrid::inner_prod( d, n ) / viennagrid::norm_2(d);
+      ConstElementRangeType triangles(mesh, 2);
+      for (ConstElementIteratorType tit = triangles.begin(); tit != triangles.end(); ++tit)
+        candidates.push_back(*tit);
+    }
 
-      // if the projection is near zero (happens when the ray vector and the triangle are co-linear) -> skip this triangle
-      if ( std::abs(p) < viennagrid::detail::absolute_tolerance<CoordType>(numeric_config) )
-        continue;
+    // triangle boxes are enlarged so that the tolerance of element_line_intersect cannot miss a hit
+    aabb_tree<ElementType> triangle_tree( candidates.begin(), candidates.end() );
+    CoordType tolerance = viennagrid::detail::absolute_tolerance<CoordType>(numeric_config);
+    CoordType box_tolerance = tolerance * (1.0 + viennagrid::norm_2(bb.second-bb.first));
 
+    volatile long best_candidate = candidates.size();
+    {
+      thread_pool pool;
 
-      ConstElementIteratorType tit2 = triangles.begin();
-      for (; tit2 != triangles.end(); ++tit2)
+      long chunk_count = std::min<long>( candidates.size(), 8*pool.worker_count() );
+      for (long chunk = 0; chunk != chunk_count; ++chunk)
       {
-        // no self intersect test
-        if (*tit == *tit2)
-          continue;
-
-        // in case of intersection -> nothing to do with the triangle
-        if (viennagrid::element_line_intersect(*tit2, r, outside_point, numeric_config))
-          break;
+        outside_triangle_search_task<MeshT, NumericConfigT> task;
+        task.candidates = &candidates;
+        task.tree = &triangle_tree;
+        task.outside_point = &outside_point;
+        task.numeric_config = numeric_config;
+        task.box_tolerance = box_tolerance;
+        task.first = candidates.size() * chunk / chunk_count;
+        task.last = candidates.size() * (chunk+1) / chunk_count;
+        task.best_candidate = &best_candidate;
+
+        pool.submit(task);
       }
 
-      // if there was no intersection -> mark this triangle and all neighbor triangles recursively
-      if (tit2 == triangles.end())
-      {
-        mark_neighbors(mesh, positive_neighbor_triangles, negative_neighbor_triangles, pos_orient, neg_orient, *tit, p > 0, 0);
+      pool.wait();
+    }
 
-        break;
-      }
+    // if there was no intersection -> mark this triangle and all neighbor triangles
+    if (best_candidate != static_cast<long>(candidates.size()))
+    {
+      ElementType const & triangle = candidates[best_candidate];
+
+      PointType r = viennagrid::centroid(triangle);
+      PointType n = viennagrid::normal_vector(triangle);
+      n /= viennagrid::norm_2(n);
+      PointType d = outside_point - r;
+      CoordType p = viennagrid::inner_prod( d, n ) / viennagrid::norm_2(d);
+
+      mark_neighbors(mesh, positive_neighbor_triangles, negative_neighbor_triangles, pos_orient, neg_orient, triangle, p > 0, 0);
     }
 
 
@@ -12,48 +12,47 @@
    License:         MIT (X11), see file LICENSE in the base directory
 =============================================================================== */
 
+#include <algorithm>
+
 #include "merge_meshes.hpp"
+#include "vertex_hash_grid.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
-  template<bool mesh_is_const>
-  void merge_meshes_impl(viennagrid::base_mesh<mesh_is_const> const & src_mesh,
-                         viennagrid::mesh const & dst_mesh,
-                         double tolerance, bool region_offset)
+  namespace
   {
-    viennagrid::result_of::element_copy_map<>::type copy_map(dst_mesh, tolerance, false);
-
-    typedef viennagrid::base_mesh<mesh_is_const>                                    SrcMeshType;
-
-    typedef typename viennagrid::result_of::element<SrcMeshType>::type              CellType;
-
-    typedef typename viennagrid::result_of::const_cell_range<SrcMeshType>::type     ConstCellRangeType;
-    typedef typename viennagrid::result_of::iterator<ConstCellRangeType>::type      ConstCellIteratorType;
-
-    typedef typename viennagrid::result_of::region_range<SrcMeshType>::type         SrcRegionRangeType;
-    typedef typename viennagrid::result_of::iterator<SrcRegionRangeType>::type      SrcRegionRangeIterator;
-
-    int region_id_offset = dst_mesh.region_count();
-    int source_region_count = src_mesh.region_count();
-
-    ConstCellRangeType cells(src_mesh);
-    for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+    // Welds the vertices of the meshes of right into the meshes of left: every
+    // stored vertex of right within tolerance of a stored vertex of left is
+    // represented by that vertex, all others are added to left. Vertices are
+    // global indices over all merged meshes.
+    struct weld_task
     {
-      CellType cell = copy_map(*cit);
-
-      if (source_region_count <= 1)
-        viennagrid::add( dst_mesh.get_or_create_region(region_offset ? region_id_offset : 0), cell );
-      else
+      void operator()() const
       {
-        SrcRegionRangeType region_range(*cit);
-        for (SrcRegionRangeIterator rit = region_range.begin(); rit != region_range.end(); ++rit)
+        std::vector<int> unmatched;
+
+        std::vector<int> const & right_vertices = right->stored();
+        for (std::size_t i = 0; i != right_vertices.size(); ++i)
         {
-          viennagrid::add( dst_mesh.get_or_create_region((*rit).id() + (region_offset ? region_id_offset : 0)), cell );
+          int match = left->find( right_vertices[i] );
+          if (match != -1)
+            (*representatives)[ right_vertices[i] ] = match;
+          else
+            unmatched.push_back( right_vertices[i] );
         }
+
+        for (std::size_t i = 0; i != unmatched.size(); ++i)
+          left->insert( unmatched[i] );
+
+        right->clear();
       }
-    }
-  }
 
+      vertex_hash_grid * left;
+      vertex_hash_grid * right;
+      std::vector<int> * representatives;
+    };
+  }
 
 
   merge_meshes::merge_meshes() {}
@@ -61,6 +60,21 @@ namespace viennamesh
 
   bool merge_meshes::run(viennamesh::algorithm_handle &)
   {
+    typedef viennagrid::mesh                                                MeshType;
+    typedef viennagrid::result_of::element<MeshType>::type                  ElementType;
+    typedef viennagrid::result_of::point<MeshType>::type                    PointType;
+
+    typedef viennagrid::result_of::const_vertex_range<MeshType>::type       ConstVertexRangeType;
+    typedef viennagrid::result_of::iterator<ConstVertexRangeType>::type     ConstVertexIteratorType;
+    typedef viennagrid::result_of::const_cell_range<MeshType>::type         ConstCellRangeType;
+    typedef viennagrid::result_of::iterator<ConstCellRangeType>::type       ConstCellIteratorType;
+
+    typedef viennagrid::result_of::const_element_range<ElementType>::type   ConstBoundaryRangeType;
+    typedef viennagrid::result_of::iterator<ConstBoundaryRangeType>::type   ConstBoundaryIteratorType;
+
+    typedef viennagrid::result_of::region_range<MeshType>::type             SrcRegionRangeType;
+    typedef viennagrid::result_of::iterator<SrcRegionRangeType>::type       SrcRegionRangeIterator;
+
     mesh_handle output_mesh = make_data<mesh_handle>();
     mesh_handle input_mesh = get_input<mesh_handle>("mesh");
 
@@ -70,19 +84,22 @@ namespace viennamesh
 
     double tolerance = 1e-6;
     if ( get_input<double>("tolerance").valid() )
-      tolerance = get_input<double>("tolerance")();
+      tolerance = std::max( get_input<double>("tolerance")(), 0.0 );
+
+    bool parallel_merge = false;
+    if ( get_input<bool>("parallel_merge").valid() )
+      parallel_merge = get_input<bool>("parallel_merge")();
+
+    data_handle<int> thread_count = get_input<int>("thread_count");
 
     info(1) << "Using region offset: " << std::boolalpha << region_offset << std::endl;
 
-    int merged_count = 0;
+
+    std::vector<MeshType> sources;
     if (input_mesh.valid())
     {
-      int mesh_count = input_mesh.size();
-      for (int i = 0; i != mesh_count; ++i)
-      {
-        merge_meshes_impl( input_mesh(i), output_mesh(), (merged_count == 0 ? -1 : tolerance), region_offset );
-        ++merged_count;
-      }
+      for (int i = 0; i != input_mesh.size(); ++i)
+        sources.push_back( input_mesh(i) );
     }
 
     int mesh_index = 0;
@@ -94,32 +111,149 @@ namespace viennamesh
       if (!another_input_mesh.valid())
         break;
 
-      int mesh_count = another_input_mesh.size();
-      for (int i = 0; i != mesh_count; ++i)
+      for (int i = 0; i != another_input_mesh.size(); ++i)
+        sources.push_back( another_input_mesh(i) );
+
+      ++mesh_index;
+    }
+
+    if (sources.empty())
+    {
+      info(1) << "Merged 0 meshes" << std::endl;
+      set_output( "mesh", output_mesh );
+      return true;
+    }
+
+
+    // vertices of all sources with global indices, the vertices of source s
+    // start at vertex_offsets[s] and are ordered by their id index
+    int dimension = 1;
+    for (std::size_t s = 0; s != sources.size(); ++s)
+      dimension = std::max( dimension, static_cast<int>(viennagrid::geometric_dimension(sources[s])) );
+
+    std::vector<int> vertex_offsets(1, 0);
+    std::vector< std::vector<int> > vertex_positions( sources.size() );
+    std::vector<double> points;
+
+    for (std::size_t s = 0; s != sources.size(); ++s)
+    {
+      ConstVertexRangeType vertices( sources[s] );
+      for (ConstVertexIteratorType vit = vertices.begin(); vit != vertices.end(); ++vit)
       {
-        merge_meshes_impl( another_input_mesh(i), output_mesh(), (merged_count == 0 ? -1 : tolerance), region_offset );
-        ++merged_count;
+        std::size_t index = (*vit).id().index();
+        if (index >= vertex_positions[s].size())
+          vertex_positions[s].resize(index+1, -1);
+        vertex_positions[s][index] = points.size()/dimension - vertex_offsets[s];
+
+        PointType point = viennagrid::get_point(*vit);
+        for (int d = 0; d != dimension; ++d)
+          points.push_back( d < static_cast<int>(point.size()) ? point[d] : 0.0 );
       }
 
-      ++mesh_index;
+      vertex_offsets.push_back( points.size()/dimension );
     }
 
-//
+    int vertex_count = vertex_offsets.back();
 
 
+    // vertices of one source are not welded with each other, the sources are
+    // welded either from left to right or in a parallel reduction tree
+    std::vector<int> representatives( vertex_count );
+    std::vector<vertex_hash_grid> grids( sources.size(), vertex_hash_grid(points.empty() ? NULL : &points[0], dimension, tolerance) );
 
-//     if (input_mesh)
-//       merge_meshes_impl( input_mesh(), output_mesh() );
-//
-//     int index = 0;
-//     input_mesh = get_input<mesh_handle>("mesh[" + lexical_cast<std::string>(index++) + "]");
-//     while (input_mesh)
-//     {
-//       merge_meshes_impl( input_mesh(), output_mesh() );
-//       input_mesh = get_input<mesh_handle>("mesh[" + lexical_cast<std::string>(index++) + "]");
-//     }
+    for (std::size_t s = 0; s != sources.size(); ++s)
+    {
+      for (int v = vertex_offsets[s]; v != vertex_offsets[s+1]; ++v)
+      {
+        representatives[v] = v;
+        grids[s].insert(v);
+      }
+    }
+
+    if (parallel_merge)
+    {
+      thread_pool pool( thread_count.valid() ? thread_count() : 0 );
+
+      for (std::size_t step = 1; step < sources.size(); step *= 2)
+      {
+        for (std::size_t s = 0; s+step < sources.size(); s += 2*step)
+        {
+          weld_task task;
+          task.left = &grids[s];
+          task.right = &grids[s+step];
+          task.representatives = &representatives;
+          pool.submit(task);
+        }
+        pool.wait();
+      }
+    }
+    else
+    {
+      for (std::size_t s = 1; s < sources.size(); ++s)
+      {
+        weld_task task;
+        task.left = &grids[0];
+        task.right = &grids[s];
+        task.representatives = &representatives;
+        task();
+      }
+    }
+
+    // a representative always has a lower index, resolve chains from welds of later merge steps
+    for (int v = 0; v != vertex_count; ++v)
+      representatives[v] = representatives[ representatives[v] ];
+
+    grids.clear();
+
+
+    // vertices are created when they are first used by a cell
+    std::vector<ElementType> dst_vertices( vertex_count );
+    std::vector<char> created( vertex_count, 0 );
+
+    for (std::size_t s = 0; s != sources.size(); ++s)
+    {
+      int region_id_offset = output_mesh().region_count();
+      int source_region_count = sources[s].region_count();
+
+      std::vector<ElementType> local_vertices;
+
+      ConstCellRangeType cells( sources[s] );
+      for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+      {
+        local_vertices.clear();
+
+        ConstBoundaryRangeType boundary_vertices(*cit, 0);
+        for (ConstBoundaryIteratorType bvit = boundary_vertices.begin(); bvit != boundary_vertices.end(); ++bvit)
+        {
+          int v = representatives[ vertex_offsets[s] + vertex_positions[s][(*bvit).id().index()] ];
+          if (!created[v])
+          {
+            PointType point(dimension);
+            for (int d = 0; d != dimension; ++d)
+              point[d] = points[v*dimension+d];
+
+            dst_vertices[v] = viennagrid::make_vertex( output_mesh(), point );
+            created[v] = 1;
+          }
+
+          local_vertices.push_back( dst_vertices[v] );
+        }
+
+        ElementType cell = viennagrid::make_element( output_mesh(), (*cit).tag(), local_vertices.begin(), local_vertices.end() );
+
+        if (source_region_count <= 1)
+          viennagrid::add( output_mesh().get_or_create_region(region_offset ? region_id_offset : 0), cell );
+        else
+        {
+          SrcRegionRangeType region_range(*cit);
+          for (SrcRegionRangeIterator rit = region_range.begin(); rit != region_range.end(); ++rit)
+            viennagrid::add( output_mesh().get_or_create_region((*rit).id() + (region_offset ? region_id_offset : 0)), cell );
+        }
+      }
+    }
 
-    info(1) << "Merged " << merged_count << " meshes" << std::endl;
+    info(1) << "Merged " << sources.size() << " meshes" << std::endl;
+    info(1) << "Welded " << vertex_count << " vertices into " << viennagrid::vertices(output_mesh()).size() << " vertices" << std::endl;
 
     set_output( "mesh", output_mesh );
 
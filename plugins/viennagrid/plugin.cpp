@@ -12,6 +12,7 @@
 #include "simplexify.hpp"
 #include "line_coarsening.hpp"
 #include "interpolate_quantities.hpp"
+#include "interpolation_plan.hpp"
 #include "map_regions.hpp"
 #include "refine_plc_lines.hpp"
 #include "center_mesh.hpp"
@@ -25,6 +26,8 @@
 
 viennamesh_error viennamesh_plugin_init(viennamesh_context context)
 {
+  viennamesh::register_data_type<viennamesh::interpolation_plan>(context);
+
   viennamesh::register_algorithm<viennamesh::affine_transform>(context);
   viennamesh::register_algorithm<viennamesh::extract_boundary>(context);
   viennamesh::register_algorithm<viennamesh::extract_plc_geometry>(context);
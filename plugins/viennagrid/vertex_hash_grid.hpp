@@ -0,0 +1,146 @@
+#ifndef VIENNAMESH_ALGORITHM_VIENNAGRID_VERTEX_HASH_GRID_HPP
+#define VIENNAMESH_ALGORITHM_VIENNAGRID_VERTEX_HASH_GRID_HPP
+
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+
+                    http://viennamesh.sourceforge.net/
+
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include <vector>
+#include <cmath>
+
+namespace viennamesh
+{
+  // Spatial hash of points for finding coincident vertices. Space is divided
+  // into grid cells with edge length tolerance, a query probes the cell of the
+  // point and all neighboring cells. Points are given by their index into a
+  // flat coordinate array (dimension coordinates per point) owned by the caller.
+  class vertex_hash_grid
+  {
+  public:
+
+    vertex_hash_grid(double const * points_, int dimension_, double tolerance_) :
+        points(points_), dimension(dimension_), tolerance(tolerance_),
+        cell_size(tolerance_ > 0 ? tolerance_ : 1.0), heads(64, -1) {}
+
+    // stored point within tolerance of point index with the lowest index, -1 if there is none
+    int find(int index) const
+    {
+      long long cell[3];
+      make_cell(index, cell);
+
+      int result = -1;
+
+      int probe_count = 1;
+      for (int d = 0; d != dimension; ++d)
+        probe_count *= 3;
+
+      for (int probe = 0; probe != probe_count; ++probe)
+      {
+        long long neighbor[3] = {0, 0, 0};
+        int tmp = probe;
+        for (int d = 0; d != dimension; ++d)
+        {
+          neighbor[d] = cell[d] + (tmp % 3) - 1;
+          tmp /= 3;
+        }
+
+        for (int entry = heads[bucket(neighbor)]; entry != -1; entry = next[entry])
+        {
+          int candidate = indices[entry];
+          if ( (result == -1 || candidate < result) && close(index, candidate) )
+            result = candidate;
+        }
+      }
+
+      return result;
+    }
+
+    void insert(int index)
+    {
+      if (indices.size() >= heads.size())
+        rehash( 2*heads.size() );
+
+      long long cell[3];
+      make_cell(index, cell);
+
+      std::size_t b = bucket(cell);
+      indices.push_back(index);
+      next.push_back(heads[b]);
+      heads[b] = indices.size()-1;
+    }
+
+    // stored points in insertion order
+    std::vector<int> const & stored() const { return indices; }
+
+    void clear()
+    {
+      std::vector<int>().swap(indices);
+      std::vector<int>().swap(next);
+      heads.assign(64, -1);
+    }
+
+  private:
+
+    void make_cell(int index, long long * cell) const
+    {
+      cell[0] = cell[1] = cell[2] = 0;
+      for (int d = 0; d != dimension; ++d)
+        cell[d] = static_cast<long long>( std::floor(points[index*dimension+d] / cell_size) );
+    }
+
+    std::size_t bucket(long long const * cell) const
+    {
+      unsigned long long h = static_cast<unsigned long long>(cell[0]) * 73856093ull;
+      h ^= static_cast<unsigned long long>(cell[1]) * 19349663ull;
+      h ^= static_cast<unsigned long long>(cell[2]) * 83492791ull;
+      return static_cast<std::size_t>(h % heads.size());
+    }
+
+    bool close(int lhs, int rhs) const
+    {
+      double distance = 0;
+      for (int d = 0; d != dimension; ++d)
+      {
+        double delta = points[lhs*dimension+d] - points[rhs*dimension+d];
+        distance += delta*delta;
+      }
+      return distance <= tolerance*tolerance;
+    }
+
+    void rehash(std::size_t bucket_count)
+    {
+      heads.assign(bucket_count, -1);
+      for (std::size_t entry = 0; entry != indices.size(); ++entry)
+      {
+        long long cell[3];
+        make_cell(indices[entry], cell);
+
+        std::size_t b = bucket(cell);
+        next[entry] = heads[b];
+        heads[b] = entry;
+      }
+    }
+
+    double const * points;
+    int dimension;
+    double tolerance;
+    double cell_size;
+
+    // chained buckets: heads[bucket] is the first entry, next[entry] the following one
+    std::vector<int> heads;
+    std::vector<int> next;
+    std::vector<int> indices;
+  };
+}
+
+#endif
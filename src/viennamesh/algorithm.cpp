@@ -52,6 +52,8 @@ void viennamesh_algorithm_wrapper_t::init()
 
 void viennamesh_algorithm_wrapper_t::run()
 {
+  // captured stdout/stderr of this thread is attributed to the algorithm
+  viennamesh::backend::StdCaptureTag capture_tag( type() );
   algorithm_template()->run(this);
 }
 
@@ -139,13 +141,26 @@ viennamesh_data_wrapper viennamesh_algorithm_wrapper_t::get_input(std::string co
     return input;
 
 
-  input->release();
+  viennamesh::backend::info(1) << "Requested input \"" << name << "\" of type \"" << type_name << "\" but input is of type \"" << input->type_name() << "\"" << std::endl;
 
-  viennamesh::backend::info(1) << "Requested input \"" << name << "\" of type \"" << type_name << "\" but input is of type \"" << input->type_name() << "\"";
+  // the conversion is cached at the input and shared by all consumers requesting the same type,
+  // it is a read-only view: algorithms modifying an input in place have to work on a copy
+  viennamesh_data_wrapper result = 0;
+  try
+  {
+    result = context()->cached_convert_to(input, type_name);
+  }
+  catch (...)
+  {
+    input->release();
+    throw;
+  }
 
-  viennamesh_data_wrapper result = context()->convert_to(input, type_name);
+  viennamesh::backend::info(1) << "Conversion of input \"" << name << "\": " << ((result)?"success":"failed") << std::endl;
 
-  viennamesh::backend::info(1) << "; conversion: " << ((result)?"success":"failed") << std::endl;
+  if (result)
+    result->retain();
+  input->release();
 
   return result;
 }
@@ -170,6 +185,8 @@ void viennamesh_algorithm_wrapper_t::set_output(std::string const & name, vienna
   if (it != outputs.end())
     it->second->release();
 
+  // the output may have been modified in place before it was set, conversions made so far are stale
+  output->invalidate_conversions();
   outputs[name] = output;
   output->retain();
 }
@@ -181,6 +198,7 @@ viennamesh_data_wrapper viennamesh_algorithm_wrapper_t::get_output(std::string c
   if (it == outputs.end())
     return 0;
 
+  // read access, callers modifying the output in place invalidate its conversions explicitly
   return it->second;
 }
 
@@ -194,5 +212,7 @@ viennamesh_data_wrapper viennamesh_algorithm_wrapper_t::get_output(std::string c
   if (it->second->type_name() == type_name)
     return it->second;
 
-  return context()->convert_to(it->second, type_name);
+  // like the untyped get_output, the result is not retained: it is owned by the conversion cache of the output
+  // and shared by all callers requesting the same type, it must be treated as read-only
+  return context()->cached_convert_to(it->second, type_name);
 }
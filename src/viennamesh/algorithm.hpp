@@ -70,10 +70,10 @@ public:
   std::string const & type();
   viennamesh_context context();
 
-  void retain() { ++use_count_; }
+  void retain() { __sync_add_and_fetch(&use_count_, 1); }
   bool release()
   {
-    if (--use_count_ <= 0)
+    if (__sync_sub_and_fetch(&use_count_, 1) <= 0)
     {
       delete_this();
       return false;
@@ -1,29 +1,253 @@
 #include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <limits>
+#include <algorithm>
+#include <fstream>
 #include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "viennagrid/viennagrid.h"
 #include "context.hpp"
 
 
-viennamesh_context_t::viennamesh_context_t() : use_count_(1)
+namespace
+{
+  // Plugin manifest, one per plugin directory. Installed plugin directories are
+  // usually read-only, their manifest is then kept in the cache directory of the user.
+  // A tab separated text file:
+  //   viennamesh_plugin_manifest <version>
+  //   plugin <filename> <modification time in ns> <size>
+  //   algorithm <name>            (for the preceding plugin)
+  //   data_type <name>
+  //   conversion <from> <to>
+  const char * plugin_manifest_name = ".viennamesh_plugin_manifest";
+
+  // $XDG_CACHE_HOME/viennamesh/ or $HOME/.cache/viennamesh/, created if missing, empty if there is none
+  std::string user_cache_directory()
+  {
+    std::string directory;
+    if (getenv("XDG_CACHE_HOME") && *getenv("XDG_CACHE_HOME"))
+      directory = getenv("XDG_CACHE_HOME");
+    else if (getenv("HOME") && *getenv("HOME"))
+      directory = std::string(getenv("HOME")) + "/.cache";
+    else
+      return std::string();
+
+    mkdir(directory.c_str(), 0755);
+    directory += "/viennamesh/";
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+      return std::string();
+
+    return directory;
+  }
+
+  // manifest of a plugin directory in the cache directory of the user, the file name is the escaped directory name
+  std::string user_plugin_manifest_filename(std::string const & directory_name)
+  {
+    std::string cache_directory = user_cache_directory();
+    if (cache_directory.empty())
+      return std::string();
+
+    std::string escaped = directory_name;
+    std::replace( escaped.begin(), escaped.end(), '/', '%' );
+    return cache_directory + "plugin_manifest" + escaped;
+  }
+
+  long long modification_time(struct stat const & file_status)
+  {
+    long long result = static_cast<long long>(file_status.st_mtime) * 1000000000LL;
+#if defined(__linux__)
+    result += file_status.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    result += file_status.st_mtimespec.tv_nsec;
+#endif
+    return result;
+  }
+
+  std::vector<std::string> split_tabs(std::string const & line)
+  {
+    std::vector<std::string> result;
+    std::string::size_type begin = 0;
+    while (true)
+    {
+      std::string::size_type end = line.find('\t', begin);
+      result.push_back( line.substr(begin, end == std::string::npos ? std::string::npos : end-begin) );
+      if (end == std::string::npos)
+        break;
+      begin = end+1;
+    }
+    return result;
+  }
+
+  // entries by plugin filename, the manifest is ignored if it was written by another version,
+  // returns false if there is no manifest of this version
+  bool read_plugin_manifest(std::string const & filename,
+                            std::map<std::string, viennamesh::plugin_manifest_entry> & entries)
+  {
+    std::ifstream file(filename.c_str());
+    if (!file)
+      return false;
+
+    std::string line;
+    if ( !std::getline(file, line) ||
+         line != "viennamesh_plugin_manifest\t" + boost::lexical_cast<std::string>(VIENNAMESH_VERSION) )
+      return false;
+
+    viennamesh::plugin_manifest_entry * current = NULL;
+    while (std::getline(file, line))
+    {
+      std::vector<std::string> fields = split_tabs(line);
+
+      try
+      {
+        if (fields[0] == "plugin" && fields.size() == 4)
+        {
+          current = &entries[fields[1]];
+          current->filename = fields[1];
+          current->modification_time = boost::lexical_cast<long long>(fields[2]);
+          current->file_size = boost::lexical_cast<long long>(fields[3]);
+        }
+        else if (!current)
+          continue;
+        else if (fields[0] == "algorithm" && fields.size() == 2)
+          current->algorithms.push_back(fields[1]);
+        else if (fields[0] == "data_type" && fields.size() == 2)
+          current->data_types.push_back(fields[1]);
+        else if (fields[0] == "conversion" && fields.size() == 3)
+          current->conversions.push_back( std::make_pair(fields[1], fields[2]) );
+      }
+      catch (boost::bad_lexical_cast const &)
+      {
+        // a damaged manifest only causes eager loading
+        entries.clear();
+        return true;
+      }
+    }
+
+    return true;
+  }
+
+  // written to a temporary file first, concurrent processes never read a partial manifest
+  bool write_plugin_manifest(std::string const & filename,
+                             std::vector<viennamesh::plugin_manifest_entry> const & entries)
+  {
+    std::string temporary_filename = filename + "." + boost::lexical_cast<std::string>(getpid());
+
+    {
+      std::ofstream file(temporary_filename.c_str());
+      if (!file)
+        return false;
+
+      file << "viennamesh_plugin_manifest\t" << VIENNAMESH_VERSION << "\n";
+      for (std::size_t i = 0; i != entries.size(); ++i)
+      {
+        viennamesh::plugin_manifest_entry const & entry = entries[i];
+        file << "plugin\t" << entry.filename << "\t" << entry.modification_time << "\t" << entry.file_size << "\n";
+        for (std::size_t j = 0; j != entry.algorithms.size(); ++j)
+          file << "algorithm\t" << entry.algorithms[j] << "\n";
+        for (std::size_t j = 0; j != entry.data_types.size(); ++j)
+          file << "data_type\t" << entry.data_types[j] << "\n";
+        for (std::size_t j = 0; j != entry.conversions.size(); ++j)
+          file << "conversion\t" << entry.conversions[j].first << "\t" << entry.conversions[j].second << "\n";
+      }
+
+      if (!file)
+      {
+        file.close();
+        std::remove(temporary_filename.c_str());
+        return false;
+      }
+    }
+
+    if (std::rename(temporary_filename.c_str(), filename.c_str()) != 0)
+    {
+      std::remove(temporary_filename.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+
+  // holds the registry lock of a context for the current scope
+  class registry_lock
+  {
+  public:
+    registry_lock(viennamesh_context context_in) : context(context_in) { context->lock_registry(); }
+    ~registry_lock() { context->unlock_registry(); }
+
+  private:
+    registry_lock(registry_lock const &);
+    registry_lock & operator=(registry_lock const &);
+
+    viennamesh_context context;
+  };
+}
+
+
+viennamesh_context_t::viennamesh_context_t() : recording_plugin_(NULL), conversion_cache_hits_(0), conversion_cache_misses_(0), use_count_(1)
 {
 #ifdef VIENNAMESH_BACKEND_RETAIN_RELEASE_LOGGING
   std::cout << "New context at " << this << std::endl;
 #endif
+#ifndef _WIN32
+  pthread_mutex_init(&conversion_path_mutex_, NULL);
+
+  // plugin init functions can trigger loading of further plugins
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&plugin_mutex_, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+#endif
 }
 
 viennamesh_context_t::~viennamesh_context_t()
 {
+  if (conversion_cache_hits_ != 0 || conversion_cache_misses_ != 0)
+    viennamesh::backend::info(5) << "Conversion cache: " << conversion_cache_hits_ << " hit(s), " << conversion_cache_misses_ << " miss(es)" << std::endl;
+
   for (std::set<viennamesh_plugin>::iterator it = loaded_plugins.begin(); it != loaded_plugins.end(); ++it)
     dlclose(*it);
+
+#ifndef _WIN32
+  pthread_mutex_destroy(&plugin_mutex_);
+  pthread_mutex_destroy(&conversion_path_mutex_);
+#endif
+}
+
+
+
+void viennamesh_context_t::lock_registry()
+{
+#ifndef _WIN32
+  pthread_mutex_lock(&plugin_mutex_);
+#endif
 }
 
+void viennamesh_context_t::unlock_registry()
+{
+#ifndef _WIN32
+  pthread_mutex_unlock(&plugin_mutex_);
+#endif
+}
 
 
-int viennamesh_context_t::registered_data_type_count() const { return data_types.size(); }
 
-std::string const & viennamesh_context_t::registered_data_type_name(int index_) const
+int viennamesh_context_t::registered_data_type_count()
 {
+  registry_lock lock(this);
+  load_all_pending_plugins();
+  return data_types.size();
+}
+
+std::string const & viennamesh_context_t::registered_data_type_name(int index_)
+{
+  registry_lock lock(this);
+  load_all_pending_plugins();
+
   if (index_ < 0 || index_ >= registered_data_type_count())
     VIENNAMESH_ERROR(VIENNAMESH_ERROR_INVALID_ARGUMENT, "viennamesh_context_t::registered_data_type_name invalid index: " + boost::lexical_cast<std::string>(index_));
 
@@ -34,7 +258,11 @@ std::string const & viennamesh_context_t::registered_data_type_name(int index_)
 
 viennamesh::data_template_t & viennamesh_context_t::get_data_type(std::string const & data_type_name_)
 {
+  // map elements are never removed, the returned reference stays valid after unlocking
+  registry_lock lock(this);
   std::map<std::string, viennamesh::data_template_t>::iterator it = data_types.find(data_type_name_);
+  if (it == data_types.end() && load_pending_plugin_for_data_type(data_type_name_))
+    it = data_types.find(data_type_name_);
   if (it == data_types.end())
     VIENNAMESH_ERROR( VIENNAMESH_ERROR_DATA_TYPE_NOT_REGISTERED, "Data type \"" + data_type_name_ + "\" is not registered" );
 
@@ -48,6 +276,10 @@ void viennamesh_context_t::register_data_type(std::string const & data_type_name
   if (data_type_name_.empty())
     VIENNAMESH_ERROR(VIENNAMESH_ERROR_INVALID_ARGUMENT, "data_type_name_ is empty");
 
+  registry_lock lock(this);
+  if (recording_plugin_)
+    recording_plugin_->data_types.push_back(data_type_name_);
+
   std::map<std::string, viennamesh::data_template_t>::iterator it = data_types.find(data_type_name_);
   if (it == data_types.end())
   {
@@ -56,6 +288,15 @@ void viennamesh_context_t::register_data_type(std::string const & data_type_name
     it->second.name() = data_type_name_;
     it->second.set_context(this);
     it->second.set_make_delete_function(make_function_, delete_function_);
+
+    // a new data type can be an intermediate step of previously unavailable conversion routes
+#ifndef _WIN32
+    pthread_mutex_lock(&conversion_path_mutex_);
+#endif
+    conversion_paths.clear();
+#ifndef _WIN32
+    pthread_mutex_unlock(&conversion_path_mutex_);
+#endif
   }
 
   viennamesh::backend::info(10) << "Data type \"" << data_type_name_ << "\" sucessfully registered" << std::endl;
@@ -77,34 +318,278 @@ viennamesh_data_wrapper viennamesh_context_t::make_data(std::string const & data
 
 void viennamesh_context_t::register_conversion_function(std::string const & data_type_from,
                                   std::string const & data_type_to,
-                                  viennamesh_data_convert_function convert_function)
+                                  viennamesh_data_convert_function convert_function,
+                                  double cost)
+{
+  if (cost < 0.0)
+    VIENNAMESH_ERROR(VIENNAMESH_ERROR_INVALID_ARGUMENT, "Conversion cost has to be non-negative");
+
+  registry_lock lock(this);
+  get_data_type(data_type_from).add_conversion_function(data_type_to, convert_function, cost);
+
+  if (recording_plugin_)
+    recording_plugin_->conversions.push_back( std::make_pair(data_type_from, data_type_to) );
+
+#ifndef _WIN32
+  pthread_mutex_lock(&conversion_path_mutex_);
+#endif
+  conversion_paths.clear();
+#ifndef _WIN32
+  pthread_mutex_unlock(&conversion_path_mutex_);
+#endif
+
+  viennamesh::backend::info(10) << "Conversion function from data type \"" << data_type_from << "\" to data type \"" << data_type_to << "\" sucessfully registered (cost " << cost << ")" << std::endl;
+}
+
+
+std::vector<std::string> viennamesh_context_t::conversion_path(std::string const & data_type_from,
+                                                               std::string const & data_type_to)
+{
+  registry_lock lock(this);
+  std::vector<std::string> path = find_conversion_path(data_type_from, data_type_to);
+  if (!path.empty() || data_type_from == data_type_to)
+    return path;
+
+  // conversions of plugins which are not loaded yet: first the plugins converting from or to
+  // one of the types, then all remaining plugins for routes via intermediate types
+  if (load_pending_plugins_for_conversion(data_type_from, data_type_to))
+    path = find_conversion_path(data_type_from, data_type_to);
+  if (path.empty() && load_all_pending_plugins())
+    path = find_conversion_path(data_type_from, data_type_to);
+
+  return path;
+}
+
+std::vector<std::string> viennamesh_context_t::find_conversion_path(std::string const & data_type_from,
+                                                                    std::string const & data_type_to)
 {
-  get_data_type(data_type_from).add_conversion_function(data_type_to, convert_function);
+  // the registry lock protects data_types, it is taken before conversion_path_mutex_
+  registry_lock lock(this);
+#ifndef _WIN32
+  pthread_mutex_lock(&conversion_path_mutex_);
+#endif
+
+  std::pair<std::string, std::string> key(data_type_from, data_type_to);
+  ConversionPathMapType::iterator pit = conversion_paths.find(key);
+  if (pit != conversion_paths.end())
+  {
+    std::vector<std::string> path = pit->second;
+#ifndef _WIN32
+    pthread_mutex_unlock(&conversion_path_mutex_);
+#endif
+    return path;
+  }
+
+  // Dijkstra on the (small) graph of registered data types
+  std::map<std::string, double> distance;
+  std::map<std::string, std::string> predecessor;
+  std::set<std::string> done;
+
+  distance[data_type_from] = 0.0;
+  while (true)
+  {
+    std::string current;
+    double current_distance = std::numeric_limits<double>::max();
+    for (std::map<std::string, double>::const_iterator it = distance.begin(); it != distance.end(); ++it)
+    {
+      if (done.find(it->first) == done.end() && it->second < current_distance)
+      {
+        current = it->first;
+        current_distance = it->second;
+      }
+    }
+
+    if (current_distance == std::numeric_limits<double>::max() || current == data_type_to)
+      break;
+
+    done.insert(current);
+
+    std::map<std::string, viennamesh::data_template_t>::const_iterator tit = data_types.find(current);
+    if (tit == data_types.end())
+      continue;
+
+    viennamesh::data_template_t::ConvertFunctionMap const & functions = tit->second.conversion_functions();
+    for (viennamesh::data_template_t::ConvertFunctionMap::const_iterator fit = functions.begin(); fit != functions.end(); ++fit)
+    {
+      // intermediate data has to be creatable
+      if (fit->first != data_type_to && data_types.find(fit->first) == data_types.end())
+        continue;
+
+      double new_distance = current_distance + fit->second.cost;
+      std::map<std::string, double>::iterator dit = distance.find(fit->first);
+      if (dit == distance.end() || new_distance < dit->second)
+      {
+        distance[fit->first] = new_distance;
+        predecessor[fit->first] = current;
+      }
+    }
+  }
 
-  viennamesh::backend::info(10) << "Conversion function from data type \"" << data_type_from << "\" to data type \"" << data_type_to << "\" sucessfully registered" << std::endl;
+  std::vector<std::string> path;
+  if (data_type_from != data_type_to && predecessor.find(data_type_to) != predecessor.end())
+  {
+    for (std::string type = data_type_to; type != data_type_from; type = predecessor[type])
+      path.push_back(type);
+    path.push_back(data_type_from);
+    std::reverse(path.begin(), path.end());
+
+    std::ostringstream ss;
+    for (std::size_t i = 0; i != path.size(); ++i)
+      ss << (i == 0 ? "" : " -> ") << "\"" << path[i] << "\"";
+    viennamesh::backend::info(10) << "Conversion route (cost " << distance[data_type_to] << "): " << ss.str() << std::endl;
+  }
+
+  conversion_paths[key] = path;
+
+#ifndef _WIN32
+  pthread_mutex_unlock(&conversion_path_mutex_);
+#endif
+
+  return path;
 }
 
+
 void viennamesh_context_t::convert(viennamesh_data_wrapper from, viennamesh_data_wrapper to)
 {
   if (from->context() != to->context())
     VIENNAMESH_ERROR(VIENNAMESH_ERROR_DIFFERENT_CONTEXT, "");
 
   std::string from_data_type_name = from->type_name();
+  std::string to_data_type_name = to->type_name();
+
+  bool direct = false;
+  {
+    registry_lock lock(this);
+    direct = get_data_type(from_data_type_name).has_conversion_function(to_data_type_name);
+  }
+
+  if (direct)
+  {
+    convert_direct( from, to );
+    return;
+  }
+
+  std::vector<std::string> path = conversion_path(from_data_type_name, to_data_type_name);
+  if (path.size() < 2)
+    VIENNAMESH_ERROR(VIENNAMESH_ERROR_NO_CONVERSION_TO_DATA_TYPE, "No conversion found from data type \"" + from_data_type_name + "\" to \"" + to_data_type_name + "\"");
+
+  viennamesh_data_wrapper current = from;
+  current->retain();
+
+  try
+  {
+    for (std::size_t i = 1; i != path.size()-1; ++i)
+    {
+      viennamesh_data_wrapper next = make_data(path[i]);
+
+      try
+      {
+        convert_direct(current, next);
+      }
+      catch (...)
+      {
+        next->release();
+        throw;
+      }
+
+      current->release();
+      current = next;
+    }
+
+    convert_direct(current, to);
+  }
+  catch (...)
+  {
+    current->release();
+    throw;
+  }
 
-  get_data_type(from_data_type_name).convert( from, to );
+  current->release();
+}
+
+void viennamesh_context_t::convert_direct(viennamesh_data_wrapper from, viennamesh_data_wrapper to)
+{
+  // the conversion itself runs without the registry lock
+  viennamesh_data_convert_function function = 0;
+  {
+    registry_lock lock(this);
+    viennamesh::data_template_t::ConvertFunctionMap const & functions = get_data_type(from->type_name()).conversion_functions();
+    viennamesh::data_template_t::ConvertFunctionMap::const_iterator it = functions.find( to->type_name() );
+    if (it != functions.end())
+      function = it->second.function;
+  }
+
+  if (!function)
+    VIENNAMESH_ERROR(VIENNAMESH_ERROR_NO_CONVERSION_TO_DATA_TYPE, "No conversion found from data type \"" + from->type_name() + "\" to \"" + to->type_name() + "\"");
+
+  to->resize( from->size() );
+  for (int i = 0; i != from->size(); ++i)
+  {
+    to->make_data(i);
+    function( from->data(i), to->data(i) );
+  }
 }
 
 viennamesh_data_wrapper viennamesh_context_t::convert_to(viennamesh_data_wrapper from,
                             std::string const & data_type_name_)
 {
   viennamesh_data_wrapper result = make_data(data_type_name_);
-  convert(from, result);
+
+  try
+  {
+    convert(from, result);
+  }
+  catch (...)
+  {
+    result->release();
+    throw;
+  }
+
+  return result;
+}
+
+viennamesh_data_wrapper viennamesh_context_t::cached_convert_to(viennamesh_data_wrapper from,
+                                                               std::string const & data_type_name_)
+{
+  // the lock is held during the conversion, concurrent requests for the same conversion wait for the first one
+  from->lock_conversions();
+
+  viennamesh_data_wrapper result = from->cached_conversion(data_type_name_);
+  if (result)
+  {
+    int hits = __sync_add_and_fetch(&conversion_cache_hits_, 1);
+    from->unlock_conversions();
+
+    viennamesh::backend::debug(5) << "Conversion cache hit: \"" << from->type_name() << "\" -> \"" << data_type_name_ << "\" (hits: " << hits << ", misses: " << conversion_cache_misses_ << ")" << std::endl;
+    return result;
+  }
+
+  int misses = __sync_add_and_fetch(&conversion_cache_misses_, 1);
+
+  try
+  {
+    result = convert_to(from, data_type_name_);
+  }
+  catch (...)
+  {
+    from->unlock_conversions();
+    throw;
+  }
+
+  from->cache_conversion(data_type_name_, result);
+  result->release();
+  from->unlock_conversions();
+
+  viennamesh::backend::debug(5) << "Conversion cache miss: \"" << from->type_name() << "\" -> \"" << data_type_name_ << "\" (hits: " << conversion_cache_hits_ << ", misses: " << misses << ")" << std::endl;
   return result;
 }
 
 viennamesh::algorithm_template viennamesh_context_t::get_algorithm_template(std::string const & algorithm_name_)
 {
+  registry_lock lock(this);
   std::map<std::string, viennamesh::algorithm_template_t>::iterator it = algorithm_templates.find(algorithm_name_);
+  if (it == algorithm_templates.end() && load_pending_plugin_for_algorithm(algorithm_name_))
+    it = algorithm_templates.find(algorithm_name_);
   if (it == algorithm_templates.end())
     VIENNAMESH_ERROR(VIENNAMESH_ERROR_ALGORITHM_NOT_REGISTERED, "Algorithm \"" + algorithm_name_ + "\" not registered");
 
@@ -112,8 +597,38 @@ viennamesh::algorithm_template viennamesh_context_t::get_algorithm_template(std:
 }
 
 
+void viennamesh_context_t::register_algorithm(std::string const & algorithm_id,
+                                              viennamesh_algorithm_make_function make_function,
+                                              viennamesh_algorithm_delete_function delete_function,
+                                              viennamesh_algorithm_init_function init_function,
+                                              viennamesh_algorithm_run_function run_function)
+{
+  registry_lock lock(this);
+
+  std::map<std::string, viennamesh::algorithm_template_t>::iterator it = algorithm_templates.find(algorithm_id);
+  if (it != algorithm_templates.end())
+    VIENNAMESH_ERROR(VIENNAMESH_ERROR_ALGORITHM_ALREADY_REGISTERED, "Algorithm \"" + algorithm_id + "\" already registered");
+
+  if (recording_plugin_)
+    recording_plugin_->algorithms.push_back(algorithm_id);
+
+  viennamesh::algorithm_template_t & algorithm_template = algorithm_templates[algorithm_id];
+  algorithm_template.set_context(this);
+  algorithm_template.init(algorithm_id,
+                          make_function, delete_function,
+                          init_function, run_function);
+
+  viennamesh::backend::info(10) << "Algorithm \"" << algorithm_id << "\" sucessfully registered" << std::endl;
+}
+
+
 viennamesh_plugin viennamesh_context_t::load_plugin(std::string const & plugin_filename)
 {
+  registry_lock lock(this);
+  std::map<std::string, viennamesh_plugin>::iterator pit = loaded_plugin_files.find(plugin_filename);
+  if (pit != loaded_plugin_files.end())
+    return pit->second;
+
   viennamesh::backend::LoggingStack stack("Loading plugin \"" + plugin_filename + "\"", 10);
 
   void * dl = dlopen(plugin_filename.c_str(), RTLD_NOW);
@@ -152,6 +667,7 @@ viennamesh_plugin viennamesh_context_t::load_plugin(std::string const & plugin_f
 
   init_function( this );
   loaded_plugins.insert(dl);
+  loaded_plugin_files[plugin_filename] = dl;
 
 //   viennamesh::backend::info(1) << "Plugin \"" << plugin_filename << "\" successfully loaded" << std::endl;
 
@@ -173,6 +689,8 @@ void viennamesh_context_t::load_plugins_in_directory(std::string directory_name)
 
   if (dir != NULL)
   {
+    registry_lock lock(this);
+
     /* print all the files and directories within directory */
     std::vector<std::string> plugins_in_directory;
 
@@ -191,9 +709,99 @@ void viennamesh_context_t::load_plugins_in_directory(std::string directory_name)
       return;
     }
 
+    std::sort( plugins_in_directory.begin(), plugins_in_directory.end() );
+
+    bool lazy = getenv("VIENNAMESH_EAGER_PLUGIN_LOADING") == NULL;
+
+    std::string manifest_filename = directory_name + plugin_manifest_name;
+    std::map<std::string, viennamesh::plugin_manifest_entry> manifest;
+    if (lazy && !read_plugin_manifest(manifest_filename, manifest))
+    {
+      std::string user_manifest_filename = user_plugin_manifest_filename(directory_name);
+      if (!user_manifest_filename.empty() && read_plugin_manifest(user_manifest_filename, manifest))
+        manifest_filename = user_manifest_filename;
+    }
+
+    std::vector<viennamesh::plugin_manifest_entry> new_manifest;
+    bool manifest_changed = false;
+
     viennamesh::backend::LoggingStack stack("Loading all plugins in directory \"" + directory_name + "\"", 10);
     for (std::size_t i = 0; i != plugins_in_directory.size(); ++i)
-      load_plugin(directory_name + plugins_in_directory[i]);
+    {
+      std::string plugin_filename = directory_name + plugins_in_directory[i];
+
+      struct stat file_status;
+      if (stat(plugin_filename.c_str(), &file_status) != 0)
+        continue;
+
+      std::map<std::string, viennamesh::plugin_manifest_entry>::const_iterator mit = manifest.find(plugins_in_directory[i]);
+      if ( mit != manifest.end() &&
+           mit->second.modification_time == modification_time(file_status) &&
+           mit->second.file_size == static_cast<long long>(file_status.st_size) )
+      {
+        new_manifest.push_back(mit->second);
+
+        if (loaded_plugin_files.find(plugin_filename) != loaded_plugin_files.end())
+          continue;
+
+        viennamesh::plugin_manifest_entry const & entry = mit->second;
+        pending_plugins[plugin_filename] = entry;
+        for (std::size_t j = 0; j != entry.algorithms.size(); ++j)
+          pending_algorithms[entry.algorithms[j]] = plugin_filename;
+        for (std::size_t j = 0; j != entry.data_types.size(); ++j)
+          pending_data_types[entry.data_types[j]] = plugin_filename;
+
+        viennamesh::backend::info(10) << "Plugin \"" << plugin_filename << "\" is loaded on first use" << std::endl;
+        continue;
+      }
+
+      viennamesh::plugin_manifest_entry entry;
+      entry.filename = plugins_in_directory[i];
+      entry.modification_time = modification_time(file_status);
+      entry.file_size = file_status.st_size;
+
+      viennamesh::plugin_manifest_entry * previous_recording_plugin = recording_plugin_;
+      recording_plugin_ = &entry;
+      viennamesh_plugin plugin = 0;
+      try
+      {
+        plugin = load_plugin(plugin_filename);
+      }
+      catch (...)
+      {
+        recording_plugin_ = previous_recording_plugin;
+        throw;
+      }
+      recording_plugin_ = previous_recording_plugin;
+
+      if (plugin)
+      {
+        new_manifest.push_back(entry);
+        manifest_changed = true;
+      }
+    }
+
+    if (lazy && (manifest_changed || new_manifest.size() != manifest.size()))
+    {
+      bool written = write_plugin_manifest(manifest_filename, new_manifest);
+      if (!written)
+      {
+        // e.g. an installed, read-only plugin directory
+        viennamesh::backend::info(10) << "Could not write plugin manifest \"" << manifest_filename << "\"" << std::endl;
+
+        std::string user_manifest_filename = user_plugin_manifest_filename(directory_name);
+        if (!user_manifest_filename.empty() && user_manifest_filename != manifest_filename)
+        {
+          manifest_filename = user_manifest_filename;
+          written = write_plugin_manifest(manifest_filename, new_manifest);
+        }
+      }
+
+      if (written)
+        viennamesh::backend::info(10) << "Wrote plugin manifest \"" << manifest_filename << "\"" << std::endl;
+      else
+        viennamesh::backend::warning(10) << "Could not write a plugin manifest for directory \"" << directory_name << "\", plugins are loaded eagerly" << std::endl;
+    }
   }
   else
   {
@@ -203,4 +811,86 @@ void viennamesh_context_t::load_plugins_in_directory(std::string directory_name)
 
 
 
+bool viennamesh_context_t::load_pending_plugin(std::string const & plugin_filename)
+{
+  registry_lock lock(this);
+
+  bool loaded = false;
+  std::map<std::string, viennamesh::plugin_manifest_entry>::iterator it = pending_plugins.find(plugin_filename);
+  if (it != pending_plugins.end())
+  {
+    pending_plugins.erase(it);
+
+    // registrations of a lazily loaded plugin are already in the manifest
+    viennamesh::plugin_manifest_entry * previous_recording_plugin = recording_plugin_;
+    recording_plugin_ = NULL;
+    try
+    {
+      loaded = load_plugin(plugin_filename) != 0;
+    }
+    catch (...)
+    {
+      recording_plugin_ = previous_recording_plugin;
+      throw;
+    }
+    recording_plugin_ = previous_recording_plugin;
+  }
+
+  return loaded;
+}
+
+bool viennamesh_context_t::load_pending_plugin_for_algorithm(std::string const & algorithm_name_)
+{
+  registry_lock lock(this);
+  std::map<std::string, std::string>::const_iterator it = pending_algorithms.find(algorithm_name_);
+  if (it == pending_algorithms.end())
+    return false;
+
+  viennamesh::backend::info(10) << "Loading plugin \"" << it->second << "\" for algorithm \"" << algorithm_name_ << "\"" << std::endl;
+  return load_pending_plugin(it->second);
+}
+
+bool viennamesh_context_t::load_pending_plugin_for_data_type(std::string const & data_type_name_)
+{
+  registry_lock lock(this);
+  std::map<std::string, std::string>::const_iterator it = pending_data_types.find(data_type_name_);
+  if (it == pending_data_types.end())
+    return false;
+
+  viennamesh::backend::info(10) << "Loading plugin \"" << it->second << "\" for data type \"" << data_type_name_ << "\"" << std::endl;
+  return load_pending_plugin(it->second);
+}
+
+bool viennamesh_context_t::load_pending_plugins_for_conversion(std::string const & data_type_from, std::string const & data_type_to)
+{
+  registry_lock lock(this);
+  std::vector<std::string> plugin_filenames;
+  for (std::map<std::string, viennamesh::plugin_manifest_entry>::const_iterator it = pending_plugins.begin(); it != pending_plugins.end(); ++it)
+  {
+    std::vector< std::pair<std::string, std::string> > const & conversions = it->second.conversions;
+    for (std::size_t i = 0; i != conversions.size(); ++i)
+    {
+      if (conversions[i].first == data_type_from || conversions[i].second == data_type_to)
+      {
+        plugin_filenames.push_back(it->first);
+        break;
+      }
+    }
+  }
 
+  bool loaded = false;
+  for (std::size_t i = 0; i != plugin_filenames.size(); ++i)
+    loaded = load_pending_plugin(plugin_filenames[i]) || loaded;
+
+  return loaded;
+}
+
+bool viennamesh_context_t::load_all_pending_plugins()
+{
+  registry_lock lock(this);
+  bool loaded = false;
+  while (!pending_plugins.empty())
+    loaded = load_pending_plugin(pending_plugins.begin()->first) || loaded;
+
+  return loaded;
+}
@@ -3,12 +3,36 @@
 
 #include <set>
 #include <dlfcn.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #include "forwards.hpp"
 #include "data.hpp"
 #include "algorithm.hpp"
 #include "logger.hpp"
 
+namespace viennamesh
+{
+  // What a plugin registers in its init function, stored in the plugin
+  // manifest of its directory (or of the user if the directory is not writable).
+  // The entry is valid as long as modification time and size of the plugin file
+  // do not change.
+  struct plugin_manifest_entry
+  {
+    plugin_manifest_entry() : modification_time(0), file_size(0) {}
+
+    std::string filename;
+    // in nanoseconds where the file system provides them
+    long long modification_time;
+    long long file_size;
+
+    std::vector<std::string> algorithms;
+    std::vector<std::string> data_types;
+    std::vector< std::pair<std::string, std::string> > conversions;
+  };
+}
+
 struct viennamesh_context_t
 {
 public:
@@ -16,8 +40,14 @@ public:
   viennamesh_context_t();
   ~viennamesh_context_t();
 
-  int registered_data_type_count() const;
-  std::string const & registered_data_type_name(int index_) const;
+  // both load all pending plugins to list every available data type
+  int registered_data_type_count();
+  std::string const & registered_data_type_name(int index_);
+
+  // The registry (data types, conversion functions, algorithm templates and pending plugins)
+  // is guarded by one recursive lock, plugins register while it is held by the lazy loading
+  void lock_registry();
+  void unlock_registry();
 
   viennamesh::data_template_t & get_data_type(std::string const & data_type_name_);
   viennamesh::data_template_t const & get_data_type(std::string const & data_type_name_) const;
@@ -33,13 +63,27 @@ public:
 
   void register_conversion_function(std::string const & data_type_from,
                                     std::string const & data_type_to,
-                                    viennamesh_data_convert_function convert_function);
+                                    viennamesh_data_convert_function convert_function,
+                                    double cost = 1.0);
+
+  // cheapest chain of data types from data_type_from to data_type_to (both included) using
+  // registered conversion functions, empty if there is none; routes are memoised per type pair
+  std::vector<std::string> conversion_path(std::string const & data_type_from,
+                                           std::string const & data_type_to);
 
 
   void convert(viennamesh_data_wrapper from, viennamesh_data_wrapper to);
   viennamesh_data_wrapper convert_to(viennamesh_data_wrapper from,
                                     std::string const & data_type_name_);
 
+  // like convert_to but reuses a previous conversion of the same data, the returned
+  // data is owned by the conversion cache of from (not retained for the caller)
+  viennamesh_data_wrapper cached_convert_to(viennamesh_data_wrapper from,
+                                           std::string const & data_type_name_);
+
+  int conversion_cache_hits() const { return conversion_cache_hits_; }
+  int conversion_cache_misses() const { return conversion_cache_misses_; }
+
 
 
 
@@ -49,20 +93,7 @@ public:
                           viennamesh_algorithm_make_function make_function,
                           viennamesh_algorithm_delete_function delete_function,
                           viennamesh_algorithm_init_function init_function,
-                          viennamesh_algorithm_run_function run_function)
-  {
-    std::map<std::string, viennamesh::algorithm_template_t>::iterator it = algorithm_templates.find(algorithm_id);
-    if (it != algorithm_templates.end())
-      VIENNAMESH_ERROR(VIENNAMESH_ERROR_ALGORITHM_ALREADY_REGISTERED, "Algorithm \"" + algorithm_id + "\" already registered");
-
-    viennamesh::algorithm_template_t & algorithm_template = algorithm_templates[algorithm_id];
-    algorithm_template.set_context(this);
-    algorithm_template.init(algorithm_id,
-                            make_function, delete_function,
-                            init_function, run_function);
-
-    viennamesh::backend::info(10) << "Algorithm \"" << algorithm_id << "\" sucessfully registered" << std::endl;
-  }
+                          viennamesh_algorithm_run_function run_function);
 
   viennamesh_algorithm_wrapper make_algorithm(std::string const & algorithm_id)
   {
@@ -117,13 +148,19 @@ public:
 
 
   viennamesh_plugin load_plugin(std::string const & plugin_filename);
+
+  // Plugins with an up-to-date entry in the manifest of the directory are not
+  // loaded, they are loaded on the first use of one of their algorithms, data
+  // types or conversions. All other plugins are loaded and the manifest is
+  // updated. Setting the environment variable VIENNAMESH_EAGER_PLUGIN_LOADING
+  // loads all plugins.
   void load_plugins_in_directory(std::string directory_name);
 
 
-  void retain() { ++use_count_; }
+  void retain() { __sync_add_and_fetch(&use_count_, 1); }
   bool release()
   {
-    if (--use_count_ <= 0)
+    if (__sync_sub_and_fetch(&use_count_, 1) <= 0)
     {
       delete_this();
       return false;
@@ -142,6 +179,12 @@ private:
   std::map<std::string, viennamesh::data_template_t> data_types;
   std::map<std::string, viennamesh::algorithm_template_t> algorithm_templates;
 
+  typedef std::map< std::pair<std::string, std::string>, std::vector<std::string> > ConversionPathMapType;
+  ConversionPathMapType conversion_paths;
+#ifndef _WIN32
+  pthread_mutex_t conversion_path_mutex_;
+#endif
+
   void delete_this()
   {
 #ifdef VIENNAMESH_BACKEND_RETAIN_RELEASE_LOGGING
@@ -151,6 +194,32 @@ private:
   }
 
   std::set<viennamesh_plugin> loaded_plugins;
+  std::map<std::string, viennamesh_plugin> loaded_plugin_files;
+
+  // lazy plugin loading, all maps use the full plugin filename
+  bool load_pending_plugin(std::string const & plugin_filename);
+  bool load_pending_plugin_for_algorithm(std::string const & algorithm_name_);
+  bool load_pending_plugin_for_data_type(std::string const & data_type_name_);
+  bool load_pending_plugins_for_conversion(std::string const & data_type_from, std::string const & data_type_to);
+  bool load_all_pending_plugins();
+
+  std::vector<std::string> find_conversion_path(std::string const & data_type_from,
+                                                std::string const & data_type_to);
+  // direct conversion with a registered conversion function of the type of from
+  void convert_direct(viennamesh_data_wrapper from, viennamesh_data_wrapper to);
+
+  std::map<std::string, viennamesh::plugin_manifest_entry> pending_plugins;
+  std::map<std::string, std::string> pending_algorithms;
+  std::map<std::string, std::string> pending_data_types;
+
+  // entry of the plugin whose init function is currently running, NULL if the registrations are not recorded
+  viennamesh::plugin_manifest_entry * recording_plugin_;
+#ifndef _WIN32
+  pthread_mutex_t plugin_mutex_;
+#endif
+
+  int conversion_cache_hits_;
+  int conversion_cache_misses_;
 
   int use_count_;
 };
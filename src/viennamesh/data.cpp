@@ -18,6 +18,7 @@ void viennamesh_data_wrapper_t::make_data(int position)
     return;
 
   release_internal_data(position);
+  invalidate_conversions();
 
   internal_data[position].data = data_template()->make_data();
   internal_data[position].own_data = true;
@@ -29,6 +30,7 @@ void viennamesh_data_wrapper_t::set_data(int position, viennamesh_data internal_
     return;
 
   release_internal_data(position);
+  invalidate_conversions();
 
   internal_data[position].data = internal_data_in;
   internal_data[position].own_data = false;
@@ -48,6 +50,7 @@ void viennamesh_data_wrapper_t::resize(int new_size)
     return;
 
   int old_size = size();
+  invalidate_conversions();
 
   if (new_size < old_size)
   {
@@ -67,6 +70,53 @@ void viennamesh_data_wrapper_t::resize(int new_size)
 
 
 
+void viennamesh_data_wrapper_t::lock_conversions()
+{
+#ifndef _WIN32
+  pthread_mutex_lock(&conversion_mutex_);
+#endif
+}
+
+void viennamesh_data_wrapper_t::unlock_conversions()
+{
+#ifndef _WIN32
+  pthread_mutex_unlock(&conversion_mutex_);
+#endif
+}
+
+viennamesh_data_wrapper viennamesh_data_wrapper_t::cached_conversion(std::string const & data_type_name_)
+{
+  ConversionCacheType::iterator it = conversion_cache.find(data_type_name_);
+  if (it == conversion_cache.end())
+    return 0;
+
+  return it->second;
+}
+
+void viennamesh_data_wrapper_t::cache_conversion(std::string const & data_type_name_, viennamesh_data_wrapper converted)
+{
+  ConversionCacheType::iterator it = conversion_cache.find(data_type_name_);
+  if (it != conversion_cache.end())
+    it->second->release();
+
+  conversion_cache[data_type_name_] = converted;
+  converted->retain();
+}
+
+void viennamesh_data_wrapper_t::invalidate_conversions()
+{
+  lock_conversions();
+  ConversionCacheType tmp;
+  tmp.swap(conversion_cache);
+  unlock_conversions();
+
+  for (ConversionCacheType::iterator it = tmp.begin(); it != tmp.end(); ++it)
+    it->second->release();
+}
+
+
+
+
 void viennamesh_data_wrapper_t::release_internal_data(int position)
 {
   if (position < 0 || position >= size())
@@ -93,5 +143,10 @@ void viennamesh_data_wrapper_t::delete_this()
   for (int i = 0; i != size(); ++i)
     release_internal_data(i);
 
+  invalidate_conversions();
+#ifndef _WIN32
+  pthread_mutex_destroy(&conversion_mutex_);
+#endif
+
   delete this;
 }
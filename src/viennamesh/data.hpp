@@ -11,6 +11,10 @@
 #include "viennamesh/cpp_error.hpp"
 #include "logger.hpp"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 
 
 struct viennamesh_internal_data_t
@@ -30,6 +34,9 @@ public:
   {
 #ifdef VIENNAMESH_BACKEND_RETAIN_RELEASE_LOGGING
     std::cout << "New data at " << this << std::endl;
+#endif
+#ifndef _WIN32
+    pthread_mutex_init(&conversion_mutex_, NULL);
 #endif
     make_data(0);
   }
@@ -47,12 +54,23 @@ public:
 
   viennamesh::data_template data_template() { return data_template_;}
 
-  void retain() { ++use_count_; }
+
+  // Converted representations of this data are cached per target data type, the cache
+  // holds one reference of each converted data. The cache is invalidated whenever the
+  // internal data is replaced, resized or explicitly marked as modified.
+  void lock_conversions();
+  void unlock_conversions();
+
+  viennamesh_data_wrapper cached_conversion(std::string const & data_type_name_);
+  void cache_conversion(std::string const & data_type_name_, viennamesh_data_wrapper converted);
+  void invalidate_conversions();
+
+  void retain() { __sync_add_and_fetch(&use_count_, 1); }
   bool release()
   {
     assert(use_count_ > 0);
 
-    if (--use_count_ <= 0)
+    if (__sync_sub_and_fetch(&use_count_, 1) <= 0)
     {
       delete_this();
       return false;
@@ -66,6 +84,12 @@ private:
 
   std::vector<viennamesh_internal_data_t> internal_data;
 
+  typedef std::map<std::string, viennamesh_data_wrapper> ConversionCacheType;
+  ConversionCacheType conversion_cache;
+#ifndef _WIN32
+  pthread_mutex_t conversion_mutex_;
+#endif
+
   void release_internal_data(int position);
   void release_internal_data();
 
@@ -109,12 +133,34 @@ namespace viennamesh
 
 
 
+    struct conversion_function_t
+    {
+      conversion_function_t() : function(0), cost(1.0) {}
+      conversion_function_t(viennamesh_data_convert_function function_in, double cost_in) : function(function_in), cost(cost_in) {}
+
+      viennamesh_data_convert_function function;
+      double cost;
+    };
+
+    typedef std::map<std::string, conversion_function_t> ConvertFunctionMap;
+
+
+    // cost is a relative hint used for planning multi-step conversions, cheaper chains are preferred
     void add_conversion_function(std::string const & to_data_type,
-                                 viennamesh_data_convert_function convert_function)
+                                 viennamesh_data_convert_function convert_function,
+                                 double cost = 1.0)
     {
-      convert_functions[to_data_type] = convert_function;
+      convert_functions[to_data_type] = conversion_function_t(convert_function, cost);
     }
 
+    bool has_conversion_function(std::string const & to_data_type) const
+    {
+      return convert_functions.find(to_data_type) != convert_functions.end();
+    }
+
+    ConvertFunctionMap const & conversion_functions() const { return convert_functions; }
+
+    // direct conversion only, multi-step conversions are planned by the context
     void convert(viennamesh_data_wrapper from, viennamesh_data_wrapper to) const
     {
       ConvertFunctionMap::const_iterator it = convert_functions.find( to->type_name() );
@@ -128,7 +174,7 @@ namespace viennamesh
       for (int i = 0; i != from->size(); ++i)
       {
         to->make_data(i);
-        it->second( from->data(i), to->data(i) );
+        it->second.function( from->data(i), to->data(i) );
       }
     }
 
@@ -146,7 +192,6 @@ namespace viennamesh
     viennamesh_data_make_function make_function_;
     viennamesh_data_delete_function delete_function_;
 
-    typedef std::map<std::string, viennamesh_data_convert_function> ConvertFunctionMap;
     ConvertFunctionMap convert_functions;
   };
 
@@ -13,12 +13,34 @@
 =============================================================================== */
 
 #include "logger.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
   namespace backend
   {
 
+    namespace
+    {
+      VIENNAMESH_THREAD_LOCAL int logger_indentation_count = 0;
+      VIENNAMESH_THREAD_LOCAL int logger_thread_log_levels[5] = {-1, -1, -1, -1, -1};
+    }
+
+    void Logger::set_thread_log_level( int tag_index, int level )
+    {
+      logger_thread_log_levels[tag_index] = level;
+    }
+
+    int Logger::thread_log_level( int tag_index )
+    {
+      return logger_thread_log_levels[tag_index];
+    }
+
+    void Logger::increase_indentation() { ++logger_indentation_count; }
+    void Logger::decrease_indentation() { --logger_indentation_count; }
+    int Logger::indentation_count() const { return logger_indentation_count; }
+
+
     int Logger::register_color_cout_callback()
     {
       return register_callback( new StdOutCallback<CoutColorFormater>() );
@@ -51,51 +73,105 @@ namespace viennamesh
     }
 
 #ifndef _WIN32
+    namespace
+    {
+      VIENNAMESH_THREAD_LOCAL char const * std_capture_thread_tag = NULL;
+    }
+
+    char const * StdCapture::thread_tag()
+    {
+      return std_capture_thread_tag;
+    }
+
+    void StdCapture::set_thread_tag(char const * tag)
+    {
+      std_capture_thread_tag = tag;
+    }
+
+
     void * StdCapture::reader(void * data)
     {
-      // Form descriptor
       StdCapture & std_capture = *(StdCapture*)(data);
       int readFd = std_capture.m_pipe[StdCapture::READ];
       fd_set readset;
-      int err = 0;
-      // Initialize time out struct for select()
-      struct timeval tv;
-      tv.tv_sec = 0;
-      tv.tv_usec = 10000;
-      // Implement the receiver loop
-      while(std_capture.thread_running)
+
+      while (!std_capture.m_shutdown)
       {
-        // Initialize the set
         FD_ZERO(&readset);
         FD_SET(readFd, &readset);
-        // Now, check for readability
-        err = select(readFd+1, &readset, NULL, NULL, &tv);
-        if (err > 0 && FD_ISSET(readFd, &readset))
+
+        // select may modify the time out, it has to be initialized every time
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = 10000;
+
+        if (select(readFd+1, &readset, NULL, NULL, &tv) > 0 && FD_ISSET(readFd, &readset))
         {
-          // Clear flags
-          FD_CLR(readFd, &readset);
-
-          std::string m_captured;
-          std::string buf;
-          const int bufSize = 1024;
-          buf.resize(bufSize);
-          int bytesRead = 0;
-
-          bytesRead = read(std_capture.m_pipe[StdCapture::READ], &(*buf.begin()), bufSize);
-          while ( bytesRead > 0 )
-          {
-            buf.resize(bytesRead);
-            m_captured += buf;
-            bytesRead = read(std_capture.m_pipe[StdCapture::READ], &(*buf.begin()), bufSize);
-          }
-
-          logger().log<info_tag>(7, m_captured);
+          pthread_mutex_lock(&std_capture.m_mutex);
+          std_capture.drain();
+          pthread_mutex_unlock(&std_capture.m_mutex);
         }
       }
 
       return NULL;
     }
 
+    void StdCapture::drain()
+    {
+      char buf[4096];
+      ssize_t bytesRead = 0;
+
+      while ( (bytesRead = read(m_pipe[READ], buf, sizeof(buf))) > 0 )
+        push(buf, bytesRead);
+    }
+
+    void StdCapture::push(char const * data, std::size_t size)
+    {
+      for (std::size_t i = 0; i != size; ++i)
+      {
+        // a line longer than the ring buffer is logged in pieces
+        if (m_ringSize == m_ring.size())
+          emit_line(m_ringSize);
+
+        m_ring[ (m_ringBegin + m_ringSize) % m_ring.size() ] = data[i];
+        ++m_ringSize;
+
+        if (data[i] == '\n')
+          emit_line(m_ringSize);
+      }
+    }
+
+    void StdCapture::emit_line(std::size_t count)
+    {
+      if (count == 0)
+        return;
+
+      std::string line;
+      line.reserve(count+1);
+      for (std::size_t i = 0; i != count; ++i)
+        line.push_back( m_ring[ (m_ringBegin + i) % m_ring.size() ] );
+      if (line[line.size()-1] != '\n')
+        line.push_back('\n');
+
+      m_ringBegin = (m_ringBegin + count) % m_ring.size();
+      m_ringSize -= count;
+
+      // attribute the line to the tags of the active captures
+      std::string prefix;
+      for (std::size_t i = 0; i != m_activeTags.size(); ++i)
+      {
+        if (m_activeTags[i].empty() || std::find(m_activeTags.begin(), m_activeTags.begin()+i, m_activeTags[i]) != m_activeTags.begin()+i)
+          continue;
+
+        prefix += prefix.empty() ? "[" : ",";
+        prefix += m_activeTags[i];
+      }
+      if (!prefix.empty())
+        prefix += "] ";
+
+      logger().log<info_tag>(capture_log_level, prefix + line);
+    }
+
 #endif
 
     template<typename OutputFormaterT>
@@ -107,7 +183,7 @@ namespace viennamesh
 #ifndef _WIN32
       if (StdCapture::get().capturing())
       {
-        ::write( StdCapture::get().old_stdout(), message.c_str(), message.length()+1 );
+        ::write( StdCapture::get().old_stdout(), message.c_str(), message.length() );
       }
       else
         std::cout << message;
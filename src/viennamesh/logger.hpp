@@ -18,6 +18,7 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <map>
 #include <sstream>
 #include <fstream>
@@ -26,6 +27,7 @@
 #ifndef _WIN32
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #endif
 
 #include "viennautils/timer.hpp"
@@ -75,30 +77,35 @@ namespace viennamesh
 
     struct stack_tag
     {
+      enum { index = 0 };
       static std::string name() { return "stack"; }
       typedef cyan color;
     };
 
     struct info_tag
     {
+      enum { index = 1 };
       static std::string name() { return "info"; }
       typedef blue color;
     };
 
     struct warning_tag
     {
+      enum { index = 2 };
       static std::string name() { return "warning"; }
       typedef yellow color;
     };
 
     struct error_tag
     {
+      enum { index = 3 };
       static std::string name() { return "error"; }
       typedef red color;
     };
 
     struct debug_tag
     {
+      enum { index = 4 };
       static std::string name() { return "debug"; }
       typedef magenta color;
     };
@@ -276,11 +283,20 @@ namespace viennamesh
     {
     public:
 
-      Logger() : indentation_count_(0), log_levels_(5) {}
+      Logger() : log_levels_(5)
+      {
+#ifndef _WIN32
+        pthread_mutex_init(&mutex_, NULL);
+#endif
+      }
+
       ~Logger()
       {
         for (std::vector<BaseCallback *>::iterator it = callbacks.begin(); it != callbacks.end(); ++it)
           delete *it;
+#ifndef _WIN32
+        pthread_mutex_destroy(&mutex_);
+#endif
       }
 
       template<typename LoggingTagT>
@@ -304,12 +320,19 @@ namespace viennamesh
 
 
 
+      // messages may arrive from several threads (capture reader, parallel pipelines)
       template<typename LoggingTagT>
       void log( int log_level,
                     std::string const & message )
       {
+#ifndef _WIN32
+        pthread_mutex_lock(&mutex_);
+#endif
         for (std::vector< BaseCallback * >::iterator it = callbacks.begin(); it != callbacks.end(); ++it)
           (*it)->log<LoggingTagT>(*this, log_level, message);
+#ifndef _WIN32
+        pthread_mutex_unlock(&mutex_);
+#endif
       }
 
       int register_color_cout_callback();
@@ -329,9 +352,22 @@ namespace viennamesh
       void set_log_level( int level ) { log_levels_.set<LoggingTagT>(level); }
       void set_all_log_level( int level ) { log_levels_.set_all(level); }
 
-      void increase_indentation() { ++indentation_count_; }
-      void decrease_indentation() { --indentation_count_; }
-      int indentation_count() const { return indentation_count_; }
+      // Log levels of the calling thread, e.g. of an algorithm running in a parallel
+      // pipeline. A negative level uses the level of the logger.
+      static void set_thread_log_level( int tag_index, int level );
+      static int thread_log_level( int tag_index );
+
+      template<typename LoggingTagT>
+      int effective_log_level() const
+      {
+        int level = thread_log_level( LoggingTagT::index );
+        return level < 0 ? get_log_level<LoggingTagT>() : level;
+      }
+
+      // the indentation is counted per thread, concurrent logging stacks do not interfere
+      void increase_indentation();
+      void decrease_indentation();
+      int indentation_count() const;
 
     private:
 
@@ -341,10 +377,13 @@ namespace viennamesh
         return callbacks.size()-1;
       }
 
-      int indentation_count_;
       LoggingLevels< int > log_levels_;
 
       std::vector<BaseCallback *> callbacks;
+
+#ifndef _WIN32
+      pthread_mutex_t mutex_;
+#endif
     };
 
 
@@ -362,7 +401,7 @@ namespace viennamesh
                             int log_level,
                             std::string const & message)
       {
-        if (log_level <= logger.log_levels().get<LoggingTagT>())
+        if (log_level <= logger.effective_log_level<LoggingTagT>())
           write( make(logger, LoggingTagT::name(), colored_name<LoggingTagT>(), log_level, message) );
       }
 
@@ -555,6 +594,12 @@ namespace viennamesh
 
 
 
+    // Redirects stdout/stderr of the process into a pipe while at least one
+    // capture is active, captures may overlap (e.g. meshers running in
+    // parallel). One long-lived reader thread collects the output in a ring
+    // buffer and logs it line by line as info(7), prefixed with the tags of
+    // the threads which started the active captures. If info(7) would be
+    // discarded anyway, the output is redirected to /dev/null instead.
     class StdCapture
     {
     public:
@@ -566,16 +611,24 @@ namespace viennamesh
       template<typename OutputFormaterT>
       friend struct StdOutCallback;
 
-      StdCapture(): m_capturing(false), m_init(false), m_oldStdOut(0), m_oldStdErr(0)
+      static const int capture_log_level = 7;
+
+      StdCapture() : m_oldStdOut(0), m_oldStdErr(0), m_nullFd(-1), m_init(false),
+          m_readerStarted(false), m_shutdown(false), m_activeCount(0), m_discarding(false),
+          m_ring(65536), m_ringBegin(0), m_ringSize(0)
       {
+          // the logger is used by the destructor, it has to be destroyed after this object
+          logger();
+          pthread_mutex_init(&m_mutex, NULL);
+
           m_pipe[READ] = 0;
           m_pipe[WRITE] = 0;
           if (pipe(m_pipe) == -1)
               return;
-  //  #ifndef _WIN32
           // Reading pipe has to be set to non-blocking
           fcntl(m_pipe[READ], F_SETFL, fcntl(m_pipe[READ], F_GETFL) | O_NONBLOCK);
-  //  #endif
+
+          m_nullFd = open("/dev/null", O_WRONLY);
 
           m_oldStdOut = dup(fileno(stdout));
           m_oldStdErr = dup(fileno(stderr));
@@ -587,18 +640,30 @@ namespace viennamesh
 
       ~StdCapture()
       {
-          if (m_capturing)
+          if (m_activeCount > 0)
           {
+              m_activeCount = 1;
               finish();
           }
+
+          if (m_readerStarted)
+          {
+              m_shutdown = true;
+              pthread_join( m_readerThread, NULL );
+          }
+
           if (m_oldStdOut > 0)
               close(m_oldStdOut);
           if (m_oldStdErr > 0)
               close(m_oldStdErr);
+          if (m_nullFd > 0)
+              close(m_nullFd);
           if (m_pipe[READ] > 0)
               close(m_pipe[READ]);
           if (m_pipe[WRITE] > 0)
               close(m_pipe[WRITE]);
+
+          pthread_mutex_destroy(&m_mutex);
       }
 
 
@@ -606,52 +671,121 @@ namespace viennamesh
       {
           if (!m_init)
               return;
-          if (m_capturing)
-              finish();
+
+          // flushing may block on a full pipe, the reader needs the mutex to empty it
           fflush(stdout);
           fflush(stderr);
-          dup2(m_pipe[WRITE], fileno(stdout));
-          dup2(m_pipe[WRITE], fileno(stderr));
 
-          m_capturing = true;
-          thread_running = true;
-          pthread_create( &readerThread, NULL, &reader, (void*) (this));
+          pthread_mutex_lock(&m_mutex);
+
+          if (m_activeCount == 0)
+          {
+              m_discarding = logger().get_log_level<info_tag>() < capture_log_level && m_nullFd > 0;
+
+              if (!m_discarding && !m_readerStarted)
+              {
+                  m_readerStarted = pthread_create( &m_readerThread, NULL, &reader, (void*) (this) ) == 0;
+                  if (!m_readerStarted)
+                  {
+                      pthread_mutex_unlock(&m_mutex);
+                      return;
+                  }
+              }
+
+              int fd = m_discarding ? m_nullFd : m_pipe[WRITE];
+              dup2(fd, fileno(stdout));
+              dup2(fd, fileno(stderr));
+          }
+
+          __sync_add_and_fetch(&m_activeCount, 1);
+          m_activeTags.push_back( thread_tag() ? thread_tag() : "" );
+
+          pthread_mutex_unlock(&m_mutex);
       }
 
       bool finish()
       {
           if (!m_init)
               return false;
-          if (!m_capturing)
-              return false;
+
           fflush(stdout);
           fflush(stderr);
 
-          thread_running = false;
-          pthread_join( readerThread, NULL );
-          m_capturing = false;
+          pthread_mutex_lock(&m_mutex);
+
+          if (m_activeCount == 0)
+          {
+              pthread_mutex_unlock(&m_mutex);
+              return false;
+          }
+
+          // output written so far belongs to the active captures
+          if (!m_discarding)
+              drain();
+
+          // the partial last line is logged while still capturing, the logger then
+          // writes to the old stdout instead of into the pipe
+          bool last = m_activeCount == 1;
+          if (last && !m_discarding)
+              emit_line(m_ringSize);
+
+          std::string tag = thread_tag() ? thread_tag() : "";
+          std::vector<std::string>::iterator it = std::find(m_activeTags.begin(), m_activeTags.end(), tag);
+          if (it != m_activeTags.end())
+              m_activeTags.erase(it);
+          else if (!m_activeTags.empty())
+              m_activeTags.pop_back();
+
+          // the file descriptors are restored before capturing() turns false
+          if (last)
+          {
+              dup2(m_oldStdOut, fileno(stdout));
+              dup2(m_oldStdErr, fileno(stderr));
+          }
 
-          dup2(m_oldStdOut, fileno(stdout));
-          dup2(m_oldStdErr, fileno(stderr));
+          __sync_sub_and_fetch(&m_activeCount, 1);
 
+          pthread_mutex_unlock(&m_mutex);
           return true;
       }
 
-      bool capturing() const { return m_capturing; }
+      // read without m_mutex by logging threads
+      bool capturing() const { return __sync_add_and_fetch(const_cast<int *>(&m_activeCount), 0) > 0; }
       int old_stdout() const { return m_oldStdOut; }
 
-  //   private:
-      pthread_t readerThread;
+      // tag of the calling thread, used to attribute captured output (e.g. the algorithm name)
+      static char const * thread_tag();
+      static void set_thread_tag(char const * tag);
+
+    private:
+
+      // reads everything available from the pipe, m_mutex has to be locked
+      void drain();
+      void push(char const * data, std::size_t size);
+      // logs the first count bytes of the ring buffer, m_mutex has to be locked
+      void emit_line(std::size_t count);
+
+      pthread_t m_readerThread;
+      pthread_mutex_t m_mutex;
 
       enum PIPES { READ, WRITE };
       int m_pipe[2];
 
-      bool thread_running;
-      bool m_capturing;
-      bool m_init;
-
       int m_oldStdOut;
       int m_oldStdErr;
+      int m_nullFd;
+
+      bool m_init;
+      bool m_readerStarted;
+      volatile bool m_shutdown;
+
+      int m_activeCount;
+      bool m_discarding;
+      std::vector<std::string> m_activeTags;
+
+      std::vector<char> m_ring;
+      std::size_t m_ringBegin;
+      std::size_t m_ringSize;
     };
   #else
     class StdCapture
@@ -671,6 +805,10 @@ namespace viennamesh
 
       bool capturing() const { return false; }
       int old_stdout() const { return -1; }
+
+    public:
+      static char const * thread_tag() { return 0; }
+      static void set_thread_tag(char const *) {}
     };
   #endif
 
@@ -681,6 +819,23 @@ namespace viennamesh
       ~StdCaptureHandle() { StdCapture::get().finish(); }
     };
 
+    // sets the capture tag of the calling thread for its lifetime, the tag
+    // is copied so that temporaries can be passed
+    class StdCaptureTag
+    {
+    public:
+      StdCaptureTag(std::string const & tag_) : tag(tag_), previous_tag(StdCapture::thread_tag())
+      { StdCapture::set_thread_tag(tag.c_str()); }
+      ~StdCaptureTag() { StdCapture::set_thread_tag(previous_tag); }
+
+    private:
+      StdCaptureTag(StdCaptureTag const &);
+      StdCaptureTag & operator=(StdCaptureTag const &);
+
+      std::string tag;
+      char const * previous_tag;
+    };
+
 
 
 
@@ -467,6 +467,31 @@ viennamesh_error viennamesh_data_conversion_register(viennamesh_context context,
 }
 
 
+viennamesh_error viennamesh_data_conversion_register_with_cost(viennamesh_context context,
+                                                  const char * data_type_from,
+                                                  const char * data_type_to,
+                                                  viennamesh_data_convert_function convert_function,
+                                                  double cost)
+{
+  if (!context)
+    return VIENNAMESH_ERROR_INVALID_CONTEXT;
+
+  if (!data_type_from || !data_type_to)
+    return VIENNAMESH_ERROR_INVALID_ARGUMENT;
+
+  try
+  {
+    context->register_conversion_function(data_type_from, data_type_to, convert_function, cost);
+  }
+  catch (...)
+  {
+    return viennamesh::handle_error(context);
+  }
+
+  return VIENNAMESH_SUCCESS;
+}
+
+
 viennamesh_error viennamesh_data_wrapper_convert(viennamesh_data_wrapper data_from,
                                     viennamesh_data_wrapper data_to)
 {
@@ -486,6 +511,24 @@ viennamesh_error viennamesh_data_wrapper_convert(viennamesh_data_wrapper data_fr
 }
 
 
+viennamesh_error viennamesh_data_wrapper_invalidate_conversions(viennamesh_data_wrapper data)
+{
+  if (!data)
+    return VIENNAMESH_ERROR_INVALID_ARGUMENT;
+
+  try
+  {
+    data->invalidate_conversions();
+  }
+  catch (...)
+  {
+    return viennamesh::handle_error(data->context());
+  }
+
+  return VIENNAMESH_SUCCESS;
+}
+
+
 viennamesh_error viennamesh_data_wrapper_get_type_name(viennamesh_data_wrapper data,
                                                        const char ** data_type_name)
 {
@@ -1077,6 +1120,17 @@ viennamesh_error viennamesh_log_set_stack_level(int log_level)
 }
 
 
+viennamesh_error viennamesh_log_set_thread_levels(int info_level, int error_level, int warning_level, int debug_level, int stack_level)
+{
+  viennamesh::backend::Logger::set_thread_log_level(viennamesh::backend::info_tag::index, info_level);
+  viennamesh::backend::Logger::set_thread_log_level(viennamesh::backend::error_tag::index, error_level);
+  viennamesh::backend::Logger::set_thread_log_level(viennamesh::backend::warning_tag::index, warning_level);
+  viennamesh::backend::Logger::set_thread_log_level(viennamesh::backend::debug_tag::index, debug_level);
+  viennamesh::backend::Logger::set_thread_log_level(viennamesh::backend::stack_tag::index, stack_level);
+  return VIENNAMESH_SUCCESS;
+}
+
+
 viennamesh_error viennamesh_log_add_logging_file(char const * filename, viennamesh_log_callback_handle * handle)
 {
   if (!filename)
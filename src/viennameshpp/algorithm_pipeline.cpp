@@ -13,8 +13,12 @@
 =============================================================================== */
 
 #include <list>
+#include <map>
+#include <algorithm>
+#include <fstream>
 #include <boost/config/posix_features.hpp>
 #include "viennameshpp/algorithm_pipeline.hpp"
+#include "viennameshpp/thread_pool.hpp"
 
 namespace viennamesh
 {
@@ -344,7 +348,16 @@ namespace viennamesh
 
   bool algorithm_pipeline::run(bool cleanup_after_algorithm_step)
   {
+    std::vector<algorithm_pipeline_element *> elements;
     for (std::list<algorithm_pipeline_element>::iterator it = algorithms.begin(); it != algorithms.end(); ++it)
+      elements.push_back( &(*it) );
+    init_trace(elements);
+
+    viennautils::Timer timer;
+    timer.start();
+
+    std::size_t trace_index = 0;
+    for (std::list<algorithm_pipeline_element>::iterator it = algorithms.begin(); it != algorithms.end(); ++it, ++trace_index)
     {
       algorithm_pipeline_element & pe = *it;
 
@@ -356,8 +369,14 @@ namespace viennamesh
           stack_name += " \"" + pe.name + "\"";
         stack_name += " (type = \"" + pe.algorithm.type() + "\")";
 
+        trace_[trace_index].worker = 0;
+        trace_[trace_index].start_time = timer.get();
+
         viennamesh::LoggingStack stack(stack_name);
-        if (!pe.algorithm.run())
+        bool success = pe.algorithm.run();
+        trace_[trace_index].end_time = timer.get();
+
+        if (!success)
           return false;
       }
 
@@ -386,9 +405,325 @@ namespace viennamesh
     return true;
   }
 
+
+
+
+  namespace
+  {
+    // the netgen and vgmodeler libraries keep their meshing state in globals,
+    // algorithms of these plugins are never run concurrently with each other
+    bool uses_process_wide_state(std::string const & type)
+    {
+      return type.compare(0, 7, "netgen_") == 0 || type.compare(0, 10, "vgmodeler_") == 0;
+    }
+
+    mutex process_wide_state_mutex;
+
+
+    // bookkeeping of a parallel pipeline run, all members are protected by state_mutex
+    class pipeline_scheduler
+    {
+    public:
+
+      pipeline_scheduler(std::vector<algorithm_pipeline_element *> const & elements_in,
+                         std::vector<algorithm_pipeline_trace_entry> & trace_in,
+                         thread_pool & pool_in,
+                         bool cleanup_in) :
+          elements(elements_in), trace(trace_in), pool(pool_in), cleanup(cleanup_in), failed(false),
+          dependents(elements_in.size()), missing_dependencies(elements_in.size(), 0),
+          finished(elements_in.size(), false), cleared(elements_in.size(), false)
+      {
+        for (std::size_t i = 0; i != trace.size(); ++i)
+        {
+          missing_dependencies[i] = trace[i].dependencies.size();
+          for (std::size_t j = 0; j != trace[i].dependencies.size(); ++j)
+            dependents[ trace[i].dependencies[j] ].push_back(i);
+        }
+      }
+
+      bool run()
+      {
+        timer.start();
+
+        {
+          scoped_lock lock(state_mutex);
+          for (std::size_t i = 0; i != elements.size(); ++i)
+          {
+            if (missing_dependencies[i] == 0)
+              pool.submit( boost::bind(&pipeline_scheduler::run_element, this, i) );
+          }
+        }
+
+        try
+        {
+          pool.wait();
+        }
+        catch (viennamesh::exception const & ex)
+        {
+          // run_element only throws outside of the algorithm run, e.g. while clearing data
+          error(1) << "Pipeline scheduling failed: " << ex.what() << std::endl;
+          scoped_lock lock(state_mutex);
+          failed = true;
+        }
+
+        return !failed;
+      }
+
+    private:
+
+      void run_element(std::size_t index)
+      {
+        algorithm_pipeline_element & pe = *elements[index];
+
+        {
+          scoped_lock lock(state_mutex);
+          trace[index].worker = pool.current_worker();
+          trace[index].start_time = timer.get();
+        }
+
+        // the log levels of the element only apply to the worker running it
+        viennamesh_log_set_thread_levels(pe.info_log_level, pe.error_log_level, pe.warning_log_level,
+                                         pe.debug_log_level, pe.stack_log_level);
+
+        bool success = false;
+        try
+        {
+          info(5) << "Running algorithm \"" << trace[index].name << "\" (type = \"" << trace[index].type << "\") on worker " << trace[index].worker << std::endl;
+          if (uses_process_wide_state(trace[index].type))
+          {
+            scoped_lock lock(process_wide_state_mutex);
+            success = pe.algorithm.run();
+          }
+          else
+            success = pe.algorithm.run();
+        }
+        catch (viennamesh::exception const & ex)
+        {
+          error(1) << "Algorithm \"" << trace[index].name << "\" failed: " << ex.what() << std::endl;
+        }
+        catch (std::exception const & ex)
+        {
+          error(1) << "Algorithm \"" << trace[index].name << "\" failed: " << ex.what() << std::endl;
+        }
+        catch (...)
+        {
+          error(1) << "Algorithm \"" << trace[index].name << "\" failed" << std::endl;
+        }
+
+        viennamesh_log_set_thread_levels(-1, -1, -1, -1, -1);
+
+        std::vector<algorithm_pipeline_element *> to_clear;
+
+        {
+          scoped_lock lock(state_mutex);
+
+          trace[index].end_time = timer.get();
+          finished[index] = true;
+
+          info(5) << "Finished algorithm \"" << trace[index].name << "\" (took " << trace[index].duration() << "sec)" << std::endl;
+
+          if (!success)
+          {
+            failed = true;
+            return;
+          }
+
+          if (cleanup)
+          {
+            for (std::size_t i = 0; i != pe.referenced_elements.size(); ++i)
+              --(pe.referenced_elements[i]->reference_count);
+
+            if (pe.reference_count <= 0)
+            {
+              cleared[index] = true;
+              to_clear.push_back(&pe);
+            }
+
+            for (std::size_t i = 0; i != trace[index].dependencies.size(); ++i)
+            {
+              std::size_t dependency = trace[index].dependencies[i];
+              if (finished[dependency] && !cleared[dependency] && elements[dependency]->reference_count <= 0)
+              {
+                cleared[dependency] = true;
+                to_clear.push_back( elements[dependency] );
+              }
+            }
+          }
+
+          if (!failed)
+          {
+            for (std::size_t i = 0; i != dependents[index].size(); ++i)
+            {
+              std::size_t dependent = dependents[index][i];
+              if (--missing_dependencies[dependent] == 0)
+                pool.submit( boost::bind(&pipeline_scheduler::run_element, this, dependent) );
+            }
+          }
+        }
+
+        // no running algorithm references these elements anymore
+        for (std::size_t i = 0; i != to_clear.size(); ++i)
+        {
+          to_clear[i]->algorithm.clear_inputs();
+          to_clear[i]->algorithm.clear_outputs();
+        }
+      }
+
+      std::vector<algorithm_pipeline_element *> const & elements;
+      std::vector<algorithm_pipeline_trace_entry> & trace;
+      thread_pool & pool;
+      bool cleanup;
+      bool failed;
+
+      std::vector< std::vector<std::size_t> > dependents;
+      std::vector<std::size_t> missing_dependencies;
+      std::vector<bool> finished;
+      std::vector<bool> cleared;
+
+      viennautils::Timer timer;
+      mutex state_mutex;
+    };
+  }
+
+
+  bool algorithm_pipeline::run_parallel(int worker_count, bool cleanup_after_algorithm_step)
+  {
+    std::vector<algorithm_pipeline_element *> elements;
+    for (std::list<algorithm_pipeline_element>::iterator it = algorithms.begin(); it != algorithms.end(); ++it)
+      elements.push_back( &(*it) );
+    init_trace(elements);
+
+    if (worker_count <= 0)
+      worker_count = hardware_concurrency();
+
+    viennamesh::LoggingStack stack("Running pipeline with " + lexical_cast<std::string>(worker_count) + " worker(s)");
+
+    thread_pool pool(worker_count);
+    pipeline_scheduler scheduler(elements, trace_, pool, cleanup_after_algorithm_step);
+    return scheduler.run();
+  }
+
+
+  void algorithm_pipeline::init_trace(std::vector<algorithm_pipeline_element *> const & elements)
+  {
+    std::map<algorithm_pipeline_element const *, std::size_t> element_indices;
+    for (std::size_t i = 0; i != elements.size(); ++i)
+      element_indices[ elements[i] ] = i;
+
+    trace_.clear();
+    trace_.resize( elements.size() );
+    for (std::size_t i = 0; i != elements.size(); ++i)
+    {
+      trace_[i].name = elements[i]->name;
+      trace_[i].type = elements[i]->algorithm.type();
+
+      for (std::size_t j = 0; j != elements[i]->referenced_elements.size(); ++j)
+      {
+        std::size_t dependency = element_indices[ elements[i]->referenced_elements[j] ];
+        if ( std::find(trace_[i].dependencies.begin(), trace_[i].dependencies.end(), dependency) == trace_[i].dependencies.end() )
+          trace_[i].dependencies.push_back(dependency);
+      }
+    }
+  }
+
+
+  std::vector<std::size_t> algorithm_pipeline::critical_path() const
+  {
+    // elements can only reference previously added elements, so the trace order is a topological order
+    std::vector<double> path_length( trace_.size(), 0.0 );
+    std::vector<int> predecessor( trace_.size(), -1 );
+
+    int last = -1;
+    for (std::size_t i = 0; i != trace_.size(); ++i)
+    {
+      if (trace_[i].end_time < 0.0)
+        continue;
+
+      for (std::size_t j = 0; j != trace_[i].dependencies.size(); ++j)
+      {
+        std::size_t dependency = trace_[i].dependencies[j];
+        if (predecessor[i] < 0 || path_length[dependency] > path_length[predecessor[i]])
+          predecessor[i] = dependency;
+      }
+
+      path_length[i] = trace_[i].duration();
+      if (predecessor[i] >= 0)
+        path_length[i] += path_length[predecessor[i]];
+
+      if (last < 0 || path_length[i] > path_length[last])
+        last = i;
+    }
+
+    std::vector<std::size_t> path;
+    for (int i = last; i >= 0; i = predecessor[i])
+      path.push_back(i);
+    std::reverse(path.begin(), path.end());
+
+    return path;
+  }
+
+
+  void algorithm_pipeline::log_trace() const
+  {
+    viennamesh::LoggingStack stack("Pipeline trace");
+
+    for (std::size_t i = 0; i != trace_.size(); ++i)
+    {
+      if (trace_[i].end_time < 0.0)
+        continue;
+
+      info(5) << "\"" << trace_[i].name << "\" (type = \"" << trace_[i].type << "\") worker " << trace_[i].worker
+              << ": start " << trace_[i].start_time << "sec, took " << trace_[i].duration() << "sec" << std::endl;
+    }
+
+    std::vector<std::size_t> path = critical_path();
+    if (path.empty())
+      return;
+
+    double critical_time = 0.0;
+    std::stringstream ss;
+    for (std::size_t i = 0; i != path.size(); ++i)
+    {
+      if (i != 0)
+        ss << " -> ";
+      ss << "\"" << trace_[path[i]].name << "\"";
+      critical_time += trace_[path[i]].duration();
+    }
+
+    info(5) << "Critical path (" << critical_time << "sec): " << ss.str() << std::endl;
+  }
+
+
+  bool algorithm_pipeline::write_trace(std::string const & filename) const
+  {
+    std::ofstream file( filename.c_str() );
+    if (!file)
+    {
+      error(1) << "Could not open trace file \"" << filename << "\"" << std::endl;
+      return false;
+    }
+
+    std::vector<std::size_t> path = critical_path();
+    std::vector<bool> on_critical_path( trace_.size(), false );
+    for (std::size_t i = 0; i != path.size(); ++i)
+      on_critical_path[ path[i] ] = true;
+
+    file << "name;type;worker;start;end;duration;critical" << std::endl;
+    for (std::size_t i = 0; i != trace_.size(); ++i)
+    {
+      file << trace_[i].name << ";" << trace_[i].type << ";" << trace_[i].worker << ";"
+           << trace_[i].start_time << ";" << trace_[i].end_time << ";" << trace_[i].duration() << ";"
+           << (on_critical_path[i] ? 1 : 0) << std::endl;
+    }
+
+    return true;
+  }
+
+
   void algorithm_pipeline::clear()
   {
     algorithms.clear();
+    trace_.clear();
   }
 
 
@@ -57,10 +57,11 @@ namespace viennamesh
 
   void context_handle::register_conversion(std::string const & data_type_from,
                                            std::string const & data_type_to,
-                                           viennamesh_data_convert_function convert_function)
+                                           viennamesh_data_convert_function convert_function,
+                                           double cost)
   {
     handle_error(
-      viennamesh_data_conversion_register(ctx, data_type_from.c_str(), data_type_to.c_str(), convert_function),
+      viennamesh_data_conversion_register_with_cost(ctx, data_type_from.c_str(), data_type_to.c_str(), convert_function, cost),
       ctx);
   }
 
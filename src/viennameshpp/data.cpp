@@ -45,6 +45,11 @@ namespace viennamesh
     handle_error(viennamesh_data_wrapper_resize(data, size_), data);
   }
 
+  void abstract_data_handle::invalidate_conversions()
+  {
+    handle_error(viennamesh_data_wrapper_invalidate_conversions(data), data);
+  }
+
   viennamesh_data_wrapper abstract_data_handle::internal() const
   {
     return const_cast<viennamesh_data_wrapper>(data);
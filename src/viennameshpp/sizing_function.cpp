@@ -1,3 +1,8 @@
+#include <map>
+#include <list>
+#include <algorithm>
+#include <cstdlib>
+
 #include "viennameshpp/sizing_function.hpp"
 
 #include "viennamesh/cpp_error.hpp"
@@ -7,6 +12,10 @@
 #include "viennagrid/algorithm/geometry.hpp"
 #include "viennagrid/io/vtk_reader.hpp"
 
+#include <boost/weak_ptr.hpp>
+
+#include <sys/stat.h>
+
 
 namespace viennamesh
 {
@@ -24,6 +33,25 @@ namespace viennamesh
     NumericType s1 = accessor_field.get(viennagrid::vertices(element)[1]);
     NumericType s2 = accessor_field.get(viennagrid::vertices(element)[2]);
 
+    if (viennagrid::vertices(element).size() == 4)
+    {
+      // tetrahedron: the gradient g solves (pi-p0) * g = si-s0 for i = 1,2,3
+      PointType p3 = viennagrid::get_point( viennagrid::vertices(element)[3] );
+      NumericType s3 = accessor_field.get(viennagrid::vertices(element)[3]);
+
+      PointType p10 = p1-p0;
+      PointType p20 = p2-p0;
+      PointType p30 = p3-p0;
+
+      PointType n1 = viennagrid::cross_prod(p20, p30);
+      PointType n2 = viennagrid::cross_prod(p30, p10);
+      PointType n3 = viennagrid::cross_prod(p10, p20);
+
+      NumericType det = viennagrid::inner_prod(p10, n1);
+
+      PointType g = (n1*(s1-s0) + n2*(s2-s0) + n3*(s3-s0)) / det;
+      return std::abs(g[0]) + std::abs(g[1]) + std::abs(g[2]);
+    }
 
     PointType p10 = p1-p0;
     PointType p20 = p2-p0;
@@ -52,38 +80,40 @@ namespace viennamesh
   }
 
 
-
-  template<typename PointT, typename RegionT>
-  typename viennagrid::result_of::coord<PointT>::type distance_to_interface(PointT const & point,
-                                                                            RegionT const & reg0,
-                                                                            RegionT const & reg1,
-                                                                            viennagrid_dimension topologic_dimension)
+  // linear interpolation of a vertex quantity inside a triangle or tetrahedron
+  template<typename ElementT, typename PointT, typename AccessorFieldT>
+  typename viennagrid::result_of::coord<ElementT>::type interpolate( ElementT const & element, PointT const & pt, AccessorFieldT const & accessor_field )
   {
-    typedef typename viennagrid::result_of::const_element_range<RegionT>::type ConstElementRangeType;
-    typedef typename viennagrid::result_of::iterator<ConstElementRangeType>::type ConstElementIteratorType;
-
-    typedef typename viennagrid::result_of::coord<RegionT>::type CoordType;
+    typedef typename viennagrid::result_of::point<ElementT>::type PointType;
+    typedef typename viennagrid::result_of::coord<ElementT>::type NumericType;
 
-    ConstElementRangeType elements(reg0, topologic_dimension);
-    if (elements.empty())
-      return CoordType();
+    PointType p0 = viennagrid::get_point( viennagrid::vertices(element)[0] );
+    PointType p1 = viennagrid::get_point( viennagrid::vertices(element)[1] );
+    PointType p2 = viennagrid::get_point( viennagrid::vertices(element)[2] );
 
-    CoordType min_distance = -1;
+    NumericType s0 = accessor_field.get(viennagrid::vertices(element)[0]);
+    NumericType s1 = accessor_field.get(viennagrid::vertices(element)[1]);
+    NumericType s2 = accessor_field.get(viennagrid::vertices(element)[2]);
 
-    for (ConstElementIteratorType eit = elements.begin(); eit != elements.end(); ++eit)
+    if (viennagrid::vertices(element).size() == 4)
     {
-      if (is_boundary(reg1, *eit))
-      {
-        CoordType current_distance = viennagrid::distance(point, *eit);
+      PointType p3 = viennagrid::get_point( viennagrid::vertices(element)[3] );
+      NumericType s3 = accessor_field.get(viennagrid::vertices(element)[3]);
 
-        if (min_distance < 0)
-          min_distance = current_distance;
-        else if (current_distance < min_distance)
-          min_distance = current_distance;
-      }
+      // six times the volumes of the sub-tetrahedra opposite to each vertex
+      NumericType f0 = std::abs( viennagrid::inner_prod(p1-pt, viennagrid::cross_prod(p2-pt, p3-pt)) );
+      NumericType f1 = std::abs( viennagrid::inner_prod(p0-pt, viennagrid::cross_prod(p2-pt, p3-pt)) );
+      NumericType f2 = std::abs( viennagrid::inner_prod(p0-pt, viennagrid::cross_prod(p1-pt, p3-pt)) );
+      NumericType f3 = std::abs( viennagrid::inner_prod(p0-pt, viennagrid::cross_prod(p1-pt, p2-pt)) );
+
+      return (s0*f0 + s1*f1 + s2*f2 + s3*f3) / (f0 + f1 + f2 + f3);
     }
 
-    return min_distance;
+    NumericType f0 = viennagrid::spanned_volume( pt, p1, p2 );
+    NumericType f1 = viennagrid::spanned_volume( p0, pt, p2 );
+    NumericType f2 = viennagrid::spanned_volume( p0, p1, pt );
+
+    return (s0*f0 + s1*f1 + s2*f2) / (f0 + f1 + f2);
   }
 
 
@@ -91,20 +121,82 @@ namespace viennamesh
   namespace sizing_function
   {
 
+    namespace
+    {
+      // Start cell hints of point locations, consecutive queries are usually close to
+      // each other. Every thread has a small direct mapped table keyed by the locating
+      // object, so concurrent queries never share a hint. A hint may belong to a
+      // destroyed object at the same address, users have to check its range.
+      struct location_hint
+      {
+        void const * owner;
+        long hit;
+      };
+
+      const std::size_t location_hint_count = 16;
+      VIENNAMESH_THREAD_LOCAL location_hint location_hints[location_hint_count];
+
+      location_hint & location_hint_slot(void const * owner)
+      {
+        return location_hints[ (reinterpret_cast<std::size_t>(owner) >> 4) % location_hint_count ];
+      }
+
+      long get_location_hint(void const * owner)
+      {
+        location_hint const & hint = location_hint_slot(owner);
+        return hint.owner == owner ? hint.hit : -1;
+      }
+
+      void set_location_hint(void const * owner, long hit)
+      {
+        location_hint & hint = location_hint_slot(owner);
+        hint.owner = owner;
+        hint.hit = hit;
+      }
+    }
+
+
+    fast_is_inside::fast_is_inside(MeshType const & mesh_,
+                    std::vector<int> const & counts_,
+                    double mesh_bounding_box_scale, double cell_scale) : mesh(mesh_)
+    {
+      init(counts_, mesh_bounding_box_scale, cell_scale);
+    }
+
     fast_is_inside::fast_is_inside(MeshType const & mesh_,
                     int count_x_, int count_y_,
-                    double mesh_bounding_box_scale, double cell_scale) :
-        mesh(mesh_), count_x(count_x_), count_y(count_y_)
+                    double mesh_bounding_box_scale, double cell_scale) : mesh(mesh_)
     {
+      std::vector<int> counts_;
+      counts_.push_back(count_x_);
+      counts_.push_back(count_y_);
+      init(counts_, mesh_bounding_box_scale, cell_scale);
+    }
+
+
+    void fast_is_inside::init(std::vector<int> const & counts_,
+                              double mesh_bounding_box_scale, double cell_scale)
+    {
+      typedef viennagrid::result_of::cell_range<MeshType>::type CellRangeType;
+      typedef viennagrid::result_of::iterator<CellRangeType>::type CellRangeIterator;
+
+      typedef viennagrid::result_of::neighbor_range<MeshType>::type NeighborRangeType;
+      typedef viennagrid::result_of::iterator<NeighborRangeType>::type NeighborRangeIterator;
+
+      if (counts_.empty())
+        VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "fast_is_inside: No grid resolution specified" );
+
       // ensure that bounding box is large enough
       if (mesh_bounding_box_scale <= 1.0)
         mesh_bounding_box_scale = 1.01;
       mesh_bounding_box_scale *= cell_scale;
 
-      grid_elements.resize(count_x*count_y);
+      int dimension = viennagrid::geometric_dimension(mesh);
 
-      typedef viennagrid::result_of::cell_range<MeshType>::type CellRangeType;
-      typedef viennagrid::result_of::iterator<CellRangeType>::type CellRangeIterator;
+      counts = counts_;
+      counts.resize(dimension, counts_.back());
+      for (int d = 0; d != dimension; ++d)
+        counts[d] = std::max(counts[d], 1);
 
       std::pair<PointType, PointType> bb = viennagrid::bounding_box(mesh);
       min = bb.first;
@@ -113,31 +205,118 @@ namespace viennamesh
       min = (min+max)/2.0 + (min-max)/2.0 * mesh_bounding_box_scale;
       max = (min+max)/2.0 + (max-min)/2.0 * mesh_bounding_box_scale;
 
-      CellRangeType cells(mesh);
-      for (CellRangeIterator cit = cells.begin(); cit != cells.end(); ++cit)
+      // flat axes (e.g. a planar mesh in 3D) get a single layer of buckets
+      for (int d = 0; d != dimension; ++d)
+      {
+        if (max[d] <= min[d])
+        {
+          counts[d] = 1;
+          max[d] = min[d] + 1.0;
+        }
+      }
+
+
+      // dense cell indices
+      CellRangeType cell_range(mesh);
+      cells.reserve( cell_range.size() );
+
+      std::vector<long> dense_index;
+      for (CellRangeIterator cit = cell_range.begin(); cit != cell_range.end(); ++cit)
+      {
+        std::size_t id = (*cit).id().index();
+        if (id >= dense_index.size())
+          dense_index.resize(id+1, -1);
+        dense_index[id] = cells.size();
+        cells.push_back(*cit);
+      }
+
+      // facet neighbours for the walk from the last hit cell
+      neighbor_offsets.reserve( cells.size()+1 );
+      neighbor_offsets.push_back(0);
+      for (std::size_t i = 0; i != cells.size(); ++i)
       {
-        std::pair<PointType, PointType> bb = viennagrid::bounding_box(*cit);
+        NeighborRangeType neighbors(mesh, cells[i], viennagrid::facet_dimension(mesh), viennagrid::cell_dimension(mesh));
+        for (NeighborRangeIterator nit = neighbors.begin(); nit != neighbors.end(); ++nit)
+          neighbor_cells.push_back( dense_index[(*nit).id().index()] );
+        neighbor_offsets.push_back( neighbor_cells.size() );
+      }
+
+
+      // grid buckets, the first pass counts the cells per bucket, the second one fills them
+      std::size_t bucket_count = 1;
+      for (int d = 0; d != dimension; ++d)
+        bucket_count *= counts[d];
+
+      std::vector<int> lower( cells.size()*dimension );
+      std::vector<int> upper( cells.size()*dimension );
+
+      for (std::size_t i = 0; i != cells.size(); ++i)
+      {
+        std::pair<PointType, PointType> bb = viennagrid::bounding_box(cells[i]);
 
         bb.first = (bb.first+bb.second)/2.0 + (bb.first-bb.second)/2.0 * cell_scale;
         bb.second = (bb.first+bb.second)/2.0 + (bb.second-bb.first)/2.0 * cell_scale;
 
-        int min_index_x = index_x(bb.first);
-        int max_index_x = index_x(bb.second)+1;
-
-        int min_index_y = index_y(bb.first);
-        int max_index_y = index_y(bb.second)+1;
+        for (int d = 0; d != dimension; ++d)
+        {
+          lower[i*dimension+d] = index(bb.first, d);
+          upper[i*dimension+d] = index(bb.second, d)+1;
 
-        assert(min_index_x >= 0 && min_index_x <= count_x);
-        assert(max_index_x >= 0 && max_index_x <= count_x);
+          assert(lower[i*dimension+d] >= 0 && lower[i*dimension+d] <= counts[d]);
+          assert(upper[i*dimension+d] >= 0 && upper[i*dimension+d] <= counts[d]);
+        }
+      }
 
-        assert(min_index_y >= 0 && min_index_y <= count_y);
-        assert(max_index_y >= 0 && max_index_y <= count_y);
+      bucket_offsets.assign( bucket_count+1, 0 );
+      for (int pass = 0; pass != 2; ++pass)
+      {
+        if (pass == 1)
+        {
+          // prefix sum, bucket_offsets[i+1] is the insert position of bucket i in the second pass
+          for (std::size_t i = 1; i != bucket_offsets.size(); ++i)
+            bucket_offsets[i] += bucket_offsets[i-1];
+          bucket_cells.resize( bucket_offsets.back() );
+          for (std::size_t i = bucket_offsets.size()-1; i != 0; --i)
+            bucket_offsets[i] = bucket_offsets[i-1];
+          bucket_offsets[0] = 0;
+        }
 
-        for (int y = min_index_y; y != max_index_y; ++y)
+        std::vector<int> position(dimension);
+        for (std::size_t i = 0; i != cells.size(); ++i)
         {
-          for (int x = min_index_x; x != max_index_x; ++x)
+          int const * cell_lower = &lower[i*dimension];
+          int const * cell_upper = &upper[i*dimension];
+
+          bool empty = false;
+          for (int d = 0; d != dimension; ++d)
           {
-            grid_elements[y*count_x+x].push_back( *cit );
+            position[d] = cell_lower[d];
+            empty = empty || (cell_lower[d] >= cell_upper[d]);
+          }
+          if (empty)
+            continue;
+
+          // iterate over all buckets in [cell_lower, cell_upper)
+          while (true)
+          {
+            std::size_t bucket = 0;
+            for (int d = dimension-1; d >= 0; --d)
+              bucket = bucket*counts[d] + position[d];
+
+            if (pass == 0)
+              ++bucket_offsets[bucket+1];
+            else
+              bucket_cells[ bucket_offsets[bucket+1]++ ] = i;
+
+            int d = 0;
+            for (; d != dimension; ++d)
+            {
+              if (++position[d] != cell_upper[d])
+                break;
+              position[d] = cell_lower[d];
+            }
+            if (d == dimension)
+              break;
           }
         }
       }
@@ -148,108 +327,412 @@ namespace viennamesh
     fast_is_inside::ElementContainerType fast_is_inside::operator()(PointType const & p) const
     {
       ElementContainerType fast_result;
+
+      int i = index(p);
+      if (i >= 0)
+      {
+        for (std::size_t j = bucket_offsets[i]; j != bucket_offsets[i+1]; ++j)
+        {
+          if ( viennagrid::is_inside(cells[bucket_cells[j]], p) )
+            fast_result.push_back(cells[bucket_cells[j]]);
+        }
+      }
+
+      return fast_result;
+    }
+
+
+    long fast_is_inside::locate_index(PointType const & p, long start) const
+    {
+      if (start >= 0 && start < static_cast<long>(cells.size()))
       {
-        int i = index(p);
+        if ( viennagrid::is_inside(cells[start], p) )
+          return start;
 
-        if (i >= 0 && i < static_cast<int>(grid_elements.size()))
+        for (std::size_t j = neighbor_offsets[start]; j != neighbor_offsets[start+1]; ++j)
         {
-          ElementContainerType const & tmp = grid_elements[i];
-          for (ElementContainerType::const_iterator cit = tmp.begin(); cit != tmp.end(); ++cit)
+          if ( viennagrid::is_inside(cells[neighbor_cells[j]], p) )
+            return neighbor_cells[j];
+        }
+      }
+
+      int i = index(p);
+      if (i >= 0)
+      {
+        for (std::size_t j = bucket_offsets[i]; j != bucket_offsets[i+1]; ++j)
+        {
+          if ( viennagrid::is_inside(cells[bucket_cells[j]], p) )
+            return bucket_cells[j];
+        }
+      }
+
+      return -1;
+    }
+
+
+    optional<fast_is_inside::ElementType> fast_is_inside::locate(PointType const & p) const
+    {
+      long hit = locate_index(p, get_location_hint(this));
+      if (hit < 0)
+        return optional<ElementType>();
+
+      set_location_hint(this, hit);
+      return cells[hit];
+    }
+
+
+    void fast_is_inside::locate(std::size_t count, int dimension, CoordType const * coords, long * cell_indices) const
+    {
+      PointType pt(dimension);
+
+      long hint = get_location_hint(this);
+      for (std::size_t i = 0; i != count; ++i)
+      {
+        for (int d = 0; d != dimension; ++d)
+          pt[d] = coords[d*count+i];
+
+        cell_indices[i] = locate_index(pt, hint);
+        if (cell_indices[i] >= 0)
+          hint = cell_indices[i];
+      }
+
+      if (hint >= 0)
+        set_location_hint(this, hint);
+    }
+
+
+
+
+
+
+
+    namespace
+    {
+      std::size_t default_background_mesh_cache_size()
+      {
+        char const * size = getenv("VIENNAMESH_BACKGROUND_MESH_CACHE_SIZE");
+        if (size)
+        {
+          try
           {
-            if ( viennagrid::is_inside(*cit, p) )
-            {
-              fast_result.push_back(*cit);
-            }
+            return lexical_cast<std::size_t>(size) * 1024 * 1024;
           }
+          catch (boost::bad_lexical_cast const &) {}
         }
+
+        return 512 * 1024 * 1024;
       }
 
-      return fast_result;
+      // file name, modification time and size identify the content of a background mesh file
+      std::string background_mesh_key(std::string const & filename)
+      {
+        struct stat info;
+        if (stat(filename.c_str(), &info) != 0)
+          return filename;
+
+        std::stringstream ss;
+        ss << filename << "\n" << info.st_mtime;
+#if defined(__linux__)
+        ss << "." << info.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+        ss << "." << info.st_mtimespec.tv_nsec;
+#endif
+        ss << "\n" << info.st_size;
+        return ss.str();
+      }
+
+      mutex background_meshes_mutex;
+      // every background mesh in use or cached
+      std::map< std::string, boost::weak_ptr<background_mesh> > background_meshes;
+      // cached background meshes, most recently used first
+      std::list< shared_ptr<background_mesh> > recent_background_meshes;
+      std::size_t background_mesh_cache_size = default_background_mesh_cache_size();
+
+      // evicts least recently used meshes until the cache fits, background_meshes_mutex has to be locked,
+      // the memory sizes are read without locking the meshes
+      void shrink_background_mesh_cache()
+      {
+        std::size_t total_size = 0;
+        std::list< shared_ptr<background_mesh> >::iterator it = recent_background_meshes.begin();
+        for (; it != recent_background_meshes.end(); ++it)
+        {
+          total_size += (*it)->memory_size();
+          if (total_size > background_mesh_cache_size)
+            break;
+        }
+        recent_background_meshes.erase( it, recent_background_meshes.end() );
+
+        // meshes neither cached nor used by a functor anymore
+        for (std::map< std::string, boost::weak_ptr<background_mesh> >::iterator mit = background_meshes.begin(); mit != background_meshes.end();)
+        {
+          if (mit->second.expired())
+            background_meshes.erase(mit++);
+          else
+            ++mit;
+        }
+      }
+
+      // memory of a background mesh changed, the cache may have to evict meshes
+      void background_mesh_grown()
+      {
+        scoped_lock lock(background_meshes_mutex);
+        shrink_background_mesh_cache();
+      }
     }
 
+    shared_ptr<background_mesh> background_mesh::get(std::string const & filename)
+    {
+      std::string key = background_mesh_key(filename);
 
+      shared_ptr<background_mesh> result;
+      {
+        scoped_lock lock(background_meshes_mutex);
 
+        result = background_meshes[key].lock();
+        if (!result)
+        {
+          result.reset( new background_mesh(filename) );
+          background_meshes[key] = result;
+        }
+        else
+        {
+          std::list< shared_ptr<background_mesh> >::iterator it = std::find(recent_background_meshes.begin(), recent_background_meshes.end(), result);
+          if (it != recent_background_meshes.end())
+            recent_background_meshes.erase(it);
+        }
 
+        recent_background_meshes.push_front(result);
+      }
 
+      // concurrent requests of the same mesh wait in load for the first one
+      result->load();
+      background_mesh_grown();
 
+      return result;
+    }
 
-    mesh_quantity_functor::mesh_quantity_functor( std::string const & filename,
-                            std::string const & quantity_name,
-                            int resolution_x, int resolution_y,
-                            double mesh_bounding_box_scale, double cell_scale)
+    std::size_t background_mesh::cache_size()
+    {
+      scoped_lock lock(background_meshes_mutex);
+      return background_mesh_cache_size;
+    }
+
+    void background_mesh::set_cache_size(std::size_t bytes)
     {
+      scoped_lock lock(background_meshes_mutex);
+      background_mesh_cache_size = bytes;
+      shrink_background_mesh_cache();
+    }
+
+    background_mesh::background_mesh(std::string const & filename_) : filename(filename_), loaded_(false), memory_size_(0) {}
+
+    void background_mesh::load()
+    {
+      scoped_lock lock(mutex_);
+      if (loaded_)
+        return;
+
+      // read into locals, a failed read leaves no partial mesh behind and can be retried
+      MeshType mesh;
       viennagrid::io::vtk_reader<MeshType> reader;
-      viennagrid::io::add_scalar_data_on_vertices( reader, quantities, quantity_name );
       reader( mesh, filename );
 
-      ii = make_shared<fast_is_inside>( mesh, resolution_x, resolution_y, mesh_bounding_box_scale, cell_scale );
+      // all scalar vertex quantities are kept, the file is read only once
+      std::map<std::string, QuantityFieldType> quantities;
+      std::vector<QuantityFieldType> quantity_fields = reader.quantity_fields();
+      for (std::size_t i = 0; i != quantity_fields.size(); ++i)
+      {
+        if (quantity_fields[i].topologic_dimension() == 0 && quantity_fields[i].values_per_quantity() == 1)
+          quantities[ quantity_fields[i].get_name() ] = quantity_fields[i];
+      }
+
+      mesh_ = mesh;
+      vertex_quantities.swap(quantities);
+
+      // rough estimate: coordinates and vertex handles of vertices, vertex indices of cells
+      std::size_t vertex_count = viennagrid::vertices(mesh_).size();
+      std::size_t cell_count = viennagrid::cells(mesh_).size();
+      add_memory_size( vertex_count * (viennagrid::geometric_dimension(mesh_)*sizeof(viennagrid_numeric) + 4*sizeof(viennagrid_int)) +
+                       cell_count * (viennagrid::cell_dimension(mesh_)+1) * 2*sizeof(viennagrid_int) +
+                       vertex_quantities.size() * vertex_count * sizeof(viennagrid_numeric) );
+      loaded_ = true;
     }
 
+    std::size_t background_mesh::memory_size() const
+    {
+      return __sync_add_and_fetch( const_cast<std::size_t *>(&memory_size_), 0 );
+    }
 
-    mesh_quantity_functor::result_type mesh_quantity_functor::operator()( PointType const & pt ) const
+    void background_mesh::add_memory_size(std::size_t bytes)
     {
-      fast_is_inside::ElementContainerType cells = (*ii)(pt);
-      if (cells.empty())
-        return result_type();
+      __sync_add_and_fetch(&memory_size_, bytes);
+    }
 
-      ElementType cell = cells[0];
-      PointType p0 = viennagrid::get_point( viennagrid::vertices(cell)[0] );
-      PointType p1 = viennagrid::get_point( viennagrid::vertices(cell)[1] );
-      PointType p2 = viennagrid::get_point( viennagrid::vertices(cell)[2] );
 
-      CoordType f0 = viennagrid::spanned_volume( pt, p1, p2 );
-      CoordType f1 = viennagrid::spanned_volume( p0, pt, p2 );
-      CoordType f2 = viennagrid::spanned_volume( p0, p1, pt );
+    background_mesh::QuantityFieldType const & background_mesh::vertex_quantity(std::string const & quantity_name)
+    {
+      // vertex_quantities is not modified after loading, no lock needed
+      std::map<std::string, QuantityFieldType>::const_iterator it = vertex_quantities.find(quantity_name);
+      if (it == vertex_quantities.end())
+        VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Background mesh \"" + filename + "\" has no scalar vertex quantity \"" + quantity_name + "\"" );
 
-      CoordType s0 = quantities.get(viennagrid::vertices(cell)[0]);
-      CoordType s1 = quantities.get(viennagrid::vertices(cell)[1]);
-      CoordType s2 = quantities.get(viennagrid::vertices(cell)[2]);
+      return it->second;
+    }
 
-      CoordType val = (s0*f0 + s1*f1 + s2*f2) / (f0 + f1 + f2);
 
-      return val;
+    background_mesh::QuantityFieldType const & background_mesh::cell_gradient(std::string const & quantity_name)
+    {
+      typedef viennagrid::result_of::const_cell_range<MeshType>::type       ConstCellRangeType;
+      typedef viennagrid::result_of::iterator<ConstCellRangeType>::type     ConstCellIteratorType;
+
+      QuantityFieldType const & quantities = vertex_quantity(quantity_name);
+
+      QuantityFieldType const * result;
+      {
+        scoped_lock lock(mutex_);
+
+        std::map<std::string, QuantityFieldType>::iterator it = cell_gradients.find(quantity_name);
+        if (it != cell_gradients.end())
+          return it->second;
+
+        QuantityFieldType & gradient_accessor = cell_gradients[quantity_name];
+
+        ConstCellRangeType cells(mesh_);
+
+        gradient_accessor.init(viennagrid::cell_dimension(mesh_), 1);
+        gradient_accessor.resize( cells.size() );
+
+        for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+          gradient_accessor.set(*cit, viennamesh::gradient(*cit, quantities));
+
+        result = &gradient_accessor;
+        add_memory_size( cells.size() * sizeof(viennagrid_numeric) );
+      }
+
+      background_mesh_grown();
+      return *result;
     }
 
 
+    shared_ptr<fast_is_inside> background_mesh::locator(std::vector<int> const & resolution,
+                                                        double mesh_bounding_box_scale, double cell_scale)
+    {
+      std::stringstream ss;
+      for (std::size_t i = 0; i != resolution.size(); ++i)
+        ss << resolution[i] << ";";
+      ss << mesh_bounding_box_scale << ";" << cell_scale;
 
+      shared_ptr<fast_is_inside> result;
+      {
+        scoped_lock lock(mutex_);
 
+        shared_ptr<fast_is_inside> & locator = locators[ss.str()];
+        if (locator)
+          return locator;
 
+        locator = make_shared<fast_is_inside>( mesh_, resolution, mesh_bounding_box_scale, cell_scale );
+        result = locator;
+        add_memory_size( result->memory_size() );
+      }
 
+      background_mesh_grown();
+      return result;
+    }
 
 
-    mesh_gradient_functor::mesh_gradient_functor( std::string const & filename, std::string const & quantity_name,
-                            int resolution_x, int resolution_y,
-                            double mesh_bounding_box_scale, double cell_scale )
+
+
+
+
+
+    mesh_quantity_functor::mesh_quantity_functor( std::string const & filename,
+                            std::string const & quantity_name,
+                            std::vector<int> const & resolution,
+                            double mesh_bounding_box_scale, double cell_scale)
     {
-      QuantityFieldType quantities;
-      viennagrid::io::vtk_reader<MeshType> reader;
-      viennagrid::io::add_scalar_data_on_vertices( reader, quantities, quantity_name );
-      reader( mesh, filename );
+      background = background_mesh::get(filename);
+      quantities = &background->vertex_quantity(quantity_name);
+      ii = background->locator( resolution, mesh_bounding_box_scale, cell_scale );
+    }
 
-      ConstCellRangeType cells(mesh);
 
-      gradient_accessor.init(viennagrid::cell_dimension(mesh), 1);
-      gradient_accessor.resize( cells.size() );
+    mesh_quantity_functor::result_type mesh_quantity_functor::operator()( PointType const & pt ) const
+    {
+      optional<ElementType> cell = ii->locate(pt);
+      if (!cell)
+        return result_type();
+
+      return viennamesh::interpolate( cell.get(), pt, *quantities );
+    }
+
+    void mesh_quantity_functor::evaluate( std::size_t count, int dimension,
+                                          CoordType const * coords, CoordType * results, char * valid ) const
+    {
+      std::vector<long> cell_indices(count);
+      if (count)
+        ii->locate( count, dimension, coords, &cell_indices[0] );
 
-      for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+      PointType pt(dimension);
+      for (std::size_t i = 0; i != count; ++i)
       {
-        gradient_accessor.set(*cit, viennamesh::gradient(*cit, quantities));
+        valid[i] = 0;
+        results[i] = CoordType(0);
+        if (cell_indices[i] < 0)
+          continue;
+
+        for (int d = 0; d != dimension; ++d)
+          pt[d] = coords[d*count+i];
+
+        result_type value = viennamesh::interpolate( ii->cell(cell_indices[i]), pt, *quantities );
+        if (value)
+        {
+          valid[i] = 1;
+          results[i] = value.get();
+        }
       }
+    }
+
+
+
 
-      ii = make_shared<fast_is_inside>( mesh, resolution_x, resolution_y, mesh_bounding_box_scale, cell_scale );
+
+
+
+
+    mesh_gradient_functor::mesh_gradient_functor( std::string const & filename, std::string const & quantity_name,
+                            std::vector<int> const & resolution,
+                            double mesh_bounding_box_scale, double cell_scale )
+    {
+      background = background_mesh::get(filename);
+      gradient_accessor = &background->cell_gradient(quantity_name);
+      ii = background->locator( resolution, mesh_bounding_box_scale, cell_scale );
     }
 
 
     mesh_gradient_functor::result_type mesh_gradient_functor::operator()( PointType const & pt ) const
     {
-      fast_is_inside::ElementContainerType cells = (*ii)(pt);
-      if (cells.empty())
+      optional<ElementType> cell = ii->locate(pt);
+      if (!cell)
         return result_type();
 
-      CoordType result = gradient_accessor.get(cells[0]);
+      CoordType result = gradient_accessor->get(cell.get());
       return result;
     }
 
+    void mesh_gradient_functor::evaluate( std::size_t count, int dimension,
+                                          CoordType const * coords, CoordType * results, char * valid ) const
+    {
+      std::vector<long> cell_indices(count);
+      if (count)
+        ii->locate( count, dimension, coords, &cell_indices[0] );
+
+      for (std::size_t i = 0; i != count; ++i)
+      {
+        valid[i] = cell_indices[i] < 0 ? 0 : 1;
+        results[i] = cell_indices[i] < 0 ? CoordType(0) : gradient_accessor->get( ii->cell(cell_indices[i]) );
+      }
+    }
+
 
 
 
@@ -258,13 +741,51 @@ namespace viennamesh
     distance_to_interface_functor::distance_to_interface_functor( MeshType const & mesh_,
                                     std::string const & region0_name,
                                     std::string const & region1_name ) :
-                                    mesh(mesh_),
-                                    region0( mesh.get_region(region0_name) ), region1( mesh.get_region(region1_name) ),
-                                    facet_dimension(viennagrid::facet_dimension(mesh_)) {}
+                                    mesh(mesh_), no_interface_distance(-1)
+    {
+      typedef viennagrid::result_of::const_element_range<RegionType>::type ConstElementRangeType;
+      typedef viennagrid::result_of::iterator<ConstElementRangeType>::type ConstElementIteratorType;
+
+      RegionType region0 = mesh.get_region(region0_name);
+      RegionType region1 = mesh.get_region(region1_name);
+
+      ConstElementRangeType elements(region0, viennagrid::facet_dimension(mesh));
+      if (elements.empty())
+        no_interface_distance = CoordType();
+
+      std::vector<ElementType> tmp;
+      for (ConstElementIteratorType eit = elements.begin(); eit != elements.end(); ++eit)
+      {
+        if (is_boundary(region1, *eit))
+          tmp.push_back(*eit);
+      }
+
+      interface_elements = make_shared<InterfaceElementTreeType>( tmp.begin(), tmp.end() );
+    }
 
     distance_to_interface_functor::result_type distance_to_interface_functor::operator()( PointType const & pt ) const
     {
-      return distance_to_interface( pt, region0, region1, facet_dimension );
+      if (interface_elements->empty())
+        return no_interface_distance;
+
+      CoordType min_distance;
+      interface_elements->nearest(pt, min_distance);
+      return min_distance;
+    }
+
+    void distance_to_interface_functor::evaluate( std::size_t count, int dimension,
+                                                  CoordType const * coords, CoordType * results, char * valid ) const
+    {
+      std::fill( valid, valid + count, 1 );
+      if (interface_elements->empty())
+      {
+        std::fill( results, results + count, no_interface_distance );
+        return;
+      }
+
+      std::vector<int> indices(count);
+      if (count)
+        interface_elements->nearest( count, dimension, coords, &indices[0], results );
     }
 
 
@@ -275,7 +796,7 @@ namespace viennamesh
     distance_to_region_boundaries_functor::distance_to_region_boundaries_functor(MeshType const & mesh_,
                                             std::vector<std::string> const & region_names,
                                             viennagrid_dimension topologic_dimension) :
-                                            mesh(mesh_), boundary_elements(new BoundaryElementContainer)
+                                            mesh(mesh_)
     {
       typedef viennagrid::result_of::const_element_range<RegionType>::type ConstElementRangeType;
       typedef viennagrid::result_of::iterator<ConstElementRangeType>::type ConstElementIterator;
@@ -313,6 +834,7 @@ namespace viennamesh
         }
       }
 
+      std::vector<ElementType> tmp;
       for (ConstElementIterator fit = elements.begin(); fit != elements.end(); ++fit)
       {
         bool is_on_all_boundaries = true;
@@ -326,10 +848,10 @@ namespace viennamesh
         }
 
         if (is_on_all_boundaries)
-          boundary_elements->push_back( *fit );
+          tmp.push_back( *fit );
       }
 
-      if (boundary_elements->empty())
+      if (tmp.empty())
       {
         std::stringstream ss;
 
@@ -344,74 +866,122 @@ namespace viennamesh
 
         VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION,ss.str());
       }
+
+      boundary_elements = make_shared<BoundaryElementTreeType>( tmp.begin(), tmp.end() );
     }
 
 
     distance_to_region_boundaries_functor::result_type distance_to_region_boundaries_functor::operator()( PointType const & pt ) const
     {
-      result_type min_distance;
+      CoordType min_distance;
+      if (boundary_elements->nearest(pt, min_distance) < 0)
+        return result_type();
 
-      for (BoundaryElementContainer::const_iterator beit = boundary_elements->begin();
-                                                    beit != boundary_elements->end();
-                                                    ++beit)
-      {
-        CoordType current_distance = viennagrid::distance(pt, *beit);
+      return min_distance;
+    }
 
-        if (!min_distance || current_distance < min_distance.get())
-          min_distance = current_distance;
-      }
+    void distance_to_region_boundaries_functor::evaluate( std::size_t count, int dimension,
+                                                          CoordType const * coords, CoordType * results, char * valid ) const
+    {
+      std::vector<int> indices(count);
+      if (count)
+        boundary_elements->nearest( count, dimension, coords, &indices[0], results );
 
-      return min_distance;
+      for (std::size_t i = 0; i != count; ++i)
+      {
+        valid[i] = indices[i] < 0 ? 0 : 1;
+        if (indices[i] < 0)
+          results[i] = CoordType(0);
+      }
     }
 
 
 
 
 
-    local_feature_size_2d_functor::result_type local_feature_size_2d_functor::operator()( PointType const & pt ) const
+    struct line_distance_functor
     {
-      typedef viennagrid::result_of::const_element_range<MeshType>::type ConstVertexRangeType;
-//         typedef typename viennagrid::result_of::iterator<ConstVertexRangeType>::type ConstVertexRangeIterator;
+      typedef viennagrid::result_of::element<viennagrid::mesh>::type ElementType;
+      typedef viennagrid::result_of::point<viennagrid::mesh>::type PointType;
+      typedef viennagrid::result_of::coord<PointType>::type CoordType;
+
+      CoordType operator()(PointType const & pt, ElementType const & line) const
+      { return viennagrid::distance(line, pt); }
+    };
+
+    // The local feature size is the minimum over all pairs of boundary lines without
+    // a common vertex of the larger distance of the two lines. Visiting the lines
+    // in order of increasing distance, it is the distance of the first line which
+    // does not share a vertex with every line visited before.
+    struct local_feature_size_visitor
+    {
+      typedef line_distance_functor::CoordType CoordType;
+      typedef std::vector< std::pair<int, int> > LineVertexContainerType;
 
-      typedef viennagrid::result_of::const_element_range<MeshType>::type ConstLineRangeType;
-      typedef viennagrid::result_of::iterator<ConstLineRangeType>::type ConstLineRangeIterator;
+      local_feature_size_visitor(LineVertexContainerType const & line_vertices_) :
+          line_vertices(line_vertices_), visited_count(0) {}
 
-      ConstVertexRangeType vertices( mesh, 0 );
-      ConstLineRangeType lines( mesh, 1 );
+      bool operator()(std::size_t index, CoordType distance)
+      {
+        std::pair<int, int> const & line = line_vertices[index];
+
+        // lines connecting the same two vertices are counted at both vertices
+        std::size_t adjacent_count = vertex_line_count[line.first] + vertex_line_count[line.second] - edge_line_count[line];
+        if (adjacent_count < visited_count)
+        {
+          lfs = distance;
+          return true;
+        }
 
-      result_type lfs;
+        ++vertex_line_count[line.first];
+        ++vertex_line_count[line.second];
+        ++edge_line_count[line];
+        ++visited_count;
 
-      for (ConstLineRangeIterator lit0 = lines.begin(); lit0 != lines.end(); ++lit0)
-      {
-        if (!viennagrid::is_any_boundary(*lit0))
-          continue;
+        return false;
+      }
 
-        CoordType distance_to_lit0 = viennagrid::distance(*lit0, pt);
+      LineVertexContainerType const & line_vertices;
 
-        ConstLineRangeIterator lit1 = lit0; ++lit1;
-        for (; lit1 != lines.end(); ++lit1)
-        {
-          if (!viennagrid::is_any_boundary(*lit1))
-            continue;
+      std::map<int, std::size_t> vertex_line_count;
+      std::map<std::pair<int, int>, std::size_t> edge_line_count;
+      std::size_t visited_count;
 
-          if (viennagrid::vertices(*lit0)[0] == viennagrid::vertices(*lit1)[0] ||
-              viennagrid::vertices(*lit0)[0] == viennagrid::vertices(*lit1)[1] ||
-              viennagrid::vertices(*lit0)[1] == viennagrid::vertices(*lit1)[0] ||
-              viennagrid::vertices(*lit0)[1] == viennagrid::vertices(*lit1)[1])
-          {
-            continue;
-          }
+      optional<CoordType> lfs;
+    };
 
-          CoordType distance_to_lit1 = viennagrid::distance(*lit1, pt);
-          CoordType max_distance = std::max(distance_to_lit0, distance_to_lit1);
 
-          if (!lfs || max_distance < lfs.get())
-            lfs = max_distance;
-        }
+    local_feature_size_2d_functor::local_feature_size_2d_functor( MeshType const & mesh_ ) : mesh(mesh_)
+    {
+      typedef viennagrid::result_of::const_element_range<MeshType>::type ConstLineRangeType;
+      typedef viennagrid::result_of::iterator<ConstLineRangeType>::type ConstLineRangeIterator;
+
+      std::vector<ElementType> tmp;
+
+      ConstLineRangeType lines( mesh, 1 );
+      for (ConstLineRangeIterator lit = lines.begin(); lit != lines.end(); ++lit)
+      {
+        if (viennagrid::is_any_boundary(*lit))
+          tmp.push_back(*lit);
+      }
+
+      boundary_lines = make_shared<BoundaryLineTreeType>( tmp.begin(), tmp.end() );
 
+      line_vertices = make_shared<LineVertexContainerType>();
+      line_vertices->reserve( boundary_lines->size() );
+      for (std::size_t i = 0; i != boundary_lines->size(); ++i)
+      {
+        int v0 = viennagrid::vertices(boundary_lines->element(i))[0].id().index();
+        int v1 = viennagrid::vertices(boundary_lines->element(i))[1].id().index();
+        line_vertices->push_back( std::make_pair(std::min(v0, v1), std::max(v0, v1)) );
       }
+    }
 
-      return lfs;
+    local_feature_size_2d_functor::result_type local_feature_size_2d_functor::operator()( PointType const & pt ) const
+    {
+      local_feature_size_visitor visitor(*line_vertices);
+      boundary_lines->for_each_by_distance(pt, line_distance_functor(), visitor);
+      return visitor.lfs;
     }
 
 
@@ -448,25 +1018,98 @@ namespace viennamesh
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION,ss.str());
         }
       }
-    }
-
 
-    is_in_regions_functor::result_type is_in_regions_functor::operator()( PointType const & pt ) const
-    {
       typedef viennagrid::result_of::const_cell_range<RegionType>::type ConstCellRangeType;
       typedef viennagrid::result_of::iterator<ConstCellRangeType>::type ConstCellIteratorType;
 
+      std::vector<ElementType> tmp;
       for (unsigned int i = 0; i < region_names.size(); ++i)
       {
         ConstCellRangeType cells( mesh.get_region(region_names[i]) );
         for (ConstCellIteratorType cit = cells.begin(); cit != cells.end(); ++cit)
+          tmp.push_back(*cit);
+      }
+
+      region_cells = make_shared<RegionCellTreeType>( tmp.begin(), tmp.end() );
+    }
+
+
+    struct is_inside_visitor
+    {
+      typedef aabb_tree<viennagrid::result_of::element<viennagrid::mesh>::type> TreeType;
+      typedef viennagrid::result_of::point<viennagrid::mesh>::type PointType;
+
+      is_inside_visitor(TreeType const & tree_, PointType const & pt_) : tree(tree_), pt(pt_), hit(-1) {}
+
+      bool operator()(std::size_t index)
+      {
+        if ( !viennagrid::is_inside(tree.element(index), pt) )
+          return false;
+
+        hit = index;
+        return true;
+      }
+
+      TreeType const & tree;
+      PointType const & pt;
+      long hit;
+    };
+
+
+    is_in_regions_functor::result_type is_in_regions_functor::operator()( PointType const & pt ) const
+    {
+      // consecutive queries are usually close to each other, try the last hit cell of this thread first,
+      // the hint is keyed by the tree which is shared by all copies of the functor
+      long start = get_location_hint(region_cells.get());
+      if (start >= 0 && start < static_cast<long>(region_cells->size()) &&
+          viennagrid::is_inside(region_cells->element(start), pt))
+        return function(pt);
+
+      is_inside_visitor visitor(*region_cells, pt);
+      if (region_cells->for_each_containing(pt, visitor))
+      {
+        set_location_hint(region_cells.get(), visitor.hit);
+        return function(pt);
+      }
+
+      return result_type();
+    }
+
+    void is_in_regions_functor::evaluate( std::size_t count, int dimension,
+                                          CoordType const * coords, CoordType * results, char * valid ) const
+    {
+      // the batch is walked from the previous hit, with one hint update at the end
+      long hint = get_location_hint(region_cells.get());
+      if (hint >= static_cast<long>(region_cells->size()))
+        hint = -1;
+
+      PointType pt(dimension);
+      for (std::size_t i = 0; i != count; ++i)
+      {
+        valid[i] = 0;
+        results[i] = CoordType(0);
+
+        for (int d = 0; d != dimension; ++d)
+          pt[d] = coords[d*count+i];
+
+        if ( hint < 0 || !viennagrid::is_inside(region_cells->element(hint), pt) )
+        {
+          is_inside_visitor visitor(*region_cells, pt);
+          if (!region_cells->for_each_containing(pt, visitor))
+            continue;
+          hint = visitor.hit;
+        }
+
+        result_type value = function(pt);
+        if (value)
         {
-          if ( viennagrid::is_inside( *cit, pt ) )
-            return function(pt);
+          valid[i] = 1;
+          results[i] = value.get();
         }
       }
 
-      return result_type();
+      if (hint >= 0)
+        set_location_hint(region_cells.get(), hint);
     }
 
 
@@ -543,7 +1186,7 @@ namespace viennamesh
         if (!current)
           continue;
 
-        if (val)
+        if (!val)
           val = current;
         else if (current.get() > val.get())
           val = current;
@@ -561,9 +1204,334 @@ namespace viennamesh
 
 
 
-    base_functor::function_type from_xml(pugi::xml_node const & node,
-                                         viennagrid::const_mesh const & mesh,
-                                         std::string const & base_path)
+    void base_functor::evaluate( std::size_t count, int dimension,
+                                 CoordType const * coords, CoordType * results, char * valid ) const
+    {
+      PointType pt(dimension);
+      for (std::size_t i = 0; i != count; ++i)
+      {
+        for (int d = 0; d != dimension; ++d)
+          pt[d] = coords[d*count+i];
+
+        result_type value = (*this)(pt);
+        valid[i] = value ? 1 : 0;
+        results[i] = value ? value.get() : CoordType(0);
+      }
+    }
+
+
+
+
+    namespace
+    {
+      typedef program::CoordType ProgramCoordType;
+
+      struct add_op { ProgramCoordType operator()(ProgramCoordType lhs, ProgramCoordType rhs) const { return lhs + rhs; } };
+      struct mul_op { ProgramCoordType operator()(ProgramCoordType lhs, ProgramCoordType rhs) const { return lhs * rhs; } };
+      struct min_op { ProgramCoordType operator()(ProgramCoordType lhs, ProgramCoordType rhs) const { return rhs < lhs ? rhs : lhs; } };
+      struct max_op { ProgramCoordType operator()(ProgramCoordType lhs, ProgramCoordType rhs) const { return rhs > lhs ? rhs : lhs; } };
+
+      // combines operand into accumulator, values without valid flag are ignored
+      template<typename OpT>
+      void fold(std::size_t count,
+                ProgramCoordType * accumulator, char * accumulator_valid,
+                ProgramCoordType const * operand, char const * operand_valid, OpT op)
+      {
+        for (std::size_t i = 0; i != count; ++i)
+        {
+          if (!operand_valid[i])
+            continue;
+
+          accumulator[i] = accumulator_valid[i] ? op(accumulator[i], operand[i]) : operand[i];
+          accumulator_valid[i] = 1;
+        }
+      }
+
+      struct program_functor
+      {
+        typedef program::result_type result_type;
+
+        program_functor(shared_ptr<program const> const & program__) : program_(program__) {}
+
+        result_type operator()(viennagrid::point const & pt) const
+        { return (*program_)(pt); }
+
+        shared_ptr<program const> program_;
+      };
+    }
+
+
+    void program::push_constant(CoordType value)
+    {
+      instruction inst;
+      inst.op = op_constant;
+      inst.operand_count = 0;
+      inst.index = parameters.size();
+
+      parameters.push_back(value);
+      instructions.push_back(inst);
+
+      max_stack_size = std::max(max_stack_size, ++stack_size);
+    }
+
+    void program::push_leaf(shared_ptr<base_functor const> const & leaf)
+    {
+      instruction inst;
+      inst.op = op_leaf;
+      inst.operand_count = 0;
+      inst.index = leaves.size();
+
+      leaves.push_back(leaf);
+      instructions.push_back(inst);
+
+      max_stack_size = std::max(max_stack_size, ++stack_size);
+    }
+
+    void program::push_operator(opcode op, int operand_count, std::vector<CoordType> const & op_parameters)
+    {
+      if (operand_count < 1 || operand_count > stack_size)
+        VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function program: invalid operand count" );
+
+      instruction inst;
+      inst.op = op;
+      inst.operand_count = operand_count;
+
+      // if all operands are constants, they are the last operand_count instructions
+      std::size_t first_operand = instructions.size() - operand_count;
+      bool constant_operands = true;
+      for (std::size_t i = first_operand; i != instructions.size(); ++i)
+        constant_operands = constant_operands && instructions[i].op == op_constant;
+
+      if (constant_operands)
+      {
+        program folded;
+        for (std::size_t i = first_operand; i != instructions.size(); ++i)
+          folded.push_constant( parameters[instructions[i].index] );
+
+        inst.index = folded.parameters.size();
+        folded.parameters.insert( folded.parameters.end(), op_parameters.begin(), op_parameters.end() );
+        folded.instructions.push_back(inst);
+
+        CoordType value;
+        char valid;
+        folded.evaluate(1, 0, NULL, &value, &valid);
+
+        if (valid)
+        {
+          // the parameters of the operand constants are the last parameters
+          parameters.resize( instructions[first_operand].index );
+          instructions.resize( first_operand );
+          stack_size -= operand_count;
+
+          push_constant(value);
+          return;
+        }
+      }
+
+      inst.index = parameters.size();
+      parameters.insert( parameters.end(), op_parameters.begin(), op_parameters.end() );
+      instructions.push_back(inst);
+
+      stack_size -= operand_count-1;
+    }
+
+
+    void program::execute(instruction const & inst, std::size_t count, int dimension, CoordType const * coords,
+                          CoordType * values, char * valid, int & top) const
+    {
+      if (inst.op == op_constant)
+      {
+        std::fill( values + top*count, values + (top+1)*count, parameters[inst.index] );
+        std::fill( valid + top*count, valid + (top+1)*count, 1 );
+        ++top;
+        return;
+      }
+
+      if (inst.op == op_leaf)
+      {
+        leaves[inst.index]->evaluate( count, dimension, coords, values + top*count, valid + top*count );
+        ++top;
+        return;
+      }
+
+      top -= inst.operand_count;
+
+      CoordType * result = values + top*count;
+      char * result_valid = valid + top*count;
+      CoordType const * parameter = inst.index < parameters.size() ? &parameters[inst.index] : NULL;
+
+      switch (inst.op)
+      {
+        case op_add:
+          for (int k = 1; k < inst.operand_count; ++k)
+            fold( count, result, result_valid, result + k*count, result_valid + k*count, add_op() );
+          break;
+
+        case op_mul:
+          for (int k = 1; k < inst.operand_count; ++k)
+            fold( count, result, result_valid, result + k*count, result_valid + k*count, mul_op() );
+          break;
+
+        case op_min:
+          for (int k = 1; k < inst.operand_count; ++k)
+            fold( count, result, result_valid, result + k*count, result_valid + k*count, min_op() );
+          break;
+
+        case op_max:
+          for (int k = 1; k < inst.operand_count; ++k)
+            fold( count, result, result_valid, result + k*count, result_valid + k*count, max_op() );
+          break;
+
+        case op_abs:
+          for (std::size_t i = 0; i != count; ++i)
+            result[i] = std::abs(result[i]);
+          break;
+
+        case op_less:
+          for (std::size_t i = 0; i != count; ++i)
+            result[i] = result[i] < parameter[0] ? 1.0 : 0.0;
+          break;
+
+        case op_greater:
+          for (std::size_t i = 0; i != count; ++i)
+            result[i] = result[i] > parameter[0] ? 1.0 : 0.0;
+          break;
+
+        case op_in_interval:
+          for (std::size_t i = 0; i != count; ++i)
+            result[i] = (parameter[0] < result[i] && result[i] < parameter[1]) ? 1.0 : 0.0;
+          break;
+
+        case op_linear_interpolate:
+          {
+            CoordType lower = parameter[0];
+            CoordType upper = parameter[1];
+            CoordType lower_to = parameter[2];
+            CoordType upper_to = parameter[3];
+
+            for (std::size_t i = 0; i != count; ++i)
+            {
+              CoordType x = result[i];
+              if (x < lower)
+                result[i] = lower_to;
+              else if (x >= upper)
+                result[i] = upper_to;
+              else
+                result[i] = lower_to + (x-lower)/(upper-lower)*(upper_to-lower_to);
+            }
+          }
+          break;
+
+        case op_mask:
+          for (std::size_t i = 0; i != count; ++i)
+            result_valid[i] = result_valid[i] && result_valid[count+i];
+          break;
+
+        default:
+          break;
+      }
+
+      ++top;
+    }
+
+
+    void program::evaluate(std::size_t count, int dimension,
+                           CoordType const * coords, CoordType * results, char * valid) const
+    {
+      if (count == 0)
+        return;
+
+      if (instructions.empty())
+      {
+        std::fill( valid, valid + count, 0 );
+        return;
+      }
+
+      // small batches, e.g. the sample points of a mesher callback, don't allocate
+      static const std::size_t local_size = 64;
+      CoordType local_values[local_size];
+      char local_valid[local_size];
+
+      std::vector<CoordType> heap_values;
+      std::vector<char> heap_valid;
+
+      CoordType * stack_values = local_values;
+      char * stack_valid = local_valid;
+
+      std::size_t required_size = max_stack_size*count;
+      if (required_size > local_size)
+      {
+        heap_values.resize(required_size);
+        heap_valid.resize(required_size);
+        stack_values = &heap_values[0];
+        stack_valid = &heap_valid[0];
+      }
+
+      int top = 0;
+      for (std::size_t i = 0; i != instructions.size(); ++i)
+        execute( instructions[i], count, dimension, coords, stack_values, stack_valid, top );
+
+      std::copy( stack_values, stack_values + count, results );
+      std::copy( stack_valid, stack_valid + count, valid );
+    }
+
+
+    program::result_type program::operator()(viennagrid::point const & pt) const
+    {
+      CoordType value;
+      char valid;
+      evaluate( 1, pt.size(), pt.size() ? &pt[0] : NULL, &value, &valid );
+
+      if (!valid)
+        return result_type();
+      return value;
+    }
+
+
+    program::function_type program::function() const
+    {
+      if (is_constant())
+        return bind( constant_functor(parameters[instructions[0].index]), _1 );
+
+      return program_functor( make_shared<program>(*this) );
+    }
+
+
+
+
+
+
+
+
+
+
+    // grid resolution of the background mesh point location, resolution_y and
+    // resolution_z default to the value of the preceding axis
+    std::vector<int> resolution_from_xml(pugi::xml_node const & node)
+    {
+      std::vector<int> resolution;
+
+      resolution.push_back(100);
+      if ( node.child("resolution_x") )
+        resolution.back() = lexical_cast<int>(node.child_value("resolution_x"));
+
+      resolution.push_back(resolution.back());
+      if ( node.child("resolution_y") )
+        resolution.back() = lexical_cast<int>(node.child_value("resolution_y"));
+
+      resolution.push_back(resolution.back());
+      if ( node.child("resolution_z") )
+        resolution.back() = lexical_cast<int>(node.child_value("resolution_z"));
+
+      return resolution;
+    }
+
+
+    // appends the postfix code of the functor described by node to result
+    void append_xml(pugi::xml_node const & node,
+                    viennagrid::const_mesh const & mesh,
+                    std::string const & base_path,
+                    program & result)
     {
       std::string name = node.name();
 
@@ -573,99 +1541,65 @@ namespace viennamesh
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"value\" missing" );
 
         double value = lexical_cast<double>(node.child_value("value"));
-        return bind( constant_functor(value), _1 );
+        result.push_constant(value);
       }
       else if (name == "abs")
       {
         if ( !node.child_value("source") )
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"source\" missing" );
 
-        base_functor::function_type source = from_xml(node.child("source").first_child(), mesh, base_path);
-
-        return bind(abs_functor(source), _1);
+        append_xml(node.child("source").first_child(), mesh, base_path, result);
+        result.push_operator(program::op_abs, 1);
       }
-      else if (name == "less")
+      else if (name == "less" || name == "greater")
       {
         if ( !node.child_value("source") )
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"source\" missing" );
-        base_functor::function_type source = from_xml(node.child("source").first_child(), mesh, base_path);
+        append_xml(node.child("source").first_child(), mesh, base_path, result);
 
         if ( !node.child_value("threshold") )
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"threshold\" missing" );
-        double threshold = lexical_cast<double>(node.child_value("threshold"));
-
-        return bind(less_functor(source, threshold), _1);
-      }
-      else if (name == "greater")
-      {
-        if ( !node.child_value("source") )
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"source\" missing" );
-        base_functor::function_type source = from_xml(node.child("source").first_child(), mesh, base_path);
 
-        if ( !node.child_value("threshold") )
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"threshold\" missing" );
-        double threshold = lexical_cast<double>(node.child_value("threshold"));
+        std::vector<double> parameters;
+        parameters.push_back( lexical_cast<double>(node.child_value("threshold")) );
 
-        return bind(greater_functor(source, threshold), _1);
+        result.push_operator(name == "less" ? program::op_less : program::op_greater, 1, parameters);
       }
       else if (name == "in_interval")
       {
         if ( !node.child_value("source") )
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"source\" missing" );
-        base_functor::function_type source = from_xml(node.child("source").first_child(), mesh, base_path);
+        append_xml(node.child("source").first_child(), mesh, base_path, result);
 
         if ( !node.child_value("lower") )
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"threshold\" missing" );
-        double lower = lexical_cast<double>(node.child_value("lower"));
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"lower\" missing" );
         if ( !node.child_value("upper") )
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"threshold\" missing" );
-        double upper = lexical_cast<double>(node.child_value("upper"));
-
-        return bind(in_interval_functor(source, lower, upper), _1);
-      }
-      else if (name == "add")
-      {
-        std::vector<base_functor::function_type> functions;
-        for (pugi::xml_node source = node.child("source"); source; source = source.next_sibling("source"))
-          functions.push_back( from_xml(source.first_child(), mesh, base_path) );
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"upper\" missing" );
 
-        if (functions.empty())
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": no sources specified" );
-
-        return bind( add_functor(functions), _1 );
-      }
-      else if (name == "mul")
-      {
-        std::vector<base_functor::function_type> functions;
-        for (pugi::xml_node source = node.child("source"); source; source = source.next_sibling("source"))
-          functions.push_back( from_xml(source.first_child(), mesh, base_path) );
+        std::vector<double> parameters;
+        parameters.push_back( lexical_cast<double>(node.child_value("lower")) );
+        parameters.push_back( lexical_cast<double>(node.child_value("upper")) );
 
-        if (functions.empty())
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": no sources specified" );
-
-        return bind( mul_functor(functions), _1 );
+        result.push_operator(program::op_in_interval, 1, parameters);
       }
-      else if (name == "min")
+      else if (name == "add" || name == "mul" || name == "min" || name == "max")
       {
-        std::vector<base_functor::function_type> functions;
-        for (pugi::xml_node source = node.child("source"); source; source = source.next_sibling("source"))
-          functions.push_back( from_xml(source.first_child(), mesh, base_path) );
+        int source_count = 0;
+        for (pugi::xml_node source = node.child("source"); source; source = source.next_sibling("source"), ++source_count)
+          append_xml(source.first_child(), mesh, base_path, result);
 
-        if (functions.empty())
+        if (source_count == 0)
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": no sources specified" );
 
-        return bind( min_functor(functions), _1 );
-      }
-      else if (name == "max")
-      {
-        std::vector<base_functor::function_type> functions;
-        for (pugi::xml_node source = node.child("source"); source; source = source.next_sibling("source"))
-          functions.push_back( from_xml(source.first_child(), mesh, base_path) );
-
-        if (functions.empty())
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": no sources specified" );
+        program::opcode op = program::op_add;
+        if (name == "mul")
+          op = program::op_mul;
+        else if (name == "min")
+          op = program::op_min;
+        else if (name == "max")
+          op = program::op_max;
 
-        return bind( max_functor(functions), _1 );
+        result.push_operator(op, source_count);
       }
       else if (name == "interpolate")
       {
@@ -675,28 +1609,27 @@ namespace viennamesh
         if ( !node.child_value("source") )
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"source\" missing" );
 
-        base_functor::function_type source = from_xml(node.child("source").first_child(), mesh, base_path);
+        if (transform_type != "linear")
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": transform type \"" + transform_type + "\" not supported" );
 
-        if (transform_type == "linear")
-        {
-          if ( !node.child_value("lower") )
-            VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"lower\" missing" );
-          if ( !node.child_value("upper") )
-            VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"upper\" missing" );
-          if ( !node.child_value("lower_to") )
-            VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"lower_to\" missing" );
-          if ( !node.child_value("upper_to") )
-            VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"upper_to\" missing" );
-
-          double lower = lexical_cast<double>(node.child_value("lower"));
-          double upper = lexical_cast<double>(node.child_value("upper"));
-          double lower_to = lexical_cast<double>(node.child_value("lower_to"));
-          double upper_to = lexical_cast<double>(node.child_value("upper_to"));
-
-          return bind(linear_interpolate_functor(source, lower, upper, lower_to, upper_to ), _1);
-        }
+        append_xml(node.child("source").first_child(), mesh, base_path, result);
 
-        return base_functor::function_type();
+        if ( !node.child_value("lower") )
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"lower\" missing" );
+        if ( !node.child_value("upper") )
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"upper\" missing" );
+        if ( !node.child_value("lower_to") )
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"lower_to\" missing" );
+        if ( !node.child_value("upper_to") )
+          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"upper_to\" missing" );
+
+        std::vector<double> parameters;
+        parameters.push_back( lexical_cast<double>(node.child_value("lower")) );
+        parameters.push_back( lexical_cast<double>(node.child_value("upper")) );
+        parameters.push_back( lexical_cast<double>(node.child_value("lower_to")) );
+        parameters.push_back( lexical_cast<double>(node.child_value("upper_to")) );
+
+        result.push_operator(program::op_linear_interpolate, 1, parameters);
       }
       else if (name == "distance_to_region_boundaries")
       {
@@ -709,9 +1642,9 @@ namespace viennamesh
 
         std::string element_type = node.child_value("element_type");
         if (element_type == "line")
-          return bind( distance_to_region_boundaries_functor(mesh, region_names, 1), _1 );
+          result.push_leaf( make_shared<distance_to_region_boundaries_functor>(mesh, region_names, 1) );
         else if (element_type == "facet")
-          return bind( distance_to_region_boundaries_functor(mesh, region_names, viennagrid::facet_dimension(mesh)), _1 );
+          result.push_leaf( make_shared<distance_to_region_boundaries_functor>(mesh, region_names, viennagrid::facet_dimension(mesh)) );
         else
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "distance_to_region_boundaries: Element type \"" + element_type + "\" not supported" );
       }
@@ -724,11 +1657,11 @@ namespace viennamesh
         if (region_names.empty())
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": no region names specified" );
 
-        return bind( distance_to_interface_functor(mesh, region_names[0], region_names[1]), _1 );
+        result.push_leaf( make_shared<distance_to_interface_functor>(mesh, region_names[0], region_names[1]) );
       }
       else if (name == "local_feature_size_2d")
       {
-        return bind( local_feature_size_2d_functor(mesh), _1 );
+        result.push_leaf( make_shared<local_feature_size_2d_functor>(mesh) );
       }
       else if (name == "is_in_regions")
       {
@@ -736,11 +1669,14 @@ namespace viennamesh
         for (pugi::xml_node region = node.child("region"); region; region = region.next_sibling("region"))
           region_names.push_back( region.text().as_string() );
 
-        base_functor::function_type source = from_xml(node.child("source").first_child(), mesh, base_path);
+        append_xml(node.child("source").first_child(), mesh, base_path, result);
 
-        return bind( is_in_regions_functor(mesh, region_names, source), _1 );
+        // the source is masked by a leaf which only has a value inside the regions
+        base_functor::function_type inside = bind( constant_functor(1.0), _1 );
+        result.push_leaf( make_shared<is_in_regions_functor>(mesh, region_names, inside) );
+        result.push_operator(program::op_mask, 2);
       }
-      else if (name == "mesh_quantity")
+      else if (name == "mesh_quantity" || name == "mesh_gradient")
       {
         if ( !node.child_value("mesh_file") )
           VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"mesh_file\" missing" );
@@ -753,12 +1689,7 @@ namespace viennamesh
 
         std::string quantity_name = node.child_value("quantity_name");
 
-        int resolution_x = 100;
-        if ( node.child("resolution_x") )
-          resolution_x = lexical_cast<int>(node.child_value("resolution_x"));
-        int resolution_y = 100;
-        if ( node.child("resolution_x") )
-          resolution_y = lexical_cast<int>(node.child_value("resolution_x"));
+        std::vector<int> resolution = resolution_from_xml(node);
 
         double mesh_bounding_box_scale = 1.01;
         if ( node.child("mesh_bounding_box_scale") )
@@ -767,40 +1698,50 @@ namespace viennamesh
         if ( node.child("cell_scale") )
           cell_scale = lexical_cast<double>(node.child_value("cell_scale"));
 
-        return bind( mesh_quantity_functor(mesh_file, quantity_name, resolution_x, resolution_y, mesh_bounding_box_scale, cell_scale), _1 );
+        if (name == "mesh_quantity")
+          result.push_leaf( make_shared<mesh_quantity_functor>(mesh_file, quantity_name, resolution, mesh_bounding_box_scale, cell_scale) );
+        else
+          result.push_leaf( make_shared<mesh_gradient_functor>(mesh_file, quantity_name, resolution, mesh_bounding_box_scale, cell_scale) );
       }
-      else if (name == "mesh_gradient")
-      {
-        if ( !node.child_value("mesh_file") )
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"mesh_file\" missing" );
-        if ( !node.child_value("quantity_name") )
-          VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\": required XML child element \"quantity_name\" missing" );
+      else
+        VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\" not supported" );
+    }
 
-        std::string mesh_file = node.child_value("mesh_file");
-        if (!base_path.empty())
-          mesh_file = base_path + "/" + mesh_file;
 
-        std::string quantity_name = node.child_value("quantity_name");
+    program program_from_xml(pugi::xml_node const & node,
+                             viennagrid::const_mesh const & mesh,
+                             std::string const & base_path)
+    {
+      program result;
+      append_xml(node, mesh, base_path, result);
+      return result;
+    }
+
+    program program_from_xml(std::string const & xml_string,
+                             viennagrid::const_mesh const & mesh,
+                             std::string const & base_path)
+    {
+      pugi::xml_document sf_xml;
+      sf_xml.load( xml_string.c_str() );
+      return program_from_xml( sf_xml.first_child(), mesh, base_path );
+    }
 
-        int resolution_x = 100;
-        if ( node.child("resolution_x") )
-          resolution_x = lexical_cast<int>(node.child_value("resolution_x"));
-        int resolution_y = 100;
-        if ( node.child("resolution_x") )
-          resolution_y = lexical_cast<int>(node.child_value("resolution_x"));
+    program program_from_xmlfile(std::string const & xml_filename,
+                                 viennagrid::const_mesh const & mesh,
+                                 std::string const & base_path)
+    {
+      pugi::xml_document sf_xml;
+      sf_xml.load_file( xml_filename.c_str() );
+      return program_from_xml( sf_xml.first_child(), mesh, base_path );
+    }
 
-        double mesh_bounding_box_scale = 1.01;
-        if ( node.child("mesh_bounding_box_scale") )
-          mesh_bounding_box_scale = lexical_cast<double>(node.child_value("mesh_bounding_box_scale"));
-        double cell_scale = 1.01;
-        if ( node.child("cell_scale") )
-          cell_scale = lexical_cast<double>(node.child_value("cell_scale"));
 
-        return bind( mesh_gradient_functor(mesh_file, quantity_name, resolution_x, resolution_y, mesh_bounding_box_scale, cell_scale), _1 );
-      }
 
-      VIENNAMESH_ERROR(VIENNAMESH_ERROR_SIZING_FUNCTION, "Sizing function functor \"" + name + "\" not supported" );
-      return base_functor::function_type();
+    base_functor::function_type from_xml(pugi::xml_node const & node,
+                                         viennagrid::const_mesh const & mesh,
+                                         std::string const & base_path)
+    {
+      return program_from_xml(node, mesh, base_path).function();
     }
 
     base_functor::function_type from_xml(std::string const & xml_string,
@@ -0,0 +1,101 @@
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+                    http://viennamesh.sourceforge.net/
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include "viennameshpp/core.hpp"
+#include "viennameshpp/timer.hpp"
+
+#include <tclap/CmdLine.h>
+
+int main(int argc, char **argv)
+{
+  typedef viennagrid::mesh                                              MeshType;
+  typedef viennagrid::result_of::const_vertex_range<MeshType>::type     ConstVertexRangeType;
+  typedef viennagrid::result_of::const_cell_range<MeshType>::type       ConstCellRangeType;
+
+  try
+  {
+    TCLAP::CmdLine cmd("Times the conversion of a triangle hull to a CGAL polyhedron and back (requires the CGAL plugin)", ' ', "1.0");
+
+    TCLAP::ValueArg<int> repetitions("r","repetitions", "Number of round trips (default is 10)", false, 10, "int");
+    cmd.add( repetitions );
+
+    TCLAP::UnlabeledValueArg<std::string> input_filename( "filename", "Mesh file name", true, "", "MeshFile"  );
+    cmd.add( input_filename );
+
+    cmd.parse( argc, argv );
+
+    viennamesh::context_handle context;
+
+    viennamesh::algorithm_handle mesh_reader = context.make_algorithm("mesh_reader");
+    mesh_reader.set_input( "filename", input_filename.getValue() );
+    mesh_reader.run();
+
+    viennamesh::data_handle<viennagrid_mesh> input_mesh = mesh_reader.get_output<viennagrid_mesh>("mesh");
+
+    viennautils::Timer timer;
+    double to_cgal_time = 0;
+    double from_cgal_time = 0;
+
+    MeshType output_mesh;
+
+    for (int i = 0; i != repetitions.getValue(); ++i)
+    {
+      // fresh wrappers every round trip, conversions are cached per wrapper
+      viennamesh_data_wrapper cgal_mesh;
+      if (viennamesh_data_wrapper_make(context.internal(), "cgal::mesh", &cgal_mesh) != VIENNAMESH_SUCCESS)
+      {
+        std::cerr << "error: data type cgal::mesh is not available, is the CGAL plugin loaded?" << std::endl;
+        return -1;
+      }
+
+      viennamesh::data_handle<viennagrid_mesh> back = context.make_data<viennagrid_mesh>();
+
+      timer.start();
+      viennamesh_error to_cgal_error = viennamesh_data_wrapper_convert(input_mesh.internal(), cgal_mesh);
+      to_cgal_time += timer.get();
+
+      if (to_cgal_error != VIENNAMESH_SUCCESS)
+      {
+        std::cerr << "error: conversion viennagrid -> CGAL failed" << std::endl;
+        viennamesh_data_wrapper_release(cgal_mesh);
+        return -1;
+      }
+
+      timer.start();
+      viennamesh_error from_cgal_error = viennamesh_data_wrapper_convert(cgal_mesh, back.internal());
+      from_cgal_time += timer.get();
+
+      if (from_cgal_error != VIENNAMESH_SUCCESS)
+      {
+        std::cerr << "error: conversion CGAL -> viennagrid failed" << std::endl;
+        viennamesh_data_wrapper_release(cgal_mesh);
+        return -1;
+      }
+
+      output_mesh = back();
+      viennamesh_data_wrapper_release(cgal_mesh);
+    }
+
+    MeshType mesh = input_mesh();
+
+    std::cout << "Vertices:             " << ConstVertexRangeType(mesh).size() << " -> " << ConstVertexRangeType(output_mesh).size() << std::endl;
+    std::cout << "Triangles:            " << ConstCellRangeType(mesh).size() << " -> " << ConstCellRangeType(output_mesh).size() << std::endl;
+    std::cout << "Round trips:          " << repetitions.getValue() << std::endl;
+    std::cout << "viennagrid -> CGAL:   " << to_cgal_time << "s" << std::endl;
+    std::cout << "CGAL -> viennagrid:   " << from_cgal_time << "s" << std::endl;
+  }
+  catch (TCLAP::ArgException &e)  // catch any exceptions
+  {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* ============================================================================
+   Copyright (c) 2011-2014, Institute for Microelectronics,
+                            Institute for Analysis and Scientific Computing,
+                            TU Wien.
+                            -----------------
+                ViennaMesh - The Vienna Meshing Framework
+                            -----------------
+                    http://viennamesh.sourceforge.net/
+   License:         MIT (X11), see file LICENSE in the base directory
+=============================================================================== */
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "viennameshpp/core.hpp"
+#include "viennameshpp/aabb_tree.hpp"
+#include "viennameshpp/timer.hpp"
+
+#include "viennagrid/algorithm/distance.hpp"
+#include "viennagrid/algorithm/geometry.hpp"
+
+#include <tclap/CmdLine.h>
+
+int main(int argc, char **argv)
+{
+  typedef viennagrid::mesh                                              MeshType;
+  typedef viennagrid::result_of::point<MeshType>::type                  PointType;
+  typedef viennagrid::result_of::coord<PointType>::type                 CoordType;
+  typedef viennagrid::result_of::element<MeshType>::type                ElementType;
+
+  typedef viennagrid::result_of::const_element_range<MeshType>::type    ConstElementRangeType;
+  typedef viennagrid::result_of::iterator<ConstElementRangeType>::type  ConstElementIteratorType;
+
+  try
+  {
+    TCLAP::CmdLine cmd("Compares the boundary distance query of the AABB tree against a linear scan", ' ', "1.0");
+
+    TCLAP::ValueArg<int> sample_count("n","samples", "Number of random query points (default is 10000)", false, 10000, "int");
+    cmd.add( sample_count );
+
+    TCLAP::UnlabeledValueArg<std::string> input_filename( "filename", "Mesh file name", true, "", "MeshFile"  );
+    cmd.add( input_filename );
+
+    cmd.parse( argc, argv );
+
+    viennamesh::context_handle context;
+
+    viennamesh::algorithm_handle mesh_reader = context.make_algorithm("mesh_reader");
+    mesh_reader.set_input( "filename", input_filename.getValue() );
+    mesh_reader.run();
+
+    MeshType mesh = mesh_reader.get_output<viennagrid_mesh>("mesh")();
+
+    std::vector<ElementType> boundary_facets;
+    ConstElementRangeType facets(mesh, viennagrid::facet_dimension(mesh));
+    for (ConstElementIteratorType fit = facets.begin(); fit != facets.end(); ++fit)
+    {
+      if (viennagrid::is_any_boundary(*fit))
+        boundary_facets.push_back(*fit);
+    }
+
+    if (boundary_facets.empty())
+    {
+      std::cerr << "error: mesh has no boundary facets" << std::endl;
+      return -1;
+    }
+
+    std::pair<PointType, PointType> bb = viennagrid::bounding_box(mesh);
+    PointType center = (bb.first+bb.second)/2.0;
+    PointType extent = bb.second-bb.first;
+
+    // query points are sampled from the doubled bounding box of the mesh
+    std::srand(0);
+    std::vector<PointType> samples( sample_count.getValue(), PointType(center.size()) );
+    for (std::size_t i = 0; i != samples.size(); ++i)
+      for (std::size_t d = 0; d != center.size(); ++d)
+        samples[i][d] = center[d] + extent[d] * (static_cast<double>(std::rand())/RAND_MAX - 0.5) * 2.0;
+
+    viennautils::Timer timer;
+
+    timer.start();
+    viennamesh::aabb_tree<ElementType> tree(boundary_facets.begin(), boundary_facets.end());
+    double build_time = timer.get();
+
+    std::vector<CoordType> linear_distances( samples.size() );
+    timer.start();
+    for (std::size_t i = 0; i != samples.size(); ++i)
+    {
+      CoordType min_distance = viennagrid::distance(samples[i], boundary_facets[0]);
+      for (std::size_t j = 1; j != boundary_facets.size(); ++j)
+        min_distance = std::min(min_distance, viennagrid::distance(samples[i], boundary_facets[j]));
+      linear_distances[i] = min_distance;
+    }
+    double linear_time = timer.get();
+
+    std::vector<CoordType> tree_distances( samples.size() );
+    timer.start();
+    for (std::size_t i = 0; i != samples.size(); ++i)
+      tree.nearest(samples[i], tree_distances[i]);
+    double tree_time = timer.get();
+
+    CoordType max_deviation = 0;
+    for (std::size_t i = 0; i != samples.size(); ++i)
+      max_deviation = std::max(max_deviation, std::abs(linear_distances[i]-tree_distances[i]));
+
+    std::cout << "Boundary facets:      " << boundary_facets.size() << std::endl;
+    std::cout << "Query points:         " << samples.size() << std::endl;
+    std::cout << "Tree build time:      " << build_time << "s" << std::endl;
+    std::cout << "Linear scan time:     " << linear_time << "s" << std::endl;
+    std::cout << "AABB tree query time: " << tree_time << "s" << std::endl;
+    if (tree_time > 0)
+      std::cout << "Speedup:              " << linear_time/tree_time << std::endl;
+    std::cout << "Max deviation:        " << max_deviation << std::endl;
+  }
+  catch (TCLAP::ArgException &e)  // catch any exceptions
+  {
+    std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+  }
+
+  return 0;
+}
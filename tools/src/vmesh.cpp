@@ -27,6 +27,12 @@ int main(int argc, char **argv)
     TCLAP::ValueArg<int> info_loglevel("i","info-loglevel", "Info Loglevel (default is 5)", false, 5, "int");
     cmd.add( info_loglevel );
 
+    TCLAP::ValueArg<int> jobs("j","jobs", "Number of worker threads for independent algorithms (default is 1, 0 uses all cores)", false, 1, "int");
+    cmd.add( jobs );
+
+    TCLAP::ValueArg<std::string> trace_filename("t","trace", "Write a per-algorithm wall-clock trace (CSV) to this file", false, "", "string");
+    cmd.add( trace_filename );
+
 
     TCLAP::UnlabeledValueArg<std::string> pipeline_filename( "filename", "Pipeline file name", true, "", "PipelineFile"  );
     cmd.add( pipeline_filename );
@@ -63,7 +69,16 @@ int main(int argc, char **argv)
     if (!path.empty())
       pipeline.set_base_path(path);
 
-    pipeline.run( true );
+    if (jobs.getValue() == 1)
+      pipeline.run( true );
+    else
+      pipeline.run_parallel( jobs.getValue(), true );
+
+    if ( !trace_filename.getValue().empty() )
+    {
+      pipeline.log_trace();
+      pipeline.write_trace( trace_filename.getValue() );
+    }
   }
   catch (TCLAP::ArgException &e)  // catch any exceptions
   {